@@ -3,7 +3,11 @@
 set -e
 
 ERASE=false
+SEQUENTIAL=false
 PORT_OPTION=""
+PROVISION_FILE=""
+ID_START=""
+LOCATION=""
 POSITIONAL=()
 
 # --- Helper: Show usage ---
@@ -15,9 +19,16 @@ Options:
   -e, --erase           Erase flash before uploading
   -p, --port PORT       Specify port(s) to flash:
                           1 or 2        - Flash to first or second detected port
-                          all or *      - Flash to all detected ports sequentially
+                          all or *      - Flash to all detected ports concurrently
                           /dev/ttyUSB0  - Flash to specific port path
                         If not specified, will use default or prompt if multiple ports found
+  -s, --sequential      Flash multiple ports one at a time instead of concurrently
+  -c, --provision FILE  Write per-board config (NVS) from a CSV file:
+                          port_or_mac,board_id,location,wifi_ssid,wifi_password,mqtt_server,mqtt_port,mqtt_server2,mqtt_port2
+                        Rows are matched by port path first, then by MAC address.
+                        Empty fields keep the firmware defaults from config.h.
+  -i, --id-start N      Assign board IDs N, N+1, ... in port order (no CSV needed)
+  -l, --location LOC    Location written with --id-start
   -h, --help            Show this help message
 
 Arguments:
@@ -27,6 +38,8 @@ Examples:
   $0                    # Flash current branch to default port
   $0 -p 1               # Flash to first detected port
   $0 -p all             # Flash to all detected ports
+  $0 -p all -c boards.csv   # Flash and provision every board from a CSV
+  $0 -p all -i 10 -l Yard   # Flash all, board IDs 10, 11, ... at location Yard
   $0 -p /dev/ttyUSB0    # Flash to specific port
   $0 -e main            # Erase and flash 'main' branch
 EOF
@@ -44,6 +57,22 @@ while [[ $# -gt 0 ]]; do
             PORT_OPTION="$2"
             shift 2
             ;;
+        -s|--sequential)
+            SEQUENTIAL=true
+            shift
+            ;;
+        -c|--provision)
+            PROVISION_FILE="$2"
+            shift 2
+            ;;
+        -i|--id-start)
+            ID_START="$2"
+            shift 2
+            ;;
+        -l|--location)
+            LOCATION="$2"
+            shift 2
+            ;;
         -h|--help)
             show_help
             ;;
@@ -127,9 +156,79 @@ get_flash_ports() {
     echo "${flash_ports[@]}"
 }
 
+# --- Build environment and artifacts ---
+BUILD_ENV=$(grep -m1 -o '^\[env:[^]]*' platformio.ini | cut -d: -f2)
+BUILD_DIR=".pio/build/$BUILD_ENV"
+LOG_DIR=".pio/flash-logs"
+
+esptool() {
+    pio pkg exec -p tool-esptoolpy -- esptool.py "$@"
+}
+
+# --- Build firmware and filesystem once, before any port is touched ---
+build_artifacts() {
+    echo "Building firmware ($BUILD_ENV)..."
+    pio run -e "$BUILD_ENV"
+    if [ -d "data" ]; then
+        echo "Building filesystem image..."
+        pio run -e "$BUILD_ENV" -t buildfs
+    fi
+}
+
+# --- Provisioning: find the CSV row for a port or MAC ---
+lookup_provision() {
+    local key="$1"
+    [ -z "$PROVISION_FILE" ] && return 1
+    grep -i -m1 "^${key}," "$PROVISION_FILE"
+}
+
+# --- Provisioning: write the board's NVS config image ---
+provision_port() {
+    local port="$1"
+    local index="$2"
+    local row=""
+    local board_id="" location="" ssid="" password="" mqtt_server="" mqtt_port=""
+    local mqtt_server2="" mqtt_port2=""
+
+    if [ -n "$PROVISION_FILE" ]; then
+        row=$(lookup_provision "$port") || true
+        if [ -z "$row" ]; then
+            local mac
+            mac=$(esptool --port "$port" read_mac | grep -m1 '^MAC:' | awk '{print $2}')
+            row=$(lookup_provision "$mac") || true
+        fi
+        if [ -z "$row" ]; then
+            echo "No provisioning entry for $port, keeping existing config"
+            return 0
+        fi
+        IFS=',' read -r _ board_id location ssid password mqtt_server mqtt_port \
+            mqtt_server2 mqtt_port2 <<< "$row"
+    elif [ -n "$ID_START" ]; then
+        board_id=$((ID_START + index))
+        location="$LOCATION"
+    else
+        return 0
+    fi
+
+    local nvs_bin="$LOG_DIR/nvs_$(basename "$port").bin"
+    local nvs_region
+    nvs_region=($(python3 nvs_image.py --partitions "$BUILD_DIR/partitions.bin" --print-offset))
+
+    local nvs_args=(-o "$nvs_bin" --size "${nvs_region[1]}" --board-id "$board_id"
+                    --location "$location" --wifi-ssid "$ssid" --wifi-password "$password"
+                    --mqtt-server "$mqtt_server" --mqtt-server2 "$mqtt_server2")
+    [ -n "$mqtt_port" ] && nvs_args+=(--mqtt-port "$mqtt_port")
+    [ -n "$mqtt_port2" ] && nvs_args+=(--mqtt-port2 "$mqtt_port2")
+
+    echo "Provisioning $port: board_id=$board_id location='$location'"
+    python3 nvs_image.py "${nvs_args[@]}"
+    esptool --port "$port" write_flash "${nvs_region[0]}" "$nvs_bin"
+}
+
 # --- Flash to a specific port ---
 flash_to_port() {
     local port="$1"
+    local index="$2"
     echo ""
     echo "========================================="
     echo "Flashing to port: $port"
@@ -138,18 +237,21 @@ flash_to_port() {
     # Optional erase
     if [ "$ERASE" = true ]; then
         echo "Erasing flash on $port..."
-        pio run --target erase --upload-port "$port"
+        pio run -e "$BUILD_ENV" -t nobuild -t erase --upload-port "$port"
     fi
     
     # Upload filesystem first if present
     if [ -d "data" ]; then
         echo "Uploading filesystem to $port..."
-        pio run -t uploadfs --upload-port "$port"
+        pio run -e "$BUILD_ENV" -t nobuild -t uploadfs --upload-port "$port"
     fi
     
     # Upload firmware
     echo "Uploading firmware to $port..."
-    pio run -t upload --upload-port "$port"
+    pio run -e "$BUILD_ENV" -t nobuild -t upload --upload-port "$port"
+
+    # Write per-board configuration
+    provision_port "$port" "$index"
     
     echo "✓ Completed flashing to $port"
 }
@@ -181,10 +283,36 @@ echo ""
 echo "Will flash to ${#FLASH_PORTS[@]} port(s): ${FLASH_PORTS[*]}"
 echo ""
 
-# --- Flash to each port ---
-for port in "${FLASH_PORTS[@]}"; do
-    flash_to_port "$port"
-done
+# --- Build once, then flash each port ---
+build_artifacts
+mkdir -p "$LOG_DIR"
+
+FAILED=()
+if [ "$SEQUENTIAL" = true ] || [ ${#FLASH_PORTS[@]} -eq 1 ]; then
+    for i in "${!FLASH_PORTS[@]}"; do
+        flash_to_port "${FLASH_PORTS[$i]}" "$i"
+    done
+else
+    # Each port gets its own esptool session; output goes to a per-port log
+    # so concurrent runs do not interleave on the terminal.
+    PIDS=()
+    for i in "${!FLASH_PORTS[@]}"; do
+        port="${FLASH_PORTS[$i]}"
+        log="$LOG_DIR/$(basename "$port").log"
+        echo "Flashing $port in background (log: $log)"
+        flash_to_port "$port" "$i" > "$log" 2>&1 &
+        PIDS+=($!)
+    done
+    for i in "${!PIDS[@]}"; do
+        port="${FLASH_PORTS[$i]}"
+        if wait "${PIDS[$i]}"; then
+            echo "✓ $port"
+        else
+            echo "✗ $port (see $LOG_DIR/$(basename "$port").log)"
+            FAILED+=("$port")
+        fi
+    done
+fi
 
 # --- Restore previous branch ---
 if [ "$RETURN_BACK" = true ] && [ "$TARGET" != "$CURRENT" ]; then
@@ -193,6 +321,14 @@ if [ "$RETURN_BACK" = true ] && [ "$TARGET" != "$CURRENT" ]; then
     git checkout "$CURRENT"
 fi
 
+if [ ${#FAILED[@]} -gt 0 ]; then
+    echo ""
+    echo "========================================="
+    echo "✗ Failed on ${#FAILED[@]} port(s): ${FAILED[*]}"
+    echo "========================================="
+    exit 1
+fi
+
 echo ""
 echo "========================================="
 echo "✓ All operations complete!"
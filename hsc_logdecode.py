@@ -0,0 +1,213 @@
+#!/usr/bin/env python3
+"""Decode HSC compact log frames (firmware built with -DHSC_LOG_COMPACT).
+
+A compact frame carries the flash address of the printf format string instead
+of the text. The format strings are looked up in the firmware ELF, and the
+binary arguments are rendered with the same conversions the device would have
+used. See lib/HSC_Base/src/HSC_Log.h for the frame layout.
+
+Usage:
+    hsc_logdecode.py firmware.elf < capture.bin
+    hsc_logdecode.py firmware.elf -i capture.bin
+    hsc_logdecode.py firmware.elf --mqtt mqtt.internal     # HSC/devices/+/log
+
+The stream decoder passes plain text through untouched, so serial output that
+mixes boot ROM messages, panics and compact frames decodes cleanly.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+SYNC = 0x1E
+HEADER_LEN = 8  # fmt address + millis
+
+SPEC_RE = re.compile(r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d+))?(hh|h|ll|l|z|j|t|L)?([diouxXeEfFgGcspaA%])")
+
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+
+class Elf:
+    """Minimal 32-bit little-endian ELF reader for loaded, initialised data."""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF" or self.data[4] != 1 or self.data[5] != 1:
+            raise ValueError("%s is not a 32-bit little-endian ELF" % path)
+        shoff, = struct.unpack_from("<I", self.data, 0x20)
+        shentsize, shnum = struct.unpack_from("<HH", self.data, 0x2E)
+        self.sections = []
+        for i in range(shnum):
+            (_, sh_type, flags, addr, offset, size) = struct.unpack_from(
+                "<IIIIII", self.data, shoff + i * shentsize)
+            if flags & SHF_ALLOC and sh_type != SHT_NOBITS and size:
+                self.sections.append((addr, size, offset))
+        self._cache = {}
+
+    def string_at(self, addr):
+        if addr in self._cache:
+            return self._cache[addr]
+        result = None
+        for base, size, offset in self.sections:
+            if base <= addr < base + size:
+                start = offset + addr - base
+                end = self.data.find(b"\x00", start, offset + size)
+                if end >= 0:
+                    result = self.data[start:end].decode("utf-8", "replace")
+                break
+        self._cache[addr] = result
+        return result
+
+
+def render(fmt, args):
+    """Render a printf format from a little-endian argument blob."""
+    out = []
+    pos = 0
+    last = 0
+    for m in SPEC_RE.finditer(fmt):
+        out.append(fmt[last:m.start()])
+        last = m.end()
+        flags, width, precision, length, conv = m.groups()
+        if conv == "%":
+            out.append("%")
+            continue
+        if width == "*" or precision == "*":
+            # Star arguments are sent as ints ahead of the value
+            pos += 4 * ((width == "*") + (precision == "*"))
+            width = precision = None
+        spec = "%" + flags + (width or "") + ("." + precision if precision else "")
+        try:
+            if conv == "s":
+                n = args[pos]
+                text = args[pos + 1:pos + 1 + n].decode("utf-8", "replace")
+                pos += 1 + n
+                out.append((spec + "s") % text)
+            elif conv in "eEfFgGaA":
+                value, = struct.unpack_from("<d", args, pos)
+                pos += 8
+                out.append((spec + (conv if conv not in "aA" else "f")) % value)
+            elif length == "ll" or length == "j":
+                signed = conv in "di"
+                value, = struct.unpack_from("<q" if signed else "<Q", args, pos)
+                pos += 8
+                out.append((spec + ("d" if conv in "diu" else conv)) % value)
+            else:
+                signed = conv in "di"
+                value, = struct.unpack_from("<i" if signed else "<I", args, pos)
+                pos += 4
+                if conv == "c":
+                    out.append((spec + "c") % chr(value & 0xFF))
+                elif conv == "p":
+                    out.append("0x%08x" % value)
+                else:
+                    out.append((spec + ("d" if conv in "diu" else conv)) % value)
+        except (struct.error, IndexError):
+            out.append("<?>")
+    out.append(fmt[last:])
+    return "".join(out)
+
+
+def decode_frame(elf, body):
+    """Decode a frame body (address, millis, args). Returns (millis, text)."""
+    addr, ms = struct.unpack_from("<II", body, 0)
+    fmt = elf.string_at(addr) if elf else None
+    if fmt is None:
+        return ms, "<unknown format 0x%08x: %s>" % (addr, body[HEADER_LEN:].hex())
+    return ms, render(fmt, body[HEADER_LEN:])
+
+
+class LogStream:
+    """Splits a byte stream into text lines and decoded compact frames."""
+
+    def __init__(self, elf=None):
+        self.elf = elf
+        self.buf = bytearray()
+        self.text = bytearray()
+
+    def feed(self, data):
+        """Feed bytes; returns a list of decoded lines (str)."""
+        self.buf += data
+        lines = []
+        i = 0
+        n = len(self.buf)
+        while i < n:
+            byte = self.buf[i]
+            if byte == SYNC:
+                if i + 2 > n:
+                    break
+                length = self.buf[i + 1]
+                if length >= HEADER_LEN:
+                    if i + 3 + length > n:
+                        break
+                    body = bytes(self.buf[i + 2:i + 2 + length])
+                    check = 0
+                    for b in body:
+                        check ^= b
+                    if check == self.buf[i + 2 + length]:
+                        if self.text:
+                            lines.append(self.text.decode("utf-8", "replace"))
+                            self.text = bytearray()
+                        lines.append(decode_frame(self.elf, body)[1])
+                        i += 3 + length
+                        continue
+            if byte == 0x0A:
+                lines.append(self.text.rstrip(b"\r").decode("utf-8", "replace"))
+                self.text = bytearray()
+            else:
+                self.text.append(byte)
+            i += 1
+        del self.buf[:i]
+        return lines
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode HSC compact log frames")
+    parser.add_argument("elf", help="Firmware ELF the frames were produced by")
+    parser.add_argument("-i", "--input", help="Raw capture file (default: stdin)")
+    parser.add_argument("--mqtt", metavar="BROKER", help="Subscribe to HSC/devices/+/log")
+    parser.add_argument("-P", "--port", type=int, default=1883, help="MQTT broker port")
+    args = parser.parse_args()
+
+    elf = Elf(args.elf)
+
+    if args.mqtt:
+        import paho.mqtt.client as mqtt
+        streams = {}
+
+        def on_message(c, userdata, msg):
+            device = msg.topic.split("/")[2]
+            stream = streams.setdefault(device, LogStream(elf))
+            for line in stream.feed(msg.payload):
+                print("[%s] %s" % (device, line), flush=True)
+
+        try:
+            client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION1)
+        except AttributeError:
+            client = mqtt.Client()
+        client.on_message = on_message
+        client.on_connect = lambda c, u, f, rc: c.subscribe("HSC/devices/+/log")
+        client.connect(args.mqtt, args.port)
+        try:
+            client.loop_forever()
+        except KeyboardInterrupt:
+            pass
+        return 0
+
+    source = open(args.input, "rb") if args.input else sys.stdin.buffer
+    stream = LogStream(elf)
+    while True:
+        chunk = source.read1(4096) if hasattr(source, "read1") else source.read(4096)
+        if not chunk:
+            break
+        for line in stream.feed(chunk):
+            print(line, flush=True)
+    if stream.text:
+        print(stream.text.decode("utf-8", "replace"))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -1,4 +1,5 @@
 #include "ConfigManager.h"
+#include "HSC_Log.h"
 #include "config.h"
 
 ConfigManager::ConfigManager() { loadDefaults(); }
@@ -13,6 +14,8 @@ void ConfigManager::loadDefaults() {
   _config.wifi_password = WIFI_PASSWORD;
   _config.mqtt_server = MQTT_SERVER;
   _config.mqtt_port = MQTT_PORT;
+  _config.mqtt_server2 = MQTT_SERVER2;
+  _config.mqtt_port2 = MQTT_PORT2;
   _config.mqtt_user = MQTT_USER;
   _config.mqtt_password = MQTT_PASSWORD;
   _config.board_id = BOARD_ID;
@@ -21,63 +24,204 @@ void ConfigManager::loadDefaults() {
   _config.update_url = "";
 }
 
+// Namespace of the current config; also written by nvs_image.py
+static const char CONFIG_NAMESPACE[] = "yarddetector";
+// Last known good config (same keys) and the trial state
+static const char LKG_NAMESPACE[] = "yd_lkg";
+
+void ConfigManager::readConfig(Preferences &prefs, Config &config) {
+  config.wifi_ssid = prefs.getString("wifi_ssid", WIFI_SSID);
+  config.wifi_password = prefs.getString("wifi_pass", WIFI_PASSWORD);
+  config.mqtt_server = prefs.getString("mqtt_srv", MQTT_SERVER);
+  config.mqtt_port = prefs.getInt("mqtt_port", MQTT_PORT);
+  config.mqtt_server2 = prefs.getString("mqtt_srv2", MQTT_SERVER2);
+  config.mqtt_port2 = prefs.getInt("mqtt_port2", MQTT_PORT2);
+  config.mqtt_user = prefs.getString("mqtt_user", MQTT_USER);
+  config.mqtt_password = prefs.getString("mqtt_pass", MQTT_PASSWORD);
+  config.board_id = prefs.getInt("board_id", BOARD_ID);
+  config.location = prefs.getString("location", "");
+  // config.update_url is set by loadDefaults() and not stored in NVS to
+  // allow config.h changes
+  config.update_url = "";
+}
+
+void ConfigManager::writeConfig(Preferences &prefs, const Config &config) {
+  prefs.putString("wifi_ssid", config.wifi_ssid);
+  prefs.putString("wifi_pass", config.wifi_password);
+  prefs.putString("mqtt_srv", config.mqtt_server);
+  prefs.putInt("mqtt_port", config.mqtt_port);
+  prefs.putString("mqtt_srv2", config.mqtt_server2);
+  prefs.putInt("mqtt_port2", config.mqtt_port2);
+  prefs.putString("mqtt_user", config.mqtt_user);
+  prefs.putString("mqtt_pass", config.mqtt_password);
+  prefs.putInt("board_id", config.board_id);
+  prefs.putString("location", config.location);
+  // prefs.putString("update_url", config.update_url); // Moved to config.h
+}
+
 Config ConfigManager::load() {
-  _prefs.begin("yarddetector", true); // Read-only mode
+  Preferences lkg;
+  lkg.begin(LKG_NAMESPACE, false);
+  _confirmed = lkg.getBool("confirmed", false);
+  uint8_t trialBoots = lkg.getUChar("trial", 0);
+  _hasRollback = lkg.isKey("rb_reason");
+  if (_hasRollback) {
+    _rollback.reason = lkg.getString("rb_reason");
+    _rollback.wifi_ssid = lkg.getString("rb_ssid");
+    _rollback.mqtt_server = lkg.getString("rb_mqtt");
+  }
+  if (trialBoots > 0) {
+    // Counts every boot of the trial, so a config that crashes the board
+    // is rolled back without waiting for the window
+    trialBoots++;
+    lkg.putUChar("trial", trialBoots);
+  }
+  lkg.end();
+
+  if (trialBoots > CONFIG_TRIAL_BOOTS + 1) {
+    HSC_LOG("Config trial did not come up in %d boots", CONFIG_TRIAL_BOOTS);
+    rollback("reboot");
+    trialBoots = 0;
+  }
+  _trial = trialBoots > 0;
+  _loadedTrial = _trial;
+  _savePending = false;
+
+  _prefs.begin(CONFIG_NAMESPACE, true); // Read-only mode
 
   // Check if config exists (board_id will be set if configured)
   if (!_prefs.isKey("board_id")) {
-    Serial.println("No config found in NVS, using defaults");
+    HSC_LOG("No config found in NVS, using defaults");
     _prefs.end();
     loadDefaults();
     return _config;
   }
 
   // Load all values from NVS
-  _config.wifi_ssid = _prefs.getString("wifi_ssid", WIFI_SSID);
-  _config.wifi_password = _prefs.getString("wifi_pass", WIFI_PASSWORD);
-  _config.mqtt_server = _prefs.getString("mqtt_srv", MQTT_SERVER);
-  _config.mqtt_port = _prefs.getInt("mqtt_port", MQTT_PORT);
-  _config.mqtt_user = _prefs.getString("mqtt_user", MQTT_USER);
-  _config.mqtt_password = _prefs.getString("mqtt_pass", MQTT_PASSWORD);
-  _config.board_id = _prefs.getInt("board_id", BOARD_ID);
-  _config.location = _prefs.getString("location", "");
-  // _config.update_url is set by loadDefaults() and not stored in NVS to allow
-  // config.h changes
-  _config.update_url = "";
-
+  readConfig(_prefs, _config);
   _prefs.end();
 
-  Serial.println("Config loaded from NVS");
+  HSC_LOG("Config loaded from NVS%s", _trial ? " (trial)" : "");
   return _config;
 }
 
-bool ConfigManager::save(const Config &config) {
-  _prefs.begin("yarddetector", false); // Read-write mode
-
-  // Save all values to NVS
-  _prefs.putString("wifi_ssid", config.wifi_ssid);
-  _prefs.putString("wifi_pass", config.wifi_password);
-  _prefs.putString("mqtt_srv", config.mqtt_server);
-  _prefs.putInt("mqtt_port", config.mqtt_port);
-  _prefs.putString("mqtt_user", config.mqtt_user);
-  _prefs.putString("mqtt_pass", config.mqtt_password);
-  _prefs.putInt("board_id", config.board_id);
-  _prefs.putString("location", config.location);
-  _prefs.putString("location", config.location);
-  // _prefs.putString("update_url", config.update_url); // Moved to config.h
+bool ConfigManager::save(const Config &config, bool trial) {
+  // Before any write, so the loop task stops confirming the running config
+  _savePending = true;
+  Preferences lkg;
+  lkg.begin(LKG_NAMESPACE, false);
+  // Only a config that has connected is worth going back to
+  if (trial && _confirmed) {
+    Config previous;
+    _prefs.begin(CONFIG_NAMESPACE, true);
+    bool stored = _prefs.isKey("board_id");
+    readConfig(_prefs, previous);
+    _prefs.end();
+    if (stored) {
+      writeConfig(lkg, previous);
+      lkg.putBool("valid", true);
+    }
+  }
+  bool startTrial = trial && lkg.getBool("valid", false);
+  lkg.putUChar("trial", startTrial ? 1 : 0);
+  lkg.putBool("confirmed", false);
+  lkg.end();
+  _confirmed = false;
 
+  _prefs.begin(CONFIG_NAMESPACE, false); // Read-write mode
+  writeConfig(_prefs, config);
   _prefs.end();
 
   _config = config;
-  Serial.println("Config saved to NVS");
+  HSC_LOG("Config saved to NVS%s", startTrial ? ", trial after reboot" : "");
   return true;
 }
 
+void ConfigManager::confirm() {
+  if (_savePending || (_confirmed && !_trial)) {
+    return;
+  }
+  Preferences lkg;
+  lkg.begin(LKG_NAMESPACE, false);
+  lkg.putBool("confirmed", true);
+  lkg.putUChar("trial", 0);
+  lkg.end();
+  if (_loadedTrial) {
+    HSC_LOG("New config confirmed");
+  }
+  _trial = false;
+  _confirmed = true;
+}
+
+bool ConfigManager::rollback(const char *reason) {
+  Preferences lkg;
+  lkg.begin(LKG_NAMESPACE, false);
+  if (!lkg.getBool("valid", false)) {
+    lkg.putUChar("trial", 0);
+    lkg.end();
+    _trial = false;
+    return false;
+  }
+  Config good;
+  readConfig(lkg, good);
+
+  Config failed;
+  _prefs.begin(CONFIG_NAMESPACE, false);
+  readConfig(_prefs, failed);
+  writeConfig(_prefs, good);
+  _prefs.end();
+
+  // The slot has connected before, so it counts as confirmed
+  lkg.putBool("confirmed", true);
+  lkg.putUChar("trial", 0);
+  lkg.putString("rb_reason", reason);
+  lkg.putString("rb_ssid", failed.wifi_ssid);
+  lkg.putString("rb_mqtt", failed.mqtt_server);
+  lkg.end();
+
+  _rollback.reason = reason;
+  _rollback.wifi_ssid = failed.wifi_ssid;
+  _rollback.mqtt_server = failed.mqtt_server;
+  _hasRollback = true;
+  _trial = false;
+  _confirmed = true;
+  _config = good;
+  HSC_LOG("Config rolled back to last known good (%s)", reason);
+  return true;
+}
+
+bool ConfigManager::getRollback(ConfigRollback &out) const {
+  if (_hasRollback) {
+    out = _rollback;
+  }
+  return _hasRollback;
+}
+
+void ConfigManager::clearRollback() {
+  if (!_hasRollback) {
+    return;
+  }
+  Preferences lkg;
+  lkg.begin(LKG_NAMESPACE, false);
+  lkg.remove("rb_reason");
+  lkg.remove("rb_ssid");
+  lkg.remove("rb_mqtt");
+  lkg.end();
+  _hasRollback = false;
+}
+
 void ConfigManager::reset() {
-  _prefs.begin("yarddetector", false);
+  _savePending = true;
+  _prefs.begin(CONFIG_NAMESPACE, false);
   _prefs.clear(); // Clear all keys in this namespace
   _prefs.end();
+  _prefs.begin(LKG_NAMESPACE, false);
+  _prefs.clear();
+  _prefs.end();
+  _trial = false;
+  _confirmed = false;
+  _hasRollback = false;
 
   loadDefaults();
-  Serial.println("Config reset to defaults");
+  HSC_LOG("Config reset to defaults");
 }
@@ -10,6 +10,8 @@ struct Config {
   String wifi_password;
   String mqtt_server;
   int mqtt_port;
+  String mqtt_server2; // Fallback broker, empty for none
+  int mqtt_port2;
   String mqtt_user;
   String mqtt_password;
   int board_id;
@@ -17,19 +19,55 @@ struct Config {
   String update_url;
 };
 
+// A rollback to the last known good config, kept until it is reported
+struct ConfigRollback {
+  String reason; // "wifi", "mqtt" or "reboot"
+  String wifi_ssid;
+  String mqtt_server; // Of the config that was rolled back
+};
+
+// Settings in NVS with a last-known-good slot. Once a config has connected
+// it is confirmed; saving a new one copies the confirmed config to the slot
+// and starts a trial. The caller confirms the new config when it connects
+// or rolls back to the slot when the trial window runs out. Rebooting too
+// often during a trial rolls back in load().
 class ConfigManager {
 public:
   ConfigManager();
   bool begin();
   Config load();
-  bool save(const Config &config);
+  // trial=false keeps the slot as is and skips the trial, for changes made
+  // at the board itself
+  bool save(const Config &config, bool trial = true);
   void reset();
   Config get() const { return _config; }
 
+  bool inTrial() const { return _trial; }
+  bool isConfirmed() const { return _confirmed; }
+  // True once save() has started; the running config is then not the one
+  // stored, and stays unconfirmed until the reboot loads the new one
+  bool savePending() const { return _savePending; }
+  // Confirm the config loaded at this boot. Does nothing after a save, and
+  // writes NVS only while that config is in trial or unconfirmed.
+  void confirm();
+  // Restore the last known good config; takes effect at the next boot
+  bool rollback(const char *reason);
+  bool getRollback(ConfigRollback &out) const;
+  void clearRollback();
+
 private:
   Config _config;
   Preferences _prefs;
+  bool _trial = false;
+  bool _confirmed = false;
+  bool _loadedTrial = false;          // State of the config at boot
+  volatile bool _savePending = false; // Set by save() on the web task
+  bool _hasRollback = false;
+  ConfigRollback _rollback;
+
   void loadDefaults();
+  static void readConfig(Preferences &prefs, Config &config);
+  static void writeConfig(Preferences &prefs, const Config &config);
 };
 
 #endif
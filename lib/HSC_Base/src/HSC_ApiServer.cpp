@@ -0,0 +1,237 @@
+#include "HSC_ApiServer.h"
+#include "HSC_Log.h"
+#include "HSC_Stall.h"
+#include <StreamString.h>
+
+// Request heads larger than this are refused
+static const size_t API_MAX_HEAD = 2048;
+
+HSC_ApiServer::HSC_ApiServer(uint16_t port, uint32_t idleMs,
+                             uint16_t maxRequests, uint8_t maxClients)
+    : server(port), port(port), idleMs(idleMs), maxRequests(maxRequests),
+      maxClients(maxClients) {}
+
+void HSC_ApiServer::on(const char *uri, JsonApiHandler handler) {
+  routes.push_back({uri, handler});
+}
+
+void HSC_ApiServer::begin() {
+  server.onClient(
+      [](void *arg, AsyncClient *client) {
+        static_cast<HSC_ApiServer *>(arg)->accept(client);
+      },
+      this);
+  server.setNoDelay(true);
+  server.begin();
+  HSC_LOG("Keep-alive API server on port %u", port);
+}
+
+void HSC_ApiServer::accept(AsyncClient *client) {
+  if (stats.active >= maxClients) {
+    stats.rejected++;
+    client->close(true);
+    delete client;
+    return;
+  }
+  stats.connections++;
+  stats.active++;
+
+  Connection *c = new Connection();
+  c->server = this;
+  c->client = client;
+  c->txSent = 0;
+  c->served = 0;
+  c->closing = false;
+  c->lastActivity = millis();
+
+  client->setNoDelay(true);
+  client->onData(
+      [](void *arg, AsyncClient *, void *data, size_t len) {
+        Connection *c = static_cast<Connection *>(arg);
+        c->server->onData(c, static_cast<const char *>(data), len);
+      },
+      c);
+  client->onAck(
+      [](void *arg, AsyncClient *, size_t, uint32_t) {
+        Connection *c = static_cast<Connection *>(arg);
+        c->server->flush(c);
+      },
+      c);
+  client->onPoll(
+      [](void *arg, AsyncClient *client) {
+        Connection *c = static_cast<Connection *>(arg);
+        if (c->tx.length() == 0 &&
+            millis() - c->lastActivity >= c->server->idleMs) {
+          c->server->stats.idleCloses++;
+          client->close();
+        }
+      },
+      c);
+  client->onError(
+      [](void *, AsyncClient *client, int8_t) { client->close(true); }, c);
+  client->onTimeout(
+      [](void *, AsyncClient *client, uint32_t) { client->close(true); }, c);
+  client->onDisconnect(
+      [](void *arg, AsyncClient *) {
+        Connection *c = static_cast<Connection *>(arg);
+        c->server->release(c);
+      },
+      c);
+}
+
+void HSC_ApiServer::release(Connection *c) {
+  stats.active--;
+  AsyncClient *client = c->client;
+  delete c;
+  delete client;
+}
+
+void HSC_ApiServer::onData(Connection *c, const char *data, size_t len) {
+  c->lastActivity = millis();
+  if (c->closing) {
+    return;
+  }
+  c->rx.concat(data, len);
+
+  // Requests may be pipelined; answer each complete head in order
+  int end;
+  while (!c->closing && (end = c->rx.indexOf("\r\n\r\n")) >= 0) {
+    String head = c->rx.substring(0, end);
+    c->rx.remove(0, end + 4);
+    if (!handleRequest(c, head)) {
+      c->closing = true;
+    }
+  }
+  if (!c->closing && c->rx.length() > API_MAX_HEAD) {
+    respond(c, 431, "Request Header Fields Too Large",
+            "{\"error\":\"header too large\"}", false);
+    c->closing = true;
+  }
+  flush(c);
+}
+
+// Returns false if the connection should close after the response
+bool HSC_ApiServer::handleRequest(Connection *c, const String &head) {
+  c->served++;
+  stats.requests++;
+  if (c->served > 1) {
+    stats.reusedRequests++;
+  }
+
+  int lineEnd = head.indexOf("\r\n");
+  String requestLine = lineEnd < 0 ? head : head.substring(0, lineEnd);
+  int sp1 = requestLine.indexOf(' ');
+  int sp2 = sp1 < 0 ? -1 : requestLine.indexOf(' ', sp1 + 1);
+  if (sp2 < 0) {
+    respond(c, 400, "Bad Request", "{\"error\":\"bad request\"}", false);
+    return false;
+  }
+  String method = requestLine.substring(0, sp1);
+  String target = requestLine.substring(sp1 + 1, sp2);
+  bool http11 = requestLine.substring(sp2 + 1) == "HTTP/1.1";
+
+  // HTTP/1.1 defaults to persistent connections, 1.0 only on request
+  bool keepAlive = http11;
+  long contentLength = 0;
+  int pos = lineEnd < 0 ? head.length() : lineEnd + 2;
+  while (pos < (int)head.length()) {
+    int next = head.indexOf("\r\n", pos);
+    String line = next < 0 ? head.substring(pos) : head.substring(pos, next);
+    pos = next < 0 ? head.length() : next + 2;
+    int colon = line.indexOf(':');
+    if (colon < 0) {
+      continue;
+    }
+    String name = line.substring(0, colon);
+    String value = line.substring(colon + 1);
+    value.trim();
+    value.toLowerCase();
+    if (name.equalsIgnoreCase("Connection")) {
+      if (value.indexOf("close") >= 0) {
+        keepAlive = false;
+      } else if (value.indexOf("keep-alive") >= 0) {
+        keepAlive = true;
+      }
+    } else if (name.equalsIgnoreCase("Content-Length")) {
+      contentLength = value.toInt();
+    }
+  }
+
+  if (c->served >= maxRequests && keepAlive) {
+    stats.capCloses++;
+    keepAlive = false;
+  }
+  // Only bodiless GETs are served; a body would desynchronise the stream
+  if (contentLength > 0) {
+    respond(c, 413, "Payload Too Large", "{\"error\":\"body not accepted\"}",
+            false);
+    return false;
+  }
+  bool headOnly = method == "HEAD";
+  if (method != "GET" && !headOnly) {
+    respond(c, 405, "Method Not Allowed", "{\"error\":\"GET only\"}",
+            keepAlive);
+    return keepAlive;
+  }
+
+  int query = target.indexOf('?');
+  String path = query < 0 ? target : target.substring(0, query);
+  for (const Route &route : routes) {
+    if (path == route.uri) {
+      HSC_STALL_SPAN(route.uri.c_str());
+      StreamString body;
+      route.handler(body);
+      // HEAD gets the same headers, Content-Length included, and no body
+      respond(c, 200, "OK", body, keepAlive, headOnly);
+      return keepAlive;
+    }
+  }
+  respond(c, 404, "Not Found", "{\"error\":\"not found\"}", keepAlive);
+  return keepAlive;
+}
+
+void HSC_ApiServer::respond(Connection *c, int status, const char *reason,
+                            const String &body, bool keepAlive,
+                            bool headOnly) {
+  char head[256];
+  int n = snprintf(head, sizeof(head),
+                   "HTTP/1.1 %d %s\r\n"
+                   "Content-Type: application/json\r\n"
+                   "Content-Length: %u\r\n"
+                   "Access-Control-Allow-Origin: *\r\n",
+                   status, reason, (unsigned)body.length());
+  if (keepAlive) {
+    snprintf(head + n, sizeof(head) - n,
+             "Connection: keep-alive\r\n"
+             "Keep-Alive: timeout=%u, max=%u\r\n\r\n",
+             (unsigned)(idleMs / 1000), (unsigned)(maxRequests - c->served));
+  } else {
+    snprintf(head + n, sizeof(head) - n, "Connection: close\r\n\r\n");
+  }
+  c->tx += head;
+  if (!headOnly) {
+    c->tx += body;
+  }
+}
+
+void HSC_ApiServer::flush(Connection *c) {
+  AsyncClient *client = c->client;
+  size_t remaining = c->tx.length() - c->txSent;
+  if (remaining > 0) {
+    size_t space = client->space();
+    size_t n = remaining < space ? remaining : space;
+    if (n > 0) {
+      client->add(c->tx.c_str() + c->txSent, n);
+      client->send();
+      c->txSent += n;
+    }
+  }
+  if (c->txSent == c->tx.length()) {
+    c->tx = String();
+    c->txSent = 0;
+    c->lastActivity = millis();
+    if (c->closing) {
+      client->close();
+    }
+  }
+}
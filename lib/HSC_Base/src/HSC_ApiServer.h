@@ -0,0 +1,79 @@
+#ifndef HSC_APISERVER_H
+#define HSC_APISERVER_H
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <functional>
+#include <vector>
+
+// Writes the JSON body of a GET API route
+typedef std::function<void(Print &out)> JsonApiHandler;
+
+struct ApiServerStats {
+  uint32_t connections;    // Accepted
+  uint32_t requests;       // Served, including errors
+  uint32_t reusedRequests; // Served on an already used connection
+  uint32_t idleCloses;     // Closed by the idle timeout
+  uint32_t capCloses;      // Closed after the per-connection request cap
+  uint32_t rejected;       // Refused because all slots were busy
+  uint8_t active;
+};
+
+// Minimal HTTP/1.1 server for JSON GET routes with persistent
+// connections. AsyncWebServer closes the connection after every
+// response, so a dashboard polling /api/status pays a TCP handshake per
+// request; clients of this server keep one connection open and reuse it
+// until it has been idle for idleMs or has served maxRequests requests.
+//
+// Routes are registered through HSC_Base::registerJsonApi(), which also
+// serves them on the main web server. Routes added with registerApi() take
+// an AsyncWebServerRequest and are only served on port 80, without
+// keep-alive; clients that poll must use this server's port instead. The
+// built-in web UI polls /api/status here.
+class HSC_ApiServer {
+public:
+  HSC_ApiServer(uint16_t port, uint32_t idleMs, uint16_t maxRequests,
+                uint8_t maxClients);
+
+  void on(const char *uri, JsonApiHandler handler);
+  void begin();
+
+  // Counters are updated on the async_tcp task; read them as a snapshot
+  ApiServerStats getStats() const { return stats; }
+  uint16_t getPort() const { return port; }
+
+private:
+  struct Route {
+    String uri;
+    JsonApiHandler handler;
+  };
+
+  struct Connection {
+    HSC_ApiServer *server;
+    AsyncClient *client;
+    String rx;      // Unparsed request bytes
+    String tx;      // Response bytes not yet accepted by the TCP stack
+    size_t txSent;
+    uint16_t served;
+    bool closing;   // Close once tx has drained
+    unsigned long lastActivity;
+  };
+
+  AsyncServer server;
+  uint16_t port;
+  uint32_t idleMs;
+  uint16_t maxRequests;
+  uint8_t maxClients;
+  std::vector<Route> routes;
+  ApiServerStats stats = {};
+
+  void accept(AsyncClient *client);
+  void onData(Connection *c, const char *data, size_t len);
+  bool handleRequest(Connection *c, const String &head);
+  void respond(Connection *c, int status, const char *reason,
+               const String &body, bool keepAlive, bool headOnly = false);
+  void flush(Connection *c);
+  void release(Connection *c);
+};
+
+#endif
@@ -1,6 +1,17 @@
 #include "HSC_Base.h"
 #include "config.h"
+#include <esp_timer.h>
 #include <time.h>
+#include <StreamString.h>
+
+// Blocking by design on the loop task: an OTA download for as long as it
+// takes, an MQTT connect until the socket times out
+static const uint32_t OTA_STALL_ALLOW_MS = 10 * 60 * 1000;
+static const uint32_t MQTT_CONNECT_STALL_ALLOW_MS = 10000;
+
+// A dead broker is noticed after about two keepalive intervals
+static const uint16_t MQTT_KEEPALIVE_S = 5;
+static const uint16_t MQTT_SOCKET_TIMEOUT_S = 3;
 
 // Embedded HTML and CSS
 static const char index_html[] PROGMEM = R"rawliteral(
@@ -39,6 +50,14 @@ static const char index_html[] PROGMEM = R"rawliteral(
                     <label for="mqtt_port">Port:</label>
                     <input type="number" id="mqtt_port" name="mqtt_port" required>
                 </div>
+                <div class="form-group">
+                    <label for="mqtt_server2">Secondary Server:</label>
+                    <input type="text" id="mqtt_server2" name="mqtt_server2" placeholder="Optional">
+                </div>
+                <div class="form-group">
+                    <label for="mqtt_port2">Secondary Port:</label>
+                    <input type="number" id="mqtt_port2" name="mqtt_port2">
+                </div>
                 <div class="form-group">
                     <label for="mqtt_user">User:</label>
                     <input type="text" id="mqtt_user" name="mqtt_user">
@@ -81,6 +100,8 @@ static const char index_html[] PROGMEM = R"rawliteral(
                     document.getElementById('wifi_password').value = data.wifi_password || '';
                     document.getElementById('mqtt_server').value = data.mqtt_server || '';
                     document.getElementById('mqtt_port').value = data.mqtt_port || 1883;
+                    document.getElementById('mqtt_server2').value = data.mqtt_server2 || '';
+                    document.getElementById('mqtt_port2').value = data.mqtt_port2 || 1883;
                     document.getElementById('mqtt_user').value = data.mqtt_user || '';
                     document.getElementById('mqtt_password').value = data.mqtt_password || '';
                     document.getElementById('board_id').value = (data.board_id !== undefined) ? data.board_id : 1;
@@ -95,7 +116,7 @@ static const char index_html[] PROGMEM = R"rawliteral(
                 const formData = new FormData(this);
                 const data = {};
                 formData.forEach((value, key) => {
-                    if (key === 'mqtt_port' || key === 'board_id') {
+                    if (key === 'mqtt_port' || key === 'mqtt_port2' || key === 'board_id') {
                         data[key] = parseInt(value);
                     } else {
                         data[key] = value;
@@ -215,8 +236,11 @@ static const char index_html[] PROGMEM = R"rawliteral(
         </div>
     </footer>
     <script>
+        // Poll the keep-alive API server; port 80 closes every connection.
+        // Falls back to port 80 if the keep-alive port is not reachable.
+        let statusUrl = 'http://' + location.hostname + ':%API_PORT%/api/status';
         setInterval(() => {
-            fetch('/api/status')
+            fetch(statusUrl)
                 .then(response => response.json())
                 .then(data => {
                     if (data.uptime) document.getElementById('uptime').textContent = data.uptime;
@@ -224,7 +248,13 @@ static const char index_html[] PROGMEM = R"rawliteral(
                     if (data.free_memory) document.getElementById('freemem').textContent = data.free_memory;
                     if (data.runtime) document.getElementById('runtime').textContent = data.runtime;
                 })
-                .catch(err => console.error('Failed to refresh status:', err));
+                .catch(err => {
+                    if (statusUrl !== '/api/status') {
+                        statusUrl = '/api/status';
+                        return;
+                    }
+                    console.error('Failed to refresh status:', err);
+                });
         }, 2000);
     </script>
 </body>
@@ -403,7 +433,11 @@ footer .value {
 }
 )rawliteral";
 
-HSC_Base::HSC_Base() : server(80), mqttClient(espClient) {
+HSC_Base::HSC_Base()
+    : server(80),
+      apiServer(API_KEEPALIVE_PORT, API_KEEPALIVE_IDLE_MS,
+                API_KEEPALIVE_MAX_REQUESTS, HSC_Board::API_MAX_CLIENTS),
+      mqttClient(espClient) {
   boardTypeDesc = BOARD_TYPE_DESC;
   boardTypeShort = BOARD_TYPE_SHORT;
 }
@@ -423,31 +457,51 @@ void HSC_Base::begin() {
   Serial.begin(115200);
 
   // Initialize LED
-  pinMode(2, OUTPUT);
-  digitalWrite(2, LOW);
+  if (HSC_Board::HAS_LED) {
+    pinMode(HSC_Board::PIN_LED, OUTPUT);
+  }
+  setLed(false);
 
   // Initialize SPIFFS
   if (!SPIFFS.begin(true)) {
-    Serial.println("An Error has occurred while mounting SPIFFS");
+    HSC_LOG("An Error has occurred while mounting SPIFFS");
   }
 
   // Initialize AP Mode Button
-  pinMode(PIN_AP_BUTTON, INPUT_PULLUP);
+  pinMode(HSC_Board::PIN_AP_BUTTON, INPUT_PULLUP);
 
   // Initialize Config
   if (!configManager.begin()) {
-    Serial.println("Failed to initialize ConfigManager");
+    HSC_LOG("Failed to initialize ConfigManager");
   }
   currentConfig = configManager.load();
+  store.begin();
 
   // Apply update URL from setup() if available
   if (_preConfigUpdateUrl.length() > 0) {
     currentConfig.update_url = _preConfigUpdateUrl;
   }
 
+  netStats.begin();
   setupWifi();
-  mqttClient.setServer(currentConfig.mqtt_server.c_str(),
-                       currentConfig.mqtt_port);
+  // Brokers in order of preference; the server is set per attempt
+  mqttBrokers.add(currentConfig.mqtt_server, currentConfig.mqtt_port);
+  if (currentConfig.mqtt_server2.length() > 0) {
+    mqttBrokers.add(currentConfig.mqtt_server2, currentConfig.mqtt_port2);
+  }
+  for (size_t i = 0; i < mqttBrokers.count(); i++) {
+    netStats.labelRemotePort(mqttBrokers.port(i), "mqtt");
+  }
+  netStats.labelLocalPort(80, "web");
+  netStats.labelLocalPort(API_KEEPALIVE_PORT, "api");
+  mqttClient.setKeepAlive(MQTT_KEEPALIVE_S);
+  mqttClient.setSocketTimeout(MQTT_SOCKET_TIMEOUT_S);
+  // Default 256 bytes is too small for the info document and log batches
+  mqttClient.setBufferSize(1024);
+  mqttClient.setCallback(
+      [this](char *topic, uint8_t *payload, unsigned int length) {
+        dispatchMqtt(topic, payload, length);
+      });
 
   setupWebServer();
   server.begin();
@@ -469,11 +523,23 @@ void HSC_Base::begin() {
 
   // Approximate boot time (will be refined when NTP syncs)
   bootTime = time(nullptr);
+
+  HSC_Stall::begin(STALL_BUDGET_MS, STALL_RESTART_MS);
 }
 
 void HSC_Base::loop() {
+  HSC_Stall::beat();
+
+  // Started here rather than in begin() so every route registered in
+  // setup() is in place before the first client can connect
+  if (!apiServerStarted) {
+    apiServer.begin();
+    apiServerStarted = true;
+  }
+
   // Handle Reboot
   if (shouldReboot) {
+    store.commit();
     delay(1000);
     ESP.restart();
   }
@@ -482,19 +548,20 @@ void HSC_Base::loop() {
   static unsigned long apButtonPressStart = 0;
   static bool apButtonActive = false;
 
-  if (digitalRead(PIN_AP_BUTTON) == LOW) {
+  if (digitalRead(HSC_Board::PIN_AP_BUTTON) == LOW) {
     if (!apButtonActive) {
       apButtonActive = true;
       apButtonPressStart = millis();
     } else {
       if (millis() - apButtonPressStart > 3000) {
-        Serial.println("AP Mode Button Held - Resetting WiFi Password");
+        HSC_LOG("AP Mode Button Held - Resetting WiFi Password");
         currentConfig.wifi_password = "password";
-        configManager.save(currentConfig);
+        // Deliberate, so not subject to the trial and rollback
+        configManager.save(currentConfig, false);
         shouldReboot = true;
         apButtonActive = false;
         for (int k = 0; k < 10; k++) {
-          digitalWrite(2, !digitalRead(2));
+          setLed(!ledOn);
           delay(100);
         }
       }
@@ -508,10 +575,10 @@ void HSC_Base::loop() {
     static unsigned long lastBlink = 0;
     if (millis() - lastBlink > 500) {
       lastBlink = millis();
-      digitalWrite(2, !digitalRead(2));
+      setLed(!ledOn);
     }
-  } else {
-    digitalWrite(2, LOW);
+  } else if (ledOn) {
+    setLed(false);
   }
 
   // Handle Update
@@ -523,27 +590,78 @@ void HSC_Base::loop() {
   // Handle MQTT
   if (currentConfig.board_id != 0) {
     if (!mqttClient.connected()) {
-      unsigned long now = millis();
-      if (now - lastMqttReconnectAttempt > 5000) {
-        lastMqttReconnectAttempt = now;
-        reconnectMqtt();
+      if (mqttBroker >= 0) {
+        HSC_LOG("MQTT connection to %s lost", mqttBrokers.host(mqttBroker));
+        // Losing WiFi is not the broker's fault
+        if (WiFi.status() == WL_CONNECTED) {
+          mqttBrokers.failed(mqttBroker, millis());
+        }
+        mqttBroker = -1;
       }
+      reconnectMqtt();
+    } else if (mqttBrokers.failbackReady(mqttBroker, millis())) {
+      failbackMqtt();
     }
     mqttClient.loop();
+    HSC_Log::loop();
+  }
+
+  // Keep a newly saved config once it connects, or go back to the last
+  // known good one when the trial window runs out
+  if (!configManager.isConfirmed()) {
+    checkConfigTrial();
+  }
+
+  // Coalesced NVS commits; report flash wear whenever one happens
+  if (store.loop() && mqttClient.connected()) {
+    StreamString stats;
+    writeStoreStats(stats);
+    char topic[TOPIC_MAX];
+    deviceTopic(topic, sizeof(topic), "store");
+    mqttClient.publish(topic, stats.c_str());
+  }
+
+  // Network stack telemetry, without the connection list
+  if (mqttClient.connected() &&
+      millis() - lastNetStats >= (unsigned long)NETSTATS_INTERVAL_MS) {
+    lastNetStats = millis();
+    StreamString stats;
+    netStats.write(stats, false);
+    char topic[TOPIC_MAX];
+    deviceTopic(topic, sizeof(topic), "netstats");
+    mqttClient.publish(topic, stats.c_str());
+  }
+
+  // Stall captured by the watcher, possibly before a restart
+  if (HSC_Stall::pending() && mqttClient.connected()) {
+    StreamString stall;
+    writeStall(stall);
+    HSC_LOG("Stall: %s", stall.c_str());
+    char topic[TOPIC_MAX];
+    deviceTopic(topic, sizeof(topic), "stall");
+    if (mqttClient.publish(topic, stall.c_str())) {
+      HSC_Stall::markReported();
+    }
+  }
+}
+
+void HSC_Base::setLed(bool on) {
+  ledOn = on;
+  // Folds away on boards without an LED
+  if (HSC_Board::HAS_LED) {
+    digitalWrite(HSC_Board::PIN_LED, on != (bool)HSC_Board::LED_ACTIVE_LOW);
   }
 }
 
 void HSC_Base::setupWifi() {
   delay(10);
   Serial.println();
-  Serial.println("--------------------------------");
-  Serial.println("Starting HSC-ESP32-Base");
-  Serial.println("FW Rev: " + String(FW_VERSION));
-  Serial.println("Board ID: " + String(currentConfig.board_id));
-  Serial.println("--------------------------------");
-  Serial.println();
-  Serial.print("Connecting to ");
-  Serial.println(currentConfig.wifi_ssid);
+  HSC_LOG("--------------------------------");
+  HSC_LOG("Starting HSC-ESP32-Base");
+  HSC_LOG("FW Rev: %s", FW_VERSION);
+  HSC_LOG("Board ID: %d", currentConfig.board_id);
+  HSC_LOG("--------------------------------");
+  HSC_LOG("Connecting to %s", currentConfig.wifi_ssid.c_str());
 
   WiFi.mode(WIFI_STA);
 
@@ -556,8 +674,7 @@ void HSC_Base::setupWifi() {
   sprintf(hostname, "%s-%02x%02x%02x", shortName.c_str(), mac[3], mac[4],
           mac[5]);
   WiFi.setHostname(hostname);
-  Serial.print("Hostname: ");
-  Serial.println(hostname);
+  HSC_LOG("Hostname: %s", hostname);
 
   WiFi.begin(currentConfig.wifi_ssid.c_str(),
              currentConfig.wifi_password.c_str());
@@ -570,20 +687,19 @@ void HSC_Base::setupWifi() {
   }
 
   if (WiFi.status() != WL_CONNECTED) {
-    Serial.println("\nFailed to connect to WiFi. Starting Fallback AP...");
+    Serial.println();
+    HSC_LOG("Failed to connect to WiFi. Starting Fallback AP...");
     WiFi.mode(WIFI_AP);
     WiFi.softAP("HSC-Setup", "password");
-    Serial.println("AP IP address: ");
-    Serial.println(WiFi.softAPIP());
+    HSC_LOG("AP IP address: %s", WiFi.softAPIP().toString().c_str());
   } else {
-    Serial.println("");
-    Serial.println("WiFi connected");
-    Serial.println("IP address: ");
-    Serial.println(WiFi.localIP());
+    Serial.println();
+    HSC_LOG("WiFi connected");
+    HSC_LOG("IP address: %s", WiFi.localIP().toString().c_str());
 
-    Serial.println("Configuring NTP...");
+    HSC_LOG("Configuring NTP...");
     configTime(-5 * 3600, 0, "pool.ntp.org", "time.nist.gov");
-    Serial.println("NTP configured (will sync in background)");
+    HSC_LOG("NTP configured (will sync in background)");
   }
 }
 
@@ -593,15 +709,26 @@ void HSC_Base::reconnectMqtt() {
   if (currentConfig.board_id == 0)
     return;
 
-  Serial.print("Attempting MQTT connection...");
-  String clientId = "HSC-Device-";
-  clientId += String(currentConfig.board_id);
+  // Next broker by health score, -1 while waiting to retry
+  int broker = mqttBrokers.next(millis());
+  if (broker < 0)
+    return;
+
+  HSC_LOG("Attempting MQTT connection to %s:%d...", mqttBrokers.host(broker),
+          mqttBrokers.port(broker));
+  mqttClient.setServer(mqttBrokers.host(broker), mqttBrokers.port(broker));
+  // Connecting blocks until the broker answers or the socket times out
+  HSC_StallSpan stallSpan("mqtt_connect", MQTT_CONNECT_STALL_ALLOW_MS);
+  unsigned long started = millis();
 
   if (mqttClient.connect(deviceId.c_str(), currentConfig.mqtt_user.c_str(),
                          currentConfig.mqtt_password.c_str(),
                          ("HSC/devices/" + deviceId + "/status").c_str(), 0,
                          true, "offline")) {
-    Serial.println("connected");
+    mqttBrokers.connected(broker, millis() - started);
+    mqttBroker = broker;
+    HSC_LOG("MQTT connected to %s in %lu ms", mqttBrokers.host(broker),
+            millis() - started);
 
     // 1. Publish Online Status (Retained)
     String statusTopic = "HSC/devices/" + deviceId + "/status";
@@ -611,16 +738,18 @@ void HSC_Base::reconnectMqtt() {
     // Calculate boot time based on current time - uptime
     time_t now;
     time(&now);
-    time_t actualBootTime = now - (millis() / 1000);
+    time_t actualBootTime = now - (time_t)(esp_timer_get_time() / 1000000);
 
     StaticJsonDocument<512> doc;
     doc["hostname"] = deviceId;
     doc["model"] = boardTypeDesc;
     doc["board_code"] = boardTypeShort;
+    doc["hardware"] = HSC_Board::name();
     doc["firmware"] = firmwareVersion;
     doc["mac"] = macStr;
     doc["ip"] = WiFi.localIP().toString();
     doc["boot_time"] = actualBootTime;
+    doc["broker"] = mqttBrokers.host(broker);
 
     String infoTopic = "HSC/devices/" + deviceId + "/info";
     char buffer[512];
@@ -640,44 +769,117 @@ void HSC_Base::reconnectMqtt() {
     // 4. Subscribe to Configuration
     String configTopic = "HSC/devices/" + deviceId + "/config";
     mqttClient.subscribe(configTopic.c_str());
+
+    // Renew subscriptions registered with onMqtt()
+    for (const MqttSubscription &sub : mqttSubscriptions) {
+      mqttClient.subscribe(sub.filter.c_str());
+    }
+
+    // Report a rollback to the last known good config (Non-retained)
+    ConfigRollback rollback;
+    if (configManager.getRollback(rollback)) {
+      StaticJsonDocument<256> rollbackDoc;
+      rollbackDoc["reason"] = rollback.reason;
+      rollbackDoc["failed_ssid"] = rollback.wifi_ssid;
+      rollbackDoc["failed_mqtt_server"] = rollback.mqtt_server;
+      char rollbackBuf[256];
+      serializeJson(rollbackDoc, rollbackBuf);
+      if (mqttClient.publish(deviceTopic("config/rollback").c_str(),
+                             rollbackBuf, false)) {
+        configManager.clearRollback();
+      }
+    }
+
+#ifdef HSC_LOG_COMPACT
+    // 5. Mirror compact log frames to MQTT
+    HSC_Log::attachMqtt(&mqttClient, "HSC/devices/" + deviceId + "/log");
+#endif
   } else {
-    Serial.print("failed, rc=");
-    Serial.println(mqttClient.state());
+    HSC_LOG("MQTT connection failed, rc=%d", mqttClient.state());
+    // WiFi may have dropped during the blocking connect; that is not the
+    // broker's fault either
+    if (WiFi.status() == WL_CONNECTED) {
+      mqttBrokers.failed(broker, millis());
+    }
   }
 }
 
-String HSC_Base::processor(const String &var) {
-  if (var == "FW_REV") {
-    return firmwareVersion;
+void HSC_Base::failbackMqtt() {
+  HSC_LOG("Primary MQTT broker %s is back, moving to it",
+          mqttBrokers.host(0));
+  // A clean disconnect does not fire the will, so clear the retained status
+  // on the fallback broker by hand
+  String statusTopic = "HSC/devices/" + deviceId + "/status";
+  mqttClient.publish(statusTopic.c_str(), "offline", true);
+  mqttClient.disconnect();
+  mqttBroker = -1;
+  // Status, info and subscriptions are renewed on the primary
+  reconnectMqtt();
+}
+
+void HSC_Base::checkConfigTrial() {
+  // After a save the connection still runs on the old config; only the
+  // config loaded at this boot is confirmed or rolled back
+  if (shouldReboot || configManager.savePending()) {
+    return;
   }
-  if (var == "IP") {
-    if (WiFi.status() == WL_CONNECTED) {
-      return WiFi.localIP().toString();
-    } else {
-      return WiFi.softAPIP().toString();
-    }
+  bool wifiUp = WiFi.status() == WL_CONNECTED;
+  // Boards without an ID never connect to MQTT
+  bool mqttUp = currentConfig.board_id == 0 || mqttClient.connected();
+  if (wifiUp && mqttUp) {
+    configManager.confirm();
+    return;
   }
-  if (var == "HOSTNAME") {
-    uint8_t mac[6];
-    WiFi.macAddress(mac);
-    char hostname[32];
-    String shortName = String(boardTypeShort);
-    shortName.toLowerCase();
-    sprintf(hostname, "%s-%02x%02x%02x", shortName.c_str(), mac[3], mac[4],
-            mac[5]);
-    return String(hostname);
+  if (!configManager.inTrial() ||
+      esp_timer_get_time() / 1000 < (int64_t)CONFIG_TRIAL_MS) {
+    return;
   }
-  if (var == "SSID") {
-    return currentConfig.wifi_ssid;
+  HSC_LOG("New config did not connect to %s in %d s",
+          wifiUp ? "MQTT" : "WiFi", CONFIG_TRIAL_MS / 1000);
+  if (configManager.rollback(wifiUp ? "mqtt" : "wifi")) {
+    shouldReboot = true;
+  }
+}
+
+// Length actually left in buf by snprintf()-style writer that returned n
+static size_t writtenLength(int n, size_t len) {
+  if (n < 0 || len == 0) {
+    return 0;
+  }
+  return (size_t)n < len ? (size_t)n : len - 1;
+}
+
+// Built-in template variables; -1 if var is not one of them
+int HSC_Base::writeBuiltinVar(char *buf, size_t len, const char *var) {
+  if (strcmp(var, "FW_REV") == 0) {
+    return snprintf(buf, len, "%s", firmwareVersion.c_str());
   }
-  if (var == "MQTT_STATUS") {
-    if (currentConfig.board_id == 0) {
-      return "Unconfigured";
+  if (strcmp(var, "IP") == 0) {
+    IPAddress ip = WiFi.status() == WL_CONNECTED ? WiFi.localIP()
+                                                 : WiFi.softAPIP();
+    return snprintf(buf, len, "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+  }
+  if (strcmp(var, "HOSTNAME") == 0) {
+    // The device ID is the hostname
+    return snprintf(buf, len, "%s", deviceId.c_str());
+  }
+  if (strcmp(var, "API_PORT") == 0) {
+    return snprintf(buf, len, "%d", API_KEEPALIVE_PORT);
+  }
+  if (strcmp(var, "SSID") == 0) {
+    return snprintf(buf, len, "%s", currentConfig.wifi_ssid.c_str());
+  }
+  if (strcmp(var, "MQTT_STATUS") == 0) {
+    const char *status = "Unconfigured";
+    if (currentConfig.board_id != 0) {
+      status = !mqttClient.connected() ? "Disconnected"
+               : mqttBroker > 0        ? "Connected (fallback)"
+                                       : "Connected";
     }
-    return mqttClient.connected() ? "Connected" : "Disconnected";
+    return snprintf(buf, len, "%s", status);
   }
-  if (var == "UPTIME") {
-    unsigned long seconds = millis() / 1000;
+  if (strcmp(var, "UPTIME") == 0) {
+    unsigned long seconds = esp_timer_get_time() / 1000000;
     unsigned long days = seconds / 86400;
     seconds %= 86400;
     unsigned long hours = seconds / 3600;
@@ -685,48 +887,85 @@ String HSC_Base::processor(const String &var) {
     unsigned long minutes = seconds / 60;
     seconds %= 60;
 
-    char uptime[32];
     if (days > 0) {
-      sprintf(uptime, "%lud %02luh %02lum", days, hours, minutes);
+      return snprintf(buf, len, "%lud %02luh %02lum", days, hours, minutes);
     } else if (hours > 0) {
-      sprintf(uptime, "%luh %02lum %02lus", hours, minutes, seconds);
-    } else {
-      sprintf(uptime, "%lum %02lus", minutes, seconds);
+      return snprintf(buf, len, "%luh %02lum %02lus", hours, minutes,
+                      seconds);
     }
-    return String(uptime);
+    return snprintf(buf, len, "%lum %02lus", minutes, seconds);
   }
-  if (var == "RSSI") {
+  if (strcmp(var, "RSSI") == 0) {
     if (WiFi.status() == WL_CONNECTED) {
-      return String(WiFi.RSSI()) + " dBm";
+      return snprintf(buf, len, "%d dBm", WiFi.RSSI());
     }
-    return "N/A";
+    return snprintf(buf, len, "N/A");
   }
-  if (var == "FREE_MEMORY") {
+  if (strcmp(var, "FREE_MEMORY") == 0) {
     float freeKB = ESP.getFreeHeap() / 1024.0;
-    char mem[16];
-    sprintf(mem, "%.1f KB", freeKB);
-    return String(mem);
+    return snprintf(buf, len, "%.1f KB", freeKB);
   }
-  if (var == "DATETIME") {
+  if (strcmp(var, "DATETIME") == 0) {
     struct tm timeinfo;
     if (!getLocalTime(&timeinfo)) {
-      return "Not synced";
+      return snprintf(buf, len, "Not synced");
     }
     char dateTimeStr[32];
     strftime(dateTimeStr, sizeof(dateTimeStr), "%m-%d-%y %H:%M:%S", &timeinfo);
-    return String(dateTimeStr);
+    return snprintf(buf, len, "%s", dateTimeStr);
+  }
+  if (strcmp(var, "CAN_STATUS") == 0) {
+    return snprintf(buf, len, "N/A");
+  }
+  if (strcmp(var, "CAN_ID") == 0) {
+    return snprintf(buf, len, "%d", currentConfig.board_id);
+  }
+  if (strcmp(var, "BOARD_TYPE") == 0) {
+    return snprintf(buf, len, "%s", boardTypeDesc.c_str());
+  }
+  if (strcmp(var, "BOARD_TYPE_SHORT") == 0) {
+    return snprintf(buf, len, "%s", boardTypeShort.c_str());
   }
-  if (var == "CAN_STATUS") {
-    return "N/A";
+  return -1;
+}
+
+size_t HSC_Base::processTemplate(char *buf, size_t len, const char *var) {
+  if (len == 0) {
+    return 0;
   }
-  if (var == "CAN_ID") {
-    return String(currentConfig.board_id);
+  int n = writeBuiltinVar(buf, len, var);
+  if (n >= 0) {
+    return writtenLength(n, len);
   }
-  if (var == "BOARD_TYPE") {
-    return boardTypeDesc;
+  for (const TemplateVar &custom : templateVars) {
+    if (custom.name != var) {
+      continue;
+    }
+    if (custom.writer) {
+      return writtenLength(custom.writer(buf, len), len);
+    }
+    return writtenLength(strlcpy(buf, custom.handler().c_str(), len), len);
   }
-  if (var == "BOARD_TYPE_SHORT") {
-    return boardTypeShort;
+  buf[0] = '\0';
+  return 0;
+}
+
+// AsyncWebServer's processor signature; String handlers keep values longer
+// than TEMPLATE_VALUE_MAX
+String HSC_Base::processor(const String &var) {
+  char value[TEMPLATE_VALUE_MAX];
+  if (writeBuiltinVar(value, sizeof(value), var.c_str()) >= 0) {
+    return String(value);
+  }
+  for (const TemplateVar &custom : templateVars) {
+    if (custom.name != var) {
+      continue;
+    }
+    if (custom.writer) {
+      custom.writer(value, sizeof(value));
+      return String(value);
+    }
+    return custom.handler();
   }
   return String();
 }
@@ -781,6 +1020,8 @@ void HSC_Base::setupWebServer() {
     doc["wifi_password"] = currentConfig.wifi_password;
     doc["mqtt_server"] = currentConfig.mqtt_server;
     doc["mqtt_port"] = currentConfig.mqtt_port;
+    doc["mqtt_server2"] = currentConfig.mqtt_server2;
+    doc["mqtt_port2"] = currentConfig.mqtt_port2;
     doc["mqtt_user"] = currentConfig.mqtt_user;
     doc["mqtt_password"] = currentConfig.mqtt_password;
     doc["board_id"] = currentConfig.board_id;
@@ -817,6 +1058,9 @@ void HSC_Base::setupWebServer() {
           newConfig.mqtt_server =
               doc["mqtt_server"] | currentConfig.mqtt_server;
           newConfig.mqtt_port = doc["mqtt_port"] | currentConfig.mqtt_port;
+          newConfig.mqtt_server2 =
+              doc["mqtt_server2"] | currentConfig.mqtt_server2;
+          newConfig.mqtt_port2 = doc["mqtt_port2"] | currentConfig.mqtt_port2;
           newConfig.mqtt_user = doc["mqtt_user"] | currentConfig.mqtt_user;
           newConfig.mqtt_password =
               doc["mqtt_password"] | currentConfig.mqtt_password;
@@ -828,8 +1072,7 @@ void HSC_Base::setupWebServer() {
             request->send(200, "application/json",
                           "{\"status\":\"success\",\"message\":\"Settings "
                           "saved. Rebooting...\"}");
-            delay(1000);
-            ESP.restart();
+            shouldReboot = true;
           } else {
             request->send(500, "application/json",
                           "{\"status\":\"error\",\"message\":\"Failed to save "
@@ -844,8 +1087,7 @@ void HSC_Base::setupWebServer() {
     request->send(200, "application/json",
                   "{\"status\":\"success\",\"message\":\"Settings reset. "
                   "Rebooting...\"}");
-    delay(1000);
-    ESP.restart();
+    shouldReboot = true;
   });
 
   // API: Toggle Locate
@@ -881,9 +1123,15 @@ void HSC_Base::setupWebServer() {
     shouldUpdate = true;
   });
 
+  // API: Firmware/filesystem image pushed from the browser
+  otaUpload.begin(server, "/api/firmware/upload",
+                  [this]() { shouldReboot = true; });
+
   // API: Check Firmware
   server.on(
       "/api/firmware/check", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        // Blocking HTTP request on the async_tcp task
+        HSC_STALL_SPAN("/api/firmware/check");
         const char *currentVersion = firmwareVersion.c_str();
         String updateUrl = currentConfig.update_url;
         if (updateUrl.length() == 0) {
@@ -946,72 +1194,205 @@ void HSC_Base::setupWebServer() {
         http.end();
       });
 
-  // API: Get Status
-  server.on("/api/status", HTTP_GET, [this](AsyncWebServerRequest *request) {
-    AsyncResponseStream *response =
-        request->beginResponseStream("application/json");
+  // API: Get Status (also served on the keep-alive API port)
+  registerJsonApi("/api/status", [this](Print &out) { writeStatus(out); });
+
+  // API: Application store write counters
+  registerJsonApi("/api/store", [this](Print &out) { writeStoreStats(out); });
+
+  // API: Network stack counters and every TCP connection
+  registerJsonApi("/api/netstats",
+                  [this](Print &out) { netStats.write(out, true); });
+
+  // API: Last stall captured by the watcher
+  registerJsonApi("/api/stall", [this](Print &out) { writeStall(out); });
+
+  // API: Keep-alive server connection reuse
+  registerJsonApi("/api/http/stats", [this](Print &out) {
+    ApiServerStats stats = apiServer.getStats();
     StaticJsonDocument<256> doc;
+    doc["port"] = apiServer.getPort();
+    doc["active"] = stats.active;
+    doc["connections"] = stats.connections;
+    doc["requests"] = stats.requests;
+    doc["reused_requests"] = stats.reusedRequests;
+    doc["idle_closes"] = stats.idleCloses;
+    doc["cap_closes"] = stats.capCloses;
+    doc["rejected"] = stats.rejected;
+    serializeJson(doc, out);
+  });
+}
 
-    unsigned long seconds = millis() / 1000;
-    unsigned long days = seconds / 86400;
-    seconds %= 86400;
-    unsigned long hours = seconds / 3600;
-    seconds %= 3600;
-    unsigned long minutes = seconds / 60;
-    seconds %= 60;
+void HSC_Base::writeStall(Print &out) {
+  StallRecord record;
+  if (HSC_Stall::last(record)) {
+    HSC_Stall::writeRecord(out, record);
+  } else {
+    out.print("{}");
+  }
+}
 
-    char uptime[32];
-    if (days > 0) {
-      sprintf(uptime, "%lud %02luh %02lum", days, hours, minutes);
-    } else if (hours > 0) {
-      sprintf(uptime, "%luh %02lum %02lus", hours, minutes, seconds);
-    } else {
-      sprintf(uptime, "%lum %02lus", minutes, seconds);
-    }
-    doc["uptime"] = uptime;
+void HSC_Base::writeStoreStats(Print &out) {
+  StoreStats stats = store.getStats();
+  StaticJsonDocument<192> doc;
+  doc["entries"] = stats.entries;
+  doc["dirty"] = stats.dirty;
+  doc["writes"] = stats.writes;
+  doc["commits"] = stats.commits;
+  doc["lifetime_writes"] = stats.lifetimeWrites;
+  doc["free_entries"] = stats.freeEntries;
+  serializeJson(doc, out);
+}
 
-    if (WiFi.status() == WL_CONNECTED) {
-      char rssi[16];
-      sprintf(rssi, "%d dBm", WiFi.RSSI());
-      doc["rssi"] = rssi;
-    } else {
-      doc["rssi"] = "N/A";
-    }
+void HSC_Base::writeStatus(Print &out) {
+  StaticJsonDocument<256> doc;
+
+  // From the 64-bit uptime; millis() wraps after 49.7 days
+  unsigned long seconds = esp_timer_get_time() / 1000000;
+  unsigned long days = seconds / 86400;
+  seconds %= 86400;
+  unsigned long hours = seconds / 3600;
+  seconds %= 3600;
+  unsigned long minutes = seconds / 60;
+  seconds %= 60;
+
+  char uptime[32];
+  if (days > 0) {
+    sprintf(uptime, "%lud %02luh %02lum", days, hours, minutes);
+  } else if (hours > 0) {
+    sprintf(uptime, "%luh %02lum %02lus", hours, minutes, seconds);
+  } else {
+    sprintf(uptime, "%lum %02lus", minutes, seconds);
+  }
+  doc["uptime"] = uptime;
 
-    float freeKB = ESP.getFreeHeap() / 1024.0;
-    char mem[16];
-    sprintf(mem, "%.1f KB", freeKB);
-    doc["free_memory"] = mem;
+  if (WiFi.status() == WL_CONNECTED) {
+    char rssi[16];
+    sprintf(rssi, "%d dBm", WiFi.RSSI());
+    doc["rssi"] = rssi;
+  } else {
+    doc["rssi"] = "N/A";
+  }
+  doc["mqtt_broker"] = mqttBroker >= 0 ? mqttBrokers.host(mqttBroker) : "N/A";
 
-    struct tm timeinfo;
-    if (getLocalTime(&timeinfo)) {
-      char dateTimeStr[32];
-      strftime(dateTimeStr, sizeof(dateTimeStr), "%m-%d-%y %H:%M:%S",
-               &timeinfo);
-      doc["runtime"] = dateTimeStr;
-    } else {
-      doc["runtime"] = "Not synced";
+  float freeKB = ESP.getFreeHeap() / 1024.0;
+  char mem[16];
+  sprintf(mem, "%.1f KB", freeKB);
+  doc["free_memory"] = mem;
+
+  struct tm timeinfo;
+  if (getLocalTime(&timeinfo)) {
+    char dateTimeStr[32];
+    strftime(dateTimeStr, sizeof(dateTimeStr), "%m-%d-%y %H:%M:%S",
+             &timeinfo);
+    doc["runtime"] = dateTimeStr;
+  } else {
+    doc["runtime"] = "Not synced";
+  }
+
+  serializeJson(doc, out);
+}
+
+void HSC_Base::onMqtt(const char *topicFilter, MqttHandler handler) {
+  mqttSubscriptions.push_back({topicFilter, handler});
+  if (mqttClient.connected()) {
+    mqttClient.subscribe(topicFilter);
+  }
+}
+
+void HSC_Base::addTemplateVar(const char *name, TemplateVarWriter writer) {
+  templateVars.push_back({name, writer, nullptr});
+}
+
+void HSC_Base::addTemplateVar(const String &name,
+                              TemplateVarHandler handler) {
+  templateVars.push_back({name, nullptr, handler});
+}
+
+size_t HSC_Base::deviceTopic(char *buf, size_t len,
+                             const char *suffix) const {
+  return snprintf(buf, len, "HSC/devices/%s/%s", deviceId.c_str(), suffix);
+}
+
+String HSC_Base::deviceTopic(const char *suffix) const {
+  char topic[TOPIC_MAX];
+  if (deviceTopic(topic, sizeof(topic), suffix) < sizeof(topic)) {
+    return String(topic);
+  }
+  return "HSC/devices/" + deviceId + "/" + suffix;
+}
+
+bool HSC_Base::topicMatches(const char *filter, const char *topic) {
+  while (*filter) {
+    if (*filter == '#') {
+      return true;
     }
+    if (*filter == '+') {
+      while (*topic && *topic != '/') {
+        topic++;
+      }
+      filter++;
+      continue;
+    }
+    if (*filter != *topic) {
+      // "a/#" also matches the parent level "a"
+      return *topic == '\0' && filter[0] == '/' && filter[1] == '#' &&
+             filter[2] == '\0';
+    }
+    filter++;
+    topic++;
+  }
+  return *topic == '\0';
+}
 
-    serializeJson(doc, *response);
-    request->send(response);
-  });
+void HSC_Base::dispatchMqtt(char *topic, uint8_t *payload,
+                            unsigned int length) {
+  for (const MqttSubscription &sub : mqttSubscriptions) {
+    if (topicMatches(sub.filter.c_str(), topic)) {
+      sub.handler(topic, payload, length);
+    }
+  }
+}
+
+// Handlers run on the async_tcp task; time them under their URI
+static ArRequestHandlerFunction
+withStallSpan(const char *uri, ArRequestHandlerFunction handler) {
+  String label = uri;
+  return [label, handler](AsyncWebServerRequest *request) {
+    HSC_STALL_SPAN(label.c_str());
+    handler(request);
+  };
 }
 
 void HSC_Base::registerPage(const char *uri, ArRequestHandlerFunction handler) {
-  server.on(uri, HTTP_GET, handler);
+  server.on(uri, HTTP_GET, withStallSpan(uri, handler));
 }
 
 void HSC_Base::registerApi(const char *uri, WebRequestMethodComposite method,
                            ArRequestHandlerFunction handler) {
-  server.on(uri, method, handler);
+  server.on(uri, method, withStallSpan(uri, handler));
+}
+
+void HSC_Base::registerJsonApi(const char *uri, JsonApiHandler handler) {
+  String label = uri;
+  server.on(uri, HTTP_GET, [label, handler](AsyncWebServerRequest *request) {
+    HSC_STALL_SPAN(label.c_str());
+    AsyncResponseStream *response =
+        request->beginResponseStream("application/json");
+    handler(*response);
+    request->send(response);
+  });
+  apiServer.on(uri, handler);
 }
 
-void HSC_Base::performOTA(const String &url) {
-  if (url.length() == 0) {
-    Serial.println("OTA Error: No URL configured");
+void HSC_Base::performOTA(const char *url) {
+  if (url == nullptr || url[0] == '\0') {
+    HSC_LOG("OTA Error: No URL configured");
     return;
   }
+  // httpUpdate reboots by itself once the image is written
+  store.commit();
+  HSC_StallSpan stallSpan("ota", OTA_STALL_ALLOW_MS);
 
   String finalUrl = url;
   finalUrl.replace("%BOARD_TYPE%", boardTypeShort);
@@ -1050,14 +1431,14 @@ void HSC_Base::performOTA(const String &url) {
   http.end();
 
   if (updateSpiffs) {
-    Serial.println("Filesystem update requested...");
+    HSC_LOG("Filesystem update requested...");
     String spiffsUrl = finalUrl;
     if (dotIndex != -1) {
       spiffsUrl = spiffsUrl.substring(0, dotIndex) + ".spiffs.bin";
     } else {
       spiffsUrl += ".spiffs.bin";
     }
-    Serial.println("SPIFFS URL: " + spiffsUrl);
+    HSC_LOG("SPIFFS URL: %s", spiffsUrl.c_str());
 
     // Unmount SPIFFS to ensure safe update
     SPIFFS.end();
@@ -1074,18 +1455,17 @@ void HSC_Base::performOTA(const String &url) {
     }
 
     if (ret == HTTP_UPDATE_OK) {
-      Serial.println("SPIFFS Update OK");
+      HSC_LOG("SPIFFS Update OK");
     } else {
-      Serial.printf("SPIFFS Update Failed (%d): %s\n",
-                    httpUpdate.getLastError(),
-                    httpUpdate.getLastErrorString().c_str());
+      HSC_LOG("SPIFFS Update Failed (%d): %s", httpUpdate.getLastError(),
+              httpUpdate.getLastErrorString().c_str());
       // Try to recover SPIFFS mount if update failed
       SPIFFS.begin(true);
     }
   }
 
-  Serial.println("Starting Firmware Update...");
-  Serial.println("URL: " + finalUrl);
+  HSC_LOG("Starting Firmware Update...");
+  HSC_LOG("URL: %s", finalUrl.c_str());
 
   httpUpdate.rebootOnUpdate(true); // Reboot after firmware
 
@@ -1096,15 +1476,14 @@ void HSC_Base::performOTA(const String &url) {
 
     switch (ret) {
     case HTTP_UPDATE_FAILED:
-      Serial.printf("HTTP_UPDATE_FAILED Error (%d): %s\n",
-                    httpUpdate.getLastError(),
-                    httpUpdate.getLastErrorString().c_str());
+      HSC_LOG("HTTP_UPDATE_FAILED Error (%d): %s", httpUpdate.getLastError(),
+              httpUpdate.getLastErrorString().c_str());
       break;
     case HTTP_UPDATE_NO_UPDATES:
-      Serial.println("HTTP_UPDATE_NO_UPDATES");
+      HSC_LOG("HTTP_UPDATE_NO_UPDATES");
       break;
     case HTTP_UPDATE_OK:
-      Serial.println("HTTP_UPDATE_OK");
+      HSC_LOG("HTTP_UPDATE_OK");
       break;
     }
   } else {
@@ -1112,15 +1491,14 @@ void HSC_Base::performOTA(const String &url) {
 
     switch (ret) {
     case HTTP_UPDATE_FAILED:
-      Serial.printf("HTTP_UPDATE_FAILED Error (%d): %s\n",
-                    httpUpdate.getLastError(),
-                    httpUpdate.getLastErrorString().c_str());
+      HSC_LOG("HTTP_UPDATE_FAILED Error (%d): %s", httpUpdate.getLastError(),
+              httpUpdate.getLastErrorString().c_str());
       break;
     case HTTP_UPDATE_NO_UPDATES:
-      Serial.println("HTTP_UPDATE_NO_UPDATES");
+      HSC_LOG("HTTP_UPDATE_NO_UPDATES");
       break;
     case HTTP_UPDATE_OK:
-      Serial.println("HTTP_UPDATE_OK");
+      HSC_LOG("HTTP_UPDATE_OK");
       break;
     }
   }
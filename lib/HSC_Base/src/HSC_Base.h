@@ -2,6 +2,14 @@
 #define HSC_BASE_H
 
 #include "ConfigManager.h"
+#include "HSC_ApiServer.h"
+#include "HSC_Board.h"
+#include "HSC_Log.h"
+#include "HSC_MqttBrokers.h"
+#include "HSC_NetStats.h"
+#include "HSC_OtaUpload.h"
+#include "HSC_Stall.h"
+#include "HSC_Store.h"
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <AsyncTCP.h>
@@ -10,12 +18,30 @@
 #include <PubSubClient.h>
 #include <SPIFFS.h>
 #include <WiFi.h>
+#include <functional>
+#include <vector>
 
 // Forward declaration
 class HSC_Base;
 
+// Handler for an inbound MQTT message on a subscribed topic filter
+typedef std::function<void(const char *topic, const uint8_t *payload,
+                           unsigned int length)>
+    MqttHandler;
+
+// Supplies the value of a custom %VAR% template variable
+typedef std::function<String()> TemplateVarHandler;
+
+// Writes the value of a custom %VAR% template variable into buf (len bytes,
+// NUL-terminated) and returns its length, as snprintf() does
+typedef std::function<size_t(char *buf, size_t len)> TemplateVarWriter;
+
 class HSC_Base {
 public:
+  // Room deviceTopic() and template values need, terminator included
+  static const size_t TOPIC_MAX = 64;
+  static const size_t TEMPLATE_VALUE_MAX = 64;
+
   HSC_Base();
   void begin();
   void loop();
@@ -28,7 +54,8 @@ public:
   void setUpdateUrl(const char *url);
 
   // Perform OTA Update
-  void performOTA(const String &url);
+  void performOTA(const char *url);
+  void performOTA(const String &url) { performOTA(url.c_str()); }
 
   // Register a custom page handler
   void registerPage(const char *uri, ArRequestHandlerFunction handler);
@@ -37,31 +64,92 @@ public:
   void registerApi(const char *uri, WebRequestMethodComposite method,
                    ArRequestHandlerFunction handler);
 
+  // Register a JSON GET API on the main web server and on the keep-alive
+  // API server, so polling clients can reuse one connection
+  void registerJsonApi(const char *uri, JsonApiHandler handler);
+
+  // Subscribe to an MQTT topic filter (+ and # wildcards allowed).
+  // Subscriptions are renewed on every reconnect.
+  void onMqtt(const char *topicFilter, MqttHandler handler);
+  void onMqtt(const String &topicFilter, MqttHandler handler) {
+    onMqtt(topicFilter.c_str(), handler);
+  }
+
+  // Add a %NAME% variable to the template processor used by all pages.
+  // A writer fills the caller's buffer; a handler returns a String.
+  void addTemplateVar(const char *name, TemplateVarWriter writer);
+  void addTemplateVar(const String &name, TemplateVarHandler handler);
+
+  // Write "HSC/devices/{deviceId}/{suffix}" into buf and return its length,
+  // as snprintf() does (valid after begin())
+  size_t deviceTopic(char *buf, size_t len, const char *suffix) const;
+  String deviceTopic(const char *suffix) const;
+
   // Getters
   AsyncWebServer &getServer() { return server; }
   PubSubClient &getMqttClient() { return mqttClient; }
   Config &getConfig() { return currentConfig; }
-
+  // Application key-value store, committed before planned reboots
+  HSC_Store &getStore() { return store; }
+  // Name connections of a module's server in /api/netstats
+  HSC_NetStats &getNetStats() { return netStats; }
+  const String &getDeviceId() const { return deviceId; }
+
+  // MQTT topic filter matching, as used by the dispatcher
+  static bool topicMatches(const char *filter, const char *topic);
+
+  // Write the value of template variable var into buf, truncated to fit,
+  // and return its length; unknown variables write an empty string
+  size_t processTemplate(char *buf, size_t len, const char *var);
   // Get the template processor function
   String processTemplate(const String &var) { return processor(var); }
 
 private:
   AsyncWebServer server;
+  HSC_ApiServer apiServer;
+  bool apiServerStarted = false;
+  HSC_OtaUpload otaUpload;
   WiFiClient espClient;
   PubSubClient mqttClient;
+  HSC_MqttBrokers mqttBrokers;
+  int mqttBroker = -1; // Index of the connected broker, -1 if none
   ConfigManager configManager;
   Config currentConfig;
+  HSC_Store store;
+  HSC_NetStats netStats;
+  unsigned long lastNetStats = 0;
 
   bool shouldReboot = false;
   bool locateActive = false;
-  unsigned long lastMqttReconnectAttempt = 0;
+  bool ledOn = false;
   String boardTypeDesc;
   String boardTypeShort;
 
+  struct MqttSubscription {
+    String filter;
+    MqttHandler handler;
+  };
+  std::vector<MqttSubscription> mqttSubscriptions;
+
+  struct TemplateVar {
+    String name;
+    TemplateVarWriter writer; // One of the two is set
+    TemplateVarHandler handler;
+  };
+  std::vector<TemplateVar> templateVars;
+
+  void setLed(bool on);
   void setupWifi();
   void reconnectMqtt();
+  void failbackMqtt();
+  void checkConfigTrial();
+  void dispatchMqtt(char *topic, uint8_t *payload, unsigned int length);
   void setupWebServer();
   String processor(const String &var);
+  int writeBuiltinVar(char *buf, size_t len, const char *var);
+  void writeStatus(Print &out);
+  void writeStoreStats(Print &out);
+  void writeStall(Print &out);
 
   String _preConfigUpdateUrl;
   bool shouldUpdate = false;
@@ -0,0 +1,94 @@
+#ifndef HSC_BOARD_H
+#define HSC_BOARD_H
+
+#include <stdint.h>
+
+// Board traits: the pins, status LED, memory profile and peripherals of
+// the hardware, as compile-time constants. The board is chosen with a
+// build flag so every translation unit sees the same one:
+//
+//   build_flags = -D HSC_BOARD=HSC_BOARD_D32_PRO
+//
+// and the library reads it through the HSC_Board typedef. Tests such as
+// `if (HSC_Board::HAS_LED)` are constant, so the compiler drops the code
+// for hardware the board does not have.
+//
+// A board not listed here is described in a project header, named with
+// -D HSC_BOARD=HSC_BOARD_CUSTOM -D HSC_BOARD_HEADER='"my_board.h"', that
+// defines struct HSC_BoardCustom with the members below.
+
+#define HSC_BOARD_DEVKIT 1   // ESP32-DevKitC, NodeMCU-32S
+#define HSC_BOARD_MODULE 2   // Bare WROOM module on a custom PCB, no LED
+#define HSC_BOARD_D32_PRO 3  // LOLIN D32 Pro (WROVER, PSRAM)
+#define HSC_BOARD_CUSTOM 100 // From HSC_BOARD_HEADER
+
+#ifndef HSC_BOARD
+#define HSC_BOARD HSC_BOARD_DEVKIT
+#endif
+
+// Constants are enumerators: unlike static const members they are never
+// odr-used (by a reference or a ?: with an int lvalue), so C++11 needs no
+// out-of-class definitions for them
+struct HSC_BoardDevKit {
+  static const char *name() { return "ESP32 DevKit"; }
+
+  enum {
+    // Status LED (locate, AP button feedback)
+    HAS_LED = true,
+    PIN_LED = 2,
+    LED_ACTIVE_LOW = false,
+
+    // AP Mode Button
+    PIN_AP_BUTTON = 4,
+
+    // Module defaults, used when a module is given pin -1
+    PIN_LOCONET_RX = 16, // HSC_LocoNet
+    PIN_LOCONET_TX = 17,
+    PIN_DCC_INPUT = 34,  // HSC_DCC, via opto-isolator
+    PIN_LED_STRIP = 18,  // HSC_LedStrip, WS2812 data
+    PIN_MOTOR_IN1 = 32,  // HSC_Motor H-bridge inputs
+    PIN_MOTOR_IN2 = 33,
+    PIN_MOTOR_BEMF = 39, // Back-EMF divider on the IN1 terminal
+    PIN_MOTOR_BEMF2 = 36, // and on the IN2 terminal
+
+    // Memory profile
+    HAS_PSRAM = false,
+    API_MAX_CLIENTS = 4 // Keep-alive API connections
+  };
+};
+
+// A derived board redeclares only what differs
+struct HSC_BoardModule : HSC_BoardDevKit {
+  static const char *name() { return "ESP32 module"; }
+
+  enum { HAS_LED = false };
+};
+
+struct HSC_BoardD32Pro : HSC_BoardDevKit {
+  static const char *name() { return "LOLIN D32 Pro"; }
+
+  enum {
+    PIN_LED = 5,
+    LED_ACTIVE_LOW = true,
+    // GPIO 16 and 17 carry the WROVER's PSRAM
+    PIN_LOCONET_RX = 26,
+    PIN_LOCONET_TX = 27,
+    HAS_PSRAM = true,
+    API_MAX_CLIENTS = 8
+  };
+};
+
+#if HSC_BOARD == HSC_BOARD_DEVKIT
+typedef HSC_BoardDevKit HSC_Board;
+#elif HSC_BOARD == HSC_BOARD_MODULE
+typedef HSC_BoardModule HSC_Board;
+#elif HSC_BOARD == HSC_BOARD_D32_PRO
+typedef HSC_BoardD32Pro HSC_Board;
+#elif HSC_BOARD == HSC_BOARD_CUSTOM
+#include HSC_BOARD_HEADER
+typedef HSC_BoardCustom HSC_Board;
+#else
+#error "Unknown HSC_BOARD"
+#endif
+
+#endif
@@ -0,0 +1,447 @@
+#include "HSC_DCC.h"
+#include <soc/rmt_struct.h>
+
+// NMRA S-9.1 receiver limits for half-bit durations, in microseconds
+static const uint32_t DCC_ONE_MIN_US = 52;
+static const uint32_t DCC_ONE_MAX_US = 64;
+static const uint32_t DCC_ZERO_MIN_US = 90;
+static const uint32_t DCC_ZERO_MAX_US = 10000;
+static const uint8_t DCC_MIN_PREAMBLE = 10;
+
+// A packet equal to the last one for its target is a repeat only within
+// this much signal time of it; beyond that it is passed on again
+static const uint32_t DCC_REPEAT_WINDOW_US = 50000;
+
+// Capture window. 4 RMT memory blocks hold 256 items (one bit each); the
+// densest signal (all ones, 116 us per bit) fills ~172 of them in 20 ms.
+static const uint8_t DCC_RMT_BLOCKS = 4;
+static const uint16_t DCC_RMT_ITEMS = DCC_RMT_BLOCKS * 64;
+static const uint64_t DCC_WINDOW_US = 20000;
+
+static const unsigned long DCC_PUBLISH_INTERVAL_MS = 100;
+static const unsigned long DCC_LOCO_EXPIRE_MS = 10UL * 60 * 1000;
+
+// --- DccPacketDecoder ---
+
+DccPacketDecoder::DccPacketDecoder(PacketCallback callback, void *arg)
+    : _callback(callback), _arg(arg) {
+  memset(_recent, 0, sizeof(_recent));
+  _packet.len = 0;
+}
+
+void DccPacketDecoder::reset() {
+  _pendingHalf = -1;
+  _state = PREAMBLE;
+  _preambleOnes = 0;
+  _packet.len = 0;
+}
+
+void DccPacketDecoder::feedHalfBit(uint32_t durationUs) {
+  _stats.halfBits++;
+  _timeUs += durationUs;
+  int8_t half;
+  if (durationUs >= DCC_ONE_MIN_US && durationUs <= DCC_ONE_MAX_US) {
+    half = 1;
+  } else if (durationUs >= DCC_ZERO_MIN_US && durationUs <= DCC_ZERO_MAX_US) {
+    half = 0;
+  } else {
+    _stats.framingErrors++;
+    reset();
+    return;
+  }
+
+  // A bit is two equal halves. A mismatch means we are paired with the
+  // wrong edge; keep the newer half and realign.
+  if (_pendingHalf < 0) {
+    _pendingHalf = half;
+  } else if (_pendingHalf == half) {
+    _pendingHalf = -1;
+    feedBit(half);
+  } else {
+    _pendingHalf = half;
+    if (_state == DATA) {
+      _stats.framingErrors++;
+      _state = PREAMBLE;
+      _preambleOnes = 0;
+    }
+  }
+}
+
+void DccPacketDecoder::feedBit(uint8_t bit) {
+  if (_state == PREAMBLE) {
+    if (bit) {
+      if (_preambleOnes < 255) {
+        _preambleOnes++;
+      }
+    } else {
+      if (_preambleOnes >= DCC_MIN_PREAMBLE) {
+        _state = DATA;
+        _packet.len = 0;
+        _bitCount = 0;
+        _byte = 0;
+      }
+      _preambleOnes = 0;
+    }
+    return;
+  }
+
+  if (_bitCount < 8) {
+    _byte = (_byte << 1) | bit;
+    if (++_bitCount == 8) {
+      if (_packet.len == DCC_MAX_PACKET) {
+        _stats.framingErrors++;
+        _state = PREAMBLE;
+        _preambleOnes = 0;
+        return;
+      }
+      _packet.data[_packet.len++] = _byte;
+    }
+    return;
+  }
+
+  // Separator bit: 0 = another byte follows, 1 = packet end bit
+  if (bit == 0) {
+    _bitCount = 0;
+    _byte = 0;
+    return;
+  }
+  packetComplete();
+  _state = PREAMBLE;
+  _preambleOnes = 1; // The end bit may double as the first preamble bit
+}
+
+// What a packet sets: the address, and the instruction without its
+// argument (speed, function states, turnout direction). A repeat is only
+// compared with the last packet for the same target, so a return to an
+// earlier value (speed 10, 20, 10) is never taken for one.
+static uint32_t packetKey(const DccPacket &p) {
+  uint8_t a = p.data[0];
+  if (a >= 0x80 && a <= 0xBF) {
+    // Accessory: 10AAAAAA 1AAACDDD, leaving out activate (C) and direction
+    return 0x80000000u | (a << 8) | (p.data[1] & 0xF6);
+  }
+  uint32_t address = a;
+  uint8_t i = 1;
+  if (a >= 0xC0 && a <= 0xE7) {
+    address = (a << 8) | p.data[1];
+    i = 2;
+  }
+  uint8_t instruction = p.data[i];
+  uint8_t mask;
+  switch (instruction >> 5) {
+  case 2: // Speed and direction
+  case 3:
+    mask = 0xC0;
+    break;
+  case 4: // F0-F4
+    mask = 0xE0;
+    break;
+  case 5: // F5-F8 or F9-F12
+    mask = 0xF0;
+    break;
+  default: // The whole byte is the opcode
+    mask = 0xFF;
+    break;
+  }
+  return (address << 8) | (instruction & mask);
+}
+
+void DccPacketDecoder::packetComplete() {
+  if (_packet.len < 3) {
+    _stats.framingErrors++;
+    return;
+  }
+  uint8_t check = 0;
+  for (uint8_t i = 0; i < _packet.len; i++) {
+    check ^= _packet.data[i];
+  }
+  if (check != 0) {
+    _stats.checksumErrors++;
+    return;
+  }
+  _stats.packets++;
+
+  uint32_t key = packetKey(_packet);
+  Recent *slot = nullptr;
+  for (uint8_t i = 0; i < RECENT; i++) {
+    if (_recent[i].key == key && _recent[i].packet.len > 0) {
+      slot = &_recent[i];
+      break;
+    }
+  }
+  if (slot != nullptr && slot->packet.len == _packet.len &&
+      memcmp(slot->packet.data, _packet.data, _packet.len) == 0 &&
+      _timeUs - slot->atUs < DCC_REPEAT_WINDOW_US) {
+    slot->atUs = _timeUs;
+    _stats.duplicates++;
+    return;
+  }
+  if (slot == nullptr) {
+    slot = &_recent[_recentNext];
+    _recentNext = (_recentNext + 1) % RECENT;
+  }
+  slot->key = key;
+  slot->atUs = _timeUs;
+  slot->packet = _packet;
+  _callback(_packet, _arg);
+}
+
+// --- HSC_DCC ---
+
+HSC_DCC::HSC_DCC(HSC_Base &base, int pin, rmt_channel_t channel)
+    : base(base), pin(pin < 0 ? HSC_Board::PIN_DCC_INPUT : pin),
+      channel(channel), decoder(onPacket, this) {
+  memset(locos, 0, sizeof(locos));
+}
+
+bool HSC_DCC::begin() {
+  rmt_config_t cfg = RMT_DEFAULT_CONFIG_RX((gpio_num_t)pin, channel);
+  cfg.clk_div = 80; // 1 us per tick
+  cfg.mem_block_num = DCC_RMT_BLOCKS;
+  cfg.rx_config.filter_en = true;
+  cfg.rx_config.filter_ticks_thresh = 250; // Ignore glitches under ~3 us
+  // The track signal never idles; windows are cut by the timer instead
+  cfg.rx_config.idle_threshold = 0x7FFF;
+
+  if (rmt_config(&cfg) != ESP_OK ||
+      rmt_driver_install(channel, 1024, 0) != ESP_OK) {
+    HSC_LOG("DCC: RMT setup failed");
+    return false;
+  }
+
+  packetQueue = xQueueCreate(QUEUE_LEN, sizeof(DccPacket));
+
+  esp_timer_create_args_t timerArgs = {};
+  timerArgs.callback = onWindow;
+  timerArgs.arg = this;
+  timerArgs.name = "dcc_window";
+  if (esp_timer_create(&timerArgs, &windowTimer) != ESP_OK) {
+    HSC_LOG("DCC: timer setup failed");
+    return false;
+  }
+
+  rmt_rx_start(channel, true);
+  esp_timer_start_periodic(windowTimer, DCC_WINDOW_US);
+  HSC_LOG("DCC decoder on GPIO %d (RMT channel %d)", pin, (int)channel);
+  return true;
+}
+
+void HSC_DCC::onWindow(void *arg) {
+  static_cast<HSC_DCC *>(arg)->collectWindow();
+}
+
+void HSC_DCC::collectWindow() {
+  rmt_rx_stop(channel);
+  // Items land in RMT RAM as they complete; copy them before restarting
+  static rmt_item32_t items[DCC_RMT_ITEMS];
+  // The channel owns DCC_RMT_BLOCKS consecutive 64-item blocks; address
+  // them as one area rather than indexing past a block's data32[64]
+  volatile rmt_item32_t *mem =
+      reinterpret_cast<volatile rmt_item32_t *>(&RMTMEM.chan[channel]);
+  uint16_t count = 0;
+  while (count < DCC_RMT_ITEMS) {
+    rmt_item32_t item;
+    item.val = mem[count].val;
+    if (item.duration0 == 0) {
+      break;
+    }
+    items[count++] = item;
+    if (item.duration1 == 0) {
+      break;
+    }
+  }
+  // A forced stop writes no end item and the restart only rewinds the
+  // write pointer, so a shorter next window would run on into this one's
+  // items. Clear the area; the first zero duration ends the next copy.
+  for (uint16_t i = 0; i < DCC_RMT_ITEMS; i++) {
+    mem[i].val = 0;
+  }
+  rmt_rx_start(channel, true);
+
+  // Drain anything the driver queued if the signal was lost long enough
+  // for an idle end
+  RingbufHandle_t rb = nullptr;
+  if (rmt_get_ringbuf_handle(channel, &rb) == ESP_OK && rb != nullptr) {
+    size_t size;
+    void *data;
+    while ((data = xRingbufferReceive(rb, &size, 0)) != nullptr) {
+      vRingbufferReturnItem(rb, data);
+    }
+  }
+
+  // Edges during the restart are lost; the decoder realigns on the next
+  // preamble, and DCC repeats every packet anyway.
+  decoder.reset();
+  for (uint16_t i = 0; i < count; i++) {
+    decoder.feedHalfBit(items[i].duration0);
+    if (items[i].duration1 != 0) {
+      decoder.feedHalfBit(items[i].duration1);
+    }
+  }
+}
+
+void HSC_DCC::onPacket(const DccPacket &packet, void *arg) {
+  HSC_DCC *self = static_cast<HSC_DCC *>(arg);
+  if (xQueueSend(self->packetQueue, &packet, 0) != pdTRUE) {
+    self->decoder.stats().queueOverflows++;
+  }
+}
+
+static void applyCapturedPacket(const DccPacket &packet, void *arg) {
+  static_cast<HSC_DCC *>(arg)->applyPacket(packet);
+}
+
+void HSC_DCC::feedCapture(const uint16_t *halfBitsUs, size_t count) {
+  DccPacketDecoder captureDecoder(applyCapturedPacket, this);
+  for (size_t i = 0; i < count; i++) {
+    captureDecoder.feedHalfBit(halfBitsUs[i]);
+  }
+  const DccStats &s = captureDecoder.stats();
+  HSC_LOG("DCC capture: %u half bits, %u packets, %u duplicates, "
+          "%u checksum errors",
+          s.halfBits, s.packets, s.duplicates, s.checksumErrors);
+}
+
+void HSC_DCC::loop() {
+  if (packetQueue != nullptr) {
+    DccPacket packet;
+    while (xQueueReceive(packetQueue, &packet, 0) == pdTRUE) {
+      applyPacket(packet);
+    }
+  }
+  if (millis() - lastPublish >= DCC_PUBLISH_INTERVAL_MS) {
+    lastPublish = millis();
+    publishDirty();
+  }
+}
+
+DccLoco *HSC_DCC::findLoco(uint16_t address, bool create) {
+  DccLoco *oldest = nullptr;
+  for (uint8_t i = 0; i < locoCount; i++) {
+    if (locos[i].address == address) {
+      return &locos[i];
+    }
+    if (oldest == nullptr || locos[i].lastSeen < oldest->lastSeen) {
+      oldest = &locos[i];
+    }
+  }
+  if (!create) {
+    return nullptr;
+  }
+  DccLoco *loco = locoCount < MAX_LOCOS ? &locos[locoCount++] : oldest;
+  memset(loco, 0, sizeof(*loco));
+  loco->address = address;
+  loco->forward = true;
+  loco->speedSteps = 128;
+  return loco;
+}
+
+const DccLoco *HSC_DCC::getLoco(uint16_t address) const {
+  for (uint8_t i = 0; i < locoCount; i++) {
+    if (locos[i].address == address) {
+      return &locos[i];
+    }
+  }
+  return nullptr;
+}
+
+const DccStats &HSC_DCC::getStats() {
+  statsSnapshot = decoder.stats();
+  return statsSnapshot;
+}
+
+bool HSC_DCC::applyPacket(const DccPacket &packet) {
+  const uint8_t *d = packet.data;
+  uint8_t n = packet.len - 1; // Without checksum
+  uint16_t address;
+  uint8_t i;
+
+  if (d[0] >= 0x01 && d[0] <= 0x7F) {
+    address = d[0];
+    i = 1;
+  } else if (d[0] >= 0xC0 && d[0] <= 0xE7) {
+    address = ((uint16_t)(d[0] & 0x3F) << 8) | d[1];
+    i = 2;
+  } else {
+    return false; // Broadcast, idle, accessory or service mode
+  }
+  if (i >= n) {
+    return false;
+  }
+
+  DccLoco *loco = findLoco(address, true);
+  DccLoco before = *loco;
+  loco->lastSeen = millis();
+  uint8_t cmd = d[i];
+
+  if (cmd == 0x3F && i + 1 < n) {
+    // 128 speed steps: 0 stop, 1 emergency stop, 2..127 = step 1..126
+    uint8_t v = d[i + 1] & 0x7F;
+    loco->forward = (d[i + 1] & 0x80) != 0;
+    loco->speed = v < 2 ? 0 : v - 1;
+    loco->speedSteps = 128;
+  } else if ((cmd & 0xC0) == 0x40) {
+    // 28 speed steps: 0-1 stop, 2-3 emergency stop, 4..31 = step 1..28
+    uint8_t v = ((cmd & 0x0F) << 1) | ((cmd >> 4) & 0x01);
+    loco->forward = (cmd & 0x20) != 0;
+    loco->speed = v < 4 ? 0 : v - 3;
+    loco->speedSteps = 28;
+  } else if ((cmd & 0xE0) == 0x80) {
+    // F0-F4
+    loco->functions = (loco->functions & ~0x1FUL) | ((cmd >> 4) & 0x01) |
+                      ((uint32_t)(cmd & 0x0F) << 1);
+  } else if ((cmd & 0xF0) == 0xB0) {
+    loco->functions =
+        (loco->functions & ~(0x0FUL << 5)) | ((uint32_t)(cmd & 0x0F) << 5);
+  } else if ((cmd & 0xF0) == 0xA0) {
+    loco->functions =
+        (loco->functions & ~(0x0FUL << 9)) | ((uint32_t)(cmd & 0x0F) << 9);
+  } else if (cmd == 0xDE && i + 1 < n) {
+    loco->functions =
+        (loco->functions & ~(0xFFUL << 13)) | ((uint32_t)d[i + 1] << 13);
+  } else if (cmd == 0xDF && i + 1 < n) {
+    loco->functions =
+        (loco->functions & ~(0xFFUL << 21)) | ((uint32_t)d[i + 1] << 21);
+  }
+
+  bool changed = loco->speed != before.speed ||
+                 loco->speedSteps != before.speedSteps ||
+                 loco->forward != before.forward ||
+                 loco->functions != before.functions;
+  if (changed) {
+    loco->dirty = true;
+  }
+  return changed;
+}
+
+void HSC_DCC::publishDirty() {
+  PubSubClient &mqtt = base.getMqttClient();
+  if (!mqtt.connected()) {
+    return;
+  }
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < locoCount; i++) {
+    DccLoco &loco = locos[i];
+    if (!loco.dirty) {
+      // Forget locos that have left the layout so the table can be reused
+      if (now - loco.lastSeen > DCC_LOCO_EXPIRE_MS) {
+        loco = locos[--locoCount];
+        i--;
+      }
+      continue;
+    }
+    loco.dirty = false;
+
+    StaticJsonDocument<128> doc;
+    doc["speed"] = loco.speed;
+    doc["steps"] = loco.speedSteps;
+    doc["direction"] = loco.forward ? "forward" : "reverse";
+    doc["functions"] = loco.functions;
+    char buf[128];
+    serializeJson(doc, buf);
+    char topic[32];
+    snprintf(topic, sizeof(topic), "HSC/dcc/loco/%u", loco.address);
+    mqtt.publish(topic, buf, true);
+    decoder.stats().mqttPublished++;
+  }
+}
@@ -0,0 +1,129 @@
+#ifndef HSC_DCC_H
+#define HSC_DCC_H
+
+#include "HSC_Base.h"
+#include <driver/rmt.h>
+#include <esp_timer.h>
+#include <freertos/queue.h>
+
+// Longest NMRA packet (address, up to 4 instruction bytes, checksum)
+static const uint8_t DCC_MAX_PACKET = 6;
+
+struct DccPacket {
+  uint8_t data[DCC_MAX_PACKET];
+  uint8_t len;
+};
+
+struct DccStats {
+  uint32_t halfBits;
+  uint32_t packets;
+  uint32_t checksumErrors;
+  uint32_t duplicates;
+  uint32_t framingErrors;
+  uint32_t queueOverflows;
+  uint32_t mqttPublished;
+};
+
+// Turns a stream of half-bit durations into validated NMRA DCC packets.
+// Has no hardware dependencies, so recorded timing captures can be fed to
+// it directly (see HSC_DCC::feedCapture()).
+class DccPacketDecoder {
+public:
+  typedef void (*PacketCallback)(const DccPacket &packet, void *arg);
+
+  DccPacketDecoder(PacketCallback callback, void *arg);
+
+  void feedHalfBit(uint32_t durationUs);
+  void reset();
+  DccStats &stats() { return _stats; }
+
+private:
+  enum State { PREAMBLE, DATA };
+
+  PacketCallback _callback;
+  void *_arg;
+  DccStats _stats = {};
+
+  int8_t _pendingHalf = -1; // Class of an unpaired half bit, -1 if none
+  State _state = PREAMBLE;
+  uint8_t _preambleOnes = 0;
+  uint8_t _bitCount = 0;
+  uint8_t _byte = 0;
+  DccPacket _packet;
+
+  // Signal time, the sum of the half bits fed, so captures replay alike
+  uint32_t _timeUs = 0;
+
+  // Last packet per target (address and instruction kind), to drop the
+  // command station's repeats before they are queued
+  struct Recent {
+    uint32_t key;
+    uint32_t atUs;
+    DccPacket packet;
+  };
+  static const uint8_t RECENT = 8;
+  Recent _recent[RECENT];
+  uint8_t _recentNext = 0;
+
+  void feedBit(uint8_t bit);
+  void packetComplete();
+};
+
+struct DccLoco {
+  uint16_t address;
+  uint8_t speed;      // 0 = stop, 1..126 (128 steps) or 1..28
+  uint8_t speedSteps; // 28 or 128
+  bool forward;
+  uint32_t functions; // bit n = Fn, F0..F28
+  bool dirty;
+  unsigned long lastSeen;
+};
+
+// DCC track-signal decoder. The RMT peripheral timestamps every edge in
+// hardware; a 20 ms esp_timer window collects the captured items and
+// decodes them, so there is no CPU interrupt per edge. Loco speed,
+// direction and function changes are published as retained JSON on
+// HSC/dcc/loco/{address}, only when something changed.
+class HSC_DCC {
+public:
+  // Pin defaults (-1) to PIN_DCC_INPUT from HSC_Board.h
+  HSC_DCC(HSC_Base &base, int pin = -1, rmt_channel_t channel = RMT_CHANNEL_4);
+
+  bool begin();
+  void loop();
+
+  // Decode a recorded capture of half-bit durations in microseconds.
+  // Runs the same decoder as the RMT path; useful for replaying captured
+  // track traffic deterministically and for throughput measurements.
+  void feedCapture(const uint16_t *halfBitsUs, size_t count);
+
+  const DccLoco *getLoco(uint16_t address) const;
+  const DccStats &getStats();
+
+  // Apply one packet to the loco table; returns true if state changed
+  bool applyPacket(const DccPacket &packet);
+
+private:
+  static const uint8_t MAX_LOCOS = 32;
+  static const uint8_t QUEUE_LEN = 32;
+
+  HSC_Base &base;
+  int pin;
+  rmt_channel_t channel;
+  esp_timer_handle_t windowTimer = nullptr;
+  QueueHandle_t packetQueue = nullptr;
+  DccPacketDecoder decoder;
+  DccStats statsSnapshot = {};
+
+  DccLoco locos[MAX_LOCOS];
+  uint8_t locoCount = 0;
+  unsigned long lastPublish = 0;
+
+  static void onPacket(const DccPacket &packet, void *arg);
+  static void onWindow(void *arg);
+  void collectWindow();
+  DccLoco *findLoco(uint16_t address, bool create);
+  void publishDirty();
+};
+
+#endif
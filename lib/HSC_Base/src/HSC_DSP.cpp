@@ -0,0 +1,274 @@
+#include "HSC_DSP.h"
+
+#ifdef HSC_DSP_USE_ESPDSP
+#include <esp_dsp.h>
+#endif
+
+static inline q15_t sat16(int64_t v) {
+  return v > 32767 ? 32767 : v < -32768 ? -32768 : (q15_t)v;
+}
+
+static int32_t toQ28(float v) {
+  double scaled = v * 268435456.0;
+  return (int32_t)(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+}
+
+// --- Biquad ---
+
+// Coefficients from the RBJ audio EQ cookbook
+static DspBiquad designBiquad(float b0, float b1, float b2, float a0,
+                              float a1, float a2) {
+  DspBiquad f = {};
+  f.b0 = toQ28(b0 / a0);
+  f.b1 = toQ28(b1 / a0);
+  f.b2 = toQ28(b2 / a0);
+  f.a1 = toQ28(a1 / a0);
+  f.a2 = toQ28(a2 / a0);
+  return f;
+}
+
+DspBiquad DspBiquad::lowpass(float cutoffHz, float sampleHz, float q) {
+  float w0 = 2.0f * PI * cutoffHz / sampleHz;
+  float c = cosf(w0);
+  float alpha = sinf(w0) / (2.0f * q);
+  return designBiquad((1 - c) / 2, 1 - c, (1 - c) / 2, 1 + alpha, -2 * c,
+                      1 - alpha);
+}
+
+DspBiquad DspBiquad::highpass(float cutoffHz, float sampleHz, float q) {
+  float w0 = 2.0f * PI * cutoffHz / sampleHz;
+  float c = cosf(w0);
+  float alpha = sinf(w0) / (2.0f * q);
+  return designBiquad((1 + c) / 2, -(1 + c), (1 + c) / 2, 1 + alpha, -2 * c,
+                      1 - alpha);
+}
+
+void DspBiquad::process(const q15_t *in, q15_t *out, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    q15_t x = in[i];
+    int64_t acc = (int64_t)b0 * x + (int64_t)b1 * x1 + (int64_t)b2 * x2 -
+                  (int64_t)a1 * y1 - (int64_t)a2 * y2 + err;
+    q15_t y = sat16((acc + (1 << 27)) >> 28);
+    int64_t residue = acc - ((int64_t)y << 28);
+    err = residue > (1 << 28) || residue < -(1 << 28) ? 0 : residue;
+    x2 = x1;
+    x1 = x;
+    y2 = y1;
+    y1 = y;
+    out[i] = y;
+  }
+}
+
+// --- FIR ---
+
+bool DspFir::begin(const q15_t *c, uint8_t n, uint8_t decim) {
+  if (n == 0 || n > MAX_TAPS || decim == 0) {
+    return false;
+  }
+  memcpy(coeffs, c, n * sizeof(q15_t));
+  taps = n;
+  decimation = decim;
+  reset();
+  return true;
+}
+
+void DspFir::reset() {
+  memset(delay, 0, sizeof(delay));
+  pos = 0;
+  phase = 0;
+}
+
+inline void DspFir::push(q15_t x) {
+  pos = pos == 0 ? taps - 1 : pos - 1;
+  delay[pos] = x;
+  delay[pos + taps] = x;
+}
+
+size_t DspFir::processReference(const q15_t *in, q15_t *out, size_t n) {
+  size_t produced = 0;
+  for (size_t i = 0; i < n; i++) {
+    push(in[i]);
+    if (++phase < decimation) {
+      continue;
+    }
+    phase = 0;
+    // delay[pos] is the newest sample, delay[pos + taps - 1] the oldest
+    const q15_t *window = &delay[pos];
+    int64_t acc = 0;
+    for (uint8_t k = 0; k < taps; k++) {
+      acc += (int32_t)coeffs[k] * window[k];
+    }
+    out[produced++] = sat16((acc + (1 << 14)) >> 15);
+  }
+  return produced;
+}
+
+size_t DspFir::process(const q15_t *in, q15_t *out, size_t n) {
+#ifdef HSC_DSP_USE_ESPDSP
+  // The assembly routine does not saturate and is only used for tap
+  // counts that are a multiple of four
+  if ((taps & 3) == 0) {
+    size_t produced = 0;
+    for (size_t i = 0; i < n; i++) {
+      push(in[i]);
+      if (++phase < decimation) {
+        continue;
+      }
+      phase = 0;
+      dsps_dotprod_s16(coeffs, &delay[pos], &out[produced++], taps, 0);
+    }
+    return produced;
+  }
+#endif
+  return processReference(in, out, n);
+}
+
+// --- Envelope, threshold, block statistics ---
+
+static uint16_t smoothing(float timeMs, float sampleHz) {
+  if (timeMs <= 0) {
+    return 32767;
+  }
+  float k = 1.0f - expf(-1000.0f / (timeMs * sampleHz));
+  return k * 32767.0f + 0.5f;
+}
+
+DspEnvelope DspEnvelope::fromTimes(float attackMs, float releaseMs,
+                                   float sampleHz) {
+  DspEnvelope e = {};
+  e.attack = smoothing(attackMs, sampleHz);
+  e.release = smoothing(releaseMs, sampleHz);
+  return e;
+}
+
+q15_t DspEnvelope::process(const q15_t *in, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    int32_t x = in[i] < 0 ? -(int32_t)in[i] : in[i];
+    int32_t k = x > level ? attack : release;
+    level += ((x - level) * k) >> 15;
+  }
+  return sat16(level);
+}
+
+bool DspThreshold::update(q15_t level) {
+  bool next = active ? level > off : level >= on;
+  bool changed = next != active;
+  active = next;
+  return changed;
+}
+
+static uint32_t isqrt(uint64_t v) {
+  uint64_t r = 0;
+  uint64_t bit = 1ULL << 62;
+  while (bit > v) {
+    bit >>= 2;
+  }
+  while (bit != 0) {
+    if (v >= r + bit) {
+      v -= r + bit;
+      r = (r >> 1) + bit;
+    } else {
+      r >>= 1;
+    }
+    bit >>= 2;
+  }
+  return r;
+}
+
+q15_t dspRms(const q15_t *in, size_t n) {
+  if (n == 0) {
+    return 0;
+  }
+  uint64_t sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    sum += (int32_t)in[i] * in[i];
+  }
+  return sat16(isqrt(sum / n));
+}
+
+q15_t dspPeak(const q15_t *in, size_t n) {
+  int32_t peak = 0;
+  for (size_t i = 0; i < n; i++) {
+    int32_t x = in[i] < 0 ? -(int32_t)in[i] : in[i];
+    if (x > peak) {
+      peak = x;
+    }
+  }
+  return sat16(peak);
+}
+
+// --- Benchmark ---
+
+static void report(Print &out, const char *name, uint32_t cycles,
+                   uint32_t blockCycles) {
+  out.printf("  %-16s %8u cycles  %5.1f%% of block period\n", name,
+             (unsigned)cycles, 100.0f * cycles / blockCycles);
+}
+
+void HSC_DSP::benchmark(Print &out, uint32_t sampleHz, size_t blockSize) {
+  q15_t *in = new q15_t[blockSize];
+  q15_t *out1 = new q15_t[blockSize];
+  // Two tones plus a little deterministic noise
+  uint32_t seed = 12345;
+  for (size_t i = 0; i < blockSize; i++) {
+    seed = seed * 1103515245 + 12345;
+    float t = (float)i / sampleHz;
+    float v = 0.5f * sinf(2 * PI * 50 * t) + 0.2f * sinf(2 * PI * 1000 * t);
+    in[i] = v * 32767 + (int16_t)(seed >> 16) / 64;
+  }
+
+  uint32_t blockCycles =
+      (uint64_t)getCpuFrequencyMhz() * 1000000 * blockSize / sampleHz;
+  out.printf("DSP benchmark: %u samples at %u Hz (%u cycles per block)\n",
+             (unsigned)blockSize, (unsigned)sampleHz, (unsigned)blockCycles);
+
+  uint32_t start;
+  DspBiquad biquad = DspBiquad::lowpass(100, sampleHz);
+  start = ESP.getCycleCount();
+  biquad.process(in, out1, blockSize);
+  report(out, "biquad", ESP.getCycleCount() - start, blockCycles);
+
+  // 32-tap moving average as a stand-in for a designed low-pass
+  q15_t coeffs[32];
+  for (uint8_t k = 0; k < 32; k++) {
+    coeffs[k] = 32767 / 32;
+  }
+  DspFir fir;
+  fir.begin(coeffs, 32);
+  start = ESP.getCycleCount();
+  fir.processReference(in, out1, blockSize);
+  report(out, "fir32 portable", ESP.getCycleCount() - start, blockCycles);
+  fir.reset();
+  start = ESP.getCycleCount();
+  fir.process(in, out1, blockSize);
+#ifdef HSC_DSP_USE_ESPDSP
+  report(out, "fir32 esp-dsp", ESP.getCycleCount() - start, blockCycles);
+#else
+  report(out, "fir32 (no esp-dsp)", ESP.getCycleCount() - start,
+         blockCycles);
+#endif
+
+  DspFir decimator;
+  decimator.begin(coeffs, 32, 8);
+  start = ESP.getCycleCount();
+  decimator.process(in, out1, blockSize);
+  report(out, "fir32 decimate/8", ESP.getCycleCount() - start, blockCycles);
+
+  start = ESP.getCycleCount();
+  volatile q15_t rms = dspRms(in, blockSize);
+  report(out, "rms", ESP.getCycleCount() - start, blockCycles);
+
+  DspEnvelope env = DspEnvelope::fromTimes(1, 50, sampleHz);
+  start = ESP.getCycleCount();
+  env.process(in, blockSize);
+  report(out, "envelope", ESP.getCycleCount() - start, blockCycles);
+
+  start = ESP.getCycleCount();
+  volatile q15_t peak = dspPeak(in, blockSize);
+  report(out, "peak", ESP.getCycleCount() - start, blockCycles);
+
+  (void)rms;
+  (void)peak;
+  delete[] in;
+  delete[] out1;
+}
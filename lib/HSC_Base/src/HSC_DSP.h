@@ -0,0 +1,100 @@
+#ifndef HSC_DSP_H
+#define HSC_DSP_H
+
+#include <Arduino.h>
+
+// Block-based fixed-point signal processing for sensor channels (current
+// sense, analog detectors). Samples are Q15: -32768..32767 is -1.0..1.0,
+// so 12-bit ADC readings are scaled with (raw - midpoint) << 4.
+//
+// Every kernel has a portable implementation. Building with
+// -DHSC_DSP_USE_ESPDSP routes the FIR/decimation inner loop through the
+// esp-dsp dsps_dotprod_s16 assembly routine; HSC_DSP::benchmark() compares
+// the two on the running board. It is opt-in because the routine wraps on
+// overflow where the portable loop saturates, so it is only safe for
+// coefficients with headroom.
+
+typedef int16_t q15_t;
+
+// Second-order IIR section, direct form I. Coefficients are Q28 with a0
+// normalised to 1, so low cutoffs keep their accuracy; designed from
+// floats at setup time.
+struct DspBiquad {
+  int32_t b0, b1, b2, a1, a2;
+  q15_t x1, x2, y1, y2;
+  int32_t err; // Rounding residue fed back, removes the DC dead band
+
+  static DspBiquad lowpass(float cutoffHz, float sampleHz, float q = 0.7071f);
+  static DspBiquad highpass(float cutoffHz, float sampleHz,
+                            float q = 0.7071f);
+
+  void process(const q15_t *in, q15_t *out, size_t n);
+  void reset() { x1 = x2 = y1 = y2 = err = 0; }
+};
+
+// FIR filter with optional decimation: only every decimation-th output is
+// computed, so a decimating low-pass costs 1/decimation of the full filter.
+class DspFir {
+public:
+  static const uint8_t MAX_TAPS = 64;
+
+  // coeffs are Q15; returns false if taps is 0 or above MAX_TAPS
+  bool begin(const q15_t *coeffs, uint8_t taps, uint8_t decimation = 1);
+  void reset();
+
+  // Returns the number of samples written to out (at most n / decimation,
+  // rounded up)
+  size_t process(const q15_t *in, q15_t *out, size_t n);
+
+  // Always the portable loop, for comparison with process()
+  size_t processReference(const q15_t *in, q15_t *out, size_t n);
+
+private:
+  q15_t coeffs[MAX_TAPS] = {};
+  // Every sample is stored twice, taps apart, so the newest taps samples
+  // are always contiguous and the inner loop is one dot product
+  q15_t delay[2 * MAX_TAPS] = {};
+  uint8_t taps = 0;
+  uint8_t pos = 0;
+  uint8_t decimation = 1;
+  uint8_t phase = 0;
+
+  void push(q15_t x);
+};
+
+// Peak follower with separate attack and release time constants
+struct DspEnvelope {
+  uint16_t attack;  // Q15 smoothing factors
+  uint16_t release;
+  int32_t level;    // Q15
+
+  static DspEnvelope fromTimes(float attackMs, float releaseMs,
+                               float sampleHz);
+
+  // Returns the level after the block
+  q15_t process(const q15_t *in, size_t n);
+};
+
+// On/off detection with hysteresis, e.g. on an RMS or envelope level
+struct DspThreshold {
+  q15_t on;
+  q15_t off;
+  bool active;
+
+  // Returns true when the state changed
+  bool update(q15_t level);
+};
+
+q15_t dspRms(const q15_t *in, size_t n);
+q15_t dspPeak(const q15_t *in, size_t n);
+
+class HSC_DSP {
+public:
+  // Time each kernel over one block and print cycles per block, portable
+  // against esp-dsp where both exist, and the share of the block period
+  // used at sampleHz
+  static void benchmark(Print &out, uint32_t sampleHz = 10000,
+                        size_t blockSize = 256);
+};
+
+#endif
@@ -0,0 +1,367 @@
+#include "HSC_Expanders.h"
+
+// MCP23017 registers, IOCON.BANK = 0 (A/B pairs at adjacent addresses)
+static const uint8_t MCP_IODIR = 0x00;
+static const uint8_t MCP_GPINTEN = 0x04;
+static const uint8_t MCP_IOCON = 0x0A;
+static const uint8_t MCP_GPPU = 0x0C;
+static const uint8_t MCP_INTF = 0x0E;
+static const uint8_t MCP_GPIO = 0x12;
+static const uint8_t MCP_OLAT = 0x14;
+
+// Mirror INTA/INTB so each chip needs one line, open-drain so chips can
+// share it
+static const uint8_t IOCON_MIRROR = 0x40;
+static const uint8_t IOCON_ODR = 0x04;
+
+// Indexed by Shadow. The output latch and pull-up are written before the
+// direction, so pinMode(OUTPUT) then digitalWrite(HIGH) in one flush never
+// drives the old latch level; interrupts are enabled once pins are inputs.
+static const uint8_t SHADOW_REG[] = {MCP_OLAT, MCP_GPPU, MCP_IODIR,
+                                     MCP_GPINTEN};
+
+// --- Buses ---
+
+bool HSC_WireBus::write(uint8_t addr, uint8_t reg, const uint8_t *data,
+                        uint8_t len) {
+  wire.beginTransmission(addr);
+  wire.write(reg);
+  wire.write(data, len);
+  return wire.endTransmission() == 0;
+}
+
+bool HSC_WireBus::read(uint8_t addr, uint8_t reg, uint8_t *data,
+                       uint8_t len) {
+  wire.beginTransmission(addr);
+  wire.write(reg);
+  if (wire.endTransmission(false) != 0) {
+    return false;
+  }
+  if (wire.requestFrom(addr, len) != len) {
+    return false;
+  }
+  for (uint8_t i = 0; i < len; i++) {
+    data[i] = wire.read();
+  }
+  return true;
+}
+
+HSC_SimExpanderBus::HSC_SimExpanderBus() {
+  memset(regs, 0, sizeof(regs));
+  for (uint8_t i = 0; i < MAX_CHIPS; i++) {
+    regs[i][MCP_IODIR] = 0xFF;
+    regs[i][MCP_IODIR + 1] = 0xFF;
+  }
+}
+
+bool HSC_SimExpanderBus::write(uint8_t addr, uint8_t reg, const uint8_t *data,
+                               uint8_t len) {
+  uint8_t chip = addr - 0x20;
+  if (chip >= MAX_CHIPS || reg + len > sizeof(regs[0])) {
+    return false;
+  }
+  writes++;
+  memcpy(&regs[chip][reg], data, len);
+  // Outputs follow OLAT; inputs keep their simulated level
+  for (uint8_t port = 0; port < 2; port++) {
+    uint8_t dir = regs[chip][MCP_IODIR + port];
+    uint8_t &gpio = regs[chip][MCP_GPIO + port];
+    gpio = (gpio & dir) | (regs[chip][MCP_OLAT + port] & ~dir);
+  }
+  return true;
+}
+
+bool HSC_SimExpanderBus::read(uint8_t addr, uint8_t reg, uint8_t *data,
+                              uint8_t len) {
+  uint8_t chip = addr - 0x20;
+  if (chip >= MAX_CHIPS || reg + len > sizeof(regs[0])) {
+    return false;
+  }
+  reads++;
+  memcpy(data, &regs[chip][reg], len);
+  // Reading GPIO clears the interrupt
+  if (reg <= MCP_GPIO + 1 && reg + len > MCP_GPIO) {
+    regs[chip][MCP_INTF] = 0;
+    regs[chip][MCP_INTF + 1] = 0;
+  }
+  return true;
+}
+
+void HSC_SimExpanderBus::setInput(uint8_t addr, uint8_t pin, bool level) {
+  uint8_t chip = addr - 0x20;
+  if (chip >= MAX_CHIPS || pin > 15) {
+    return;
+  }
+  uint8_t port = pin / 8;
+  uint8_t mask = 1 << (pin % 8);
+  if (!(regs[chip][MCP_IODIR + port] & mask)) {
+    return; // Output pin
+  }
+  uint8_t &gpio = regs[chip][MCP_GPIO + port];
+  bool old = gpio & mask;
+  gpio = level ? (gpio | mask) : (gpio & ~mask);
+  if (old != level && (regs[chip][MCP_GPINTEN + port] & mask)) {
+    regs[chip][MCP_INTF + port] |= mask;
+  }
+}
+
+uint8_t HSC_SimExpanderBus::reg(uint8_t addr, uint8_t reg) const {
+  uint8_t chip = addr - 0x20;
+  return chip < MAX_CHIPS && reg < sizeof(regs[0]) ? regs[chip][reg] : 0;
+}
+
+// --- Manager ---
+
+HSC_Expanders::HSC_Expanders(HSC_Base &base, HSC_ExpanderBus *bus)
+    : base(base), bus(bus), wireBus(Wire) {
+  if (this->bus == nullptr) {
+    this->bus = &wireBus;
+  }
+  memset(expanders, 0, sizeof(expanders));
+  memset(lines, 0, sizeof(lines));
+}
+
+int HSC_Expanders::add(uint8_t address, int intPin) {
+  if (started || expanderCount >= MAX_EXPANDERS || address < 0x20 ||
+      address > 0x27) {
+    return -1;
+  }
+  Expander &e = expanders[expanderCount];
+  e.address = address;
+  e.intPin = intPin;
+  // Power-on state: all inputs, no pull-ups, no interrupts
+  e.shadow[SH_IODIR][0] = 0xFF;
+  e.shadow[SH_IODIR][1] = 0xFF;
+
+  if (intPin >= 0) {
+    bool known = false;
+    for (uint8_t i = 0; i < lineCount; i++) {
+      known |= lines[i].pin == intPin;
+    }
+    if (!known) {
+      lines[lineCount].owner = this;
+      lines[lineCount].pin = intPin;
+      lineCount++;
+    }
+  }
+  return EXPANDER_PIN_BASE + 16 * expanderCount++;
+}
+
+bool HSC_Expanders::begin(uint32_t clockHz) {
+  if (bus == &wireBus) {
+    Wire.begin();
+    Wire.setClock(clockHz);
+  }
+
+  bool ok = true;
+  for (uint8_t i = 0; i < expanderCount; i++) {
+    Expander &e = expanders[i];
+    uint8_t iocon = IOCON_MIRROR | IOCON_ODR;
+    if (!bus->write(e.address, MCP_IOCON, &iocon, 1)) {
+      HSC_LOG("Expander 0x%02X not responding", e.address);
+      stats.busErrors++;
+      ok = false;
+      continue;
+    }
+    e.online = true;
+    // Bring the chip in line with the shadow image (pinMode() may already
+    // have been called) and take the initial input snapshot
+    for (uint8_t r = 0; r < SH_COUNT; r++) {
+      e.dirty[r] = 0x03;
+    }
+  }
+  started = true;
+  flush();
+  for (uint8_t i = 0; i < expanderCount; i++) {
+    readInputs(expanders[i]);
+  }
+
+  // INT lines are open-drain, active low. GPIO 34-39 have no internal
+  // pull-up and need an external resistor.
+  for (uint8_t i = 0; i < lineCount; i++) {
+    ::pinMode(lines[i].pin, INPUT_PULLUP);
+    attachInterruptArg(lines[i].pin, onInterrupt, &lines[i], FALLING);
+  }
+
+  HSC_LOG("Expanders: %u chips, %u INT lines", expanderCount, lineCount);
+  return ok;
+}
+
+void IRAM_ATTR HSC_Expanders::onInterrupt(void *arg) {
+  IntLine *line = static_cast<IntLine *>(arg);
+  HSC_Expanders *self = line->owner;
+  portENTER_CRITICAL_ISR(&self->mux);
+  self->pendingLines |= 1UL << (line - self->lines);
+  portEXIT_CRITICAL_ISR(&self->mux);
+}
+
+void HSC_Expanders::notifyInterrupt(int intPin) {
+  for (uint8_t i = 0; i < lineCount; i++) {
+    if (lines[i].pin == intPin) {
+      portENTER_CRITICAL(&mux);
+      pendingLines |= 1UL << i;
+      portEXIT_CRITICAL(&mux);
+    }
+  }
+}
+
+void HSC_Expanders::loop() {
+  if (!started) {
+    return;
+  }
+  flush();
+
+  portENTER_CRITICAL(&mux);
+  uint32_t pending = pendingLines;
+  pendingLines = 0;
+  portEXIT_CRITICAL(&mux);
+
+  for (uint8_t i = 0; i < lineCount; i++) {
+    // A line still held low means a change arrived while we were reading;
+    // the chip keeps INT asserted until GPIO is read again
+    if (!(pending & (1UL << i)) && ::digitalRead(lines[i].pin) != LOW) {
+      continue;
+    }
+    stats.interrupts++;
+    for (uint8_t j = 0; j < expanderCount; j++) {
+      if (expanders[j].intPin == lines[i].pin) {
+        readInputs(expanders[j]);
+      }
+    }
+  }
+
+  if (millis() - lastPoll >= pollMs) {
+    lastPoll = millis();
+    for (uint8_t j = 0; j < expanderCount; j++) {
+      if (expanders[j].intPin < 0) {
+        readInputs(expanders[j]);
+      }
+    }
+  }
+}
+
+void HSC_Expanders::readInputs(Expander &e) {
+  uint8_t gpio[2];
+  if (!e.online) {
+    return;
+  }
+  if (!bus->read(e.address, MCP_GPIO, gpio, 2)) {
+    stats.busErrors++;
+    return;
+  }
+  stats.reads++;
+  uint16_t now = gpio[0] | (gpio[1] << 8);
+  uint16_t inputMask = e.shadow[SH_IODIR][0] | (e.shadow[SH_IODIR][1] << 8);
+  uint16_t changed = e.inputsValid ? (now ^ e.inputs) & inputMask : 0;
+  e.inputs = now;
+  e.inputsValid = true;
+
+  if (changed == 0) {
+    return;
+  }
+  int basePin = EXPANDER_PIN_BASE + 16 * (&e - expanders);
+  for (uint8_t bit = 0; bit < 16; bit++) {
+    if (changed & (1 << bit)) {
+      stats.changes++;
+      if (changeHandler) {
+        changeHandler(basePin + bit, (now >> bit) & 1);
+      }
+    }
+  }
+}
+
+void HSC_Expanders::flush() {
+  if (!started) {
+    return;
+  }
+  for (uint8_t i = 0; i < expanderCount; i++) {
+    Expander &e = expanders[i];
+    for (uint8_t r = 0; r < SH_COUNT; r++) {
+      uint8_t d = e.dirty[r];
+      if (d == 0 || !e.online) {
+        continue;
+      }
+      // Both ports in one sequential write, or just the one that changed
+      uint8_t port = d == 0x02 ? 1 : 0;
+      uint8_t len = d == 0x03 ? 2 : 1;
+      if (bus->write(e.address, SHADOW_REG[r] + port, &e.shadow[r][port],
+                     len)) {
+        e.dirty[r] = 0;
+        stats.writes++;
+      } else {
+        stats.busErrors++;
+      }
+    }
+  }
+}
+
+HSC_Expanders::Expander *HSC_Expanders::lookup(int pin, uint8_t &bit) {
+  int index = (pin - EXPANDER_PIN_BASE) / 16;
+  if (pin < EXPANDER_PIN_BASE || index >= expanderCount) {
+    return nullptr;
+  }
+  bit = (pin - EXPANDER_PIN_BASE) % 16;
+  return &expanders[index];
+}
+
+const HSC_Expanders::Expander *HSC_Expanders::lookup(int pin,
+                                                     uint8_t &bit) const {
+  return const_cast<HSC_Expanders *>(this)->lookup(pin, bit);
+}
+
+void HSC_Expanders::setShadow(Expander &e, Shadow reg, uint8_t bit,
+                              bool value) {
+  uint8_t port = bit / 8;
+  uint8_t mask = 1 << (bit % 8);
+  uint8_t old = e.shadow[reg][port];
+  uint8_t updated = value ? (old | mask) : (old & ~mask);
+  if (updated != old) {
+    e.shadow[reg][port] = updated;
+    e.dirty[reg] |= 1 << port;
+  }
+}
+
+void HSC_Expanders::pinMode(int pin, uint8_t mode) {
+  if (pin < EXPANDER_PIN_BASE) {
+    ::pinMode(pin, mode);
+    return;
+  }
+  uint8_t bit;
+  Expander *e = lookup(pin, bit);
+  if (e == nullptr) {
+    return;
+  }
+  bool input = mode != OUTPUT;
+  setShadow(*e, SH_IODIR, bit, input);
+  setShadow(*e, SH_GPPU, bit, mode == INPUT_PULLUP);
+  setShadow(*e, SH_GPINTEN, bit, input && e->intPin >= 0);
+}
+
+int HSC_Expanders::digitalRead(int pin) const {
+  if (pin < EXPANDER_PIN_BASE) {
+    return ::digitalRead(pin);
+  }
+  uint8_t bit;
+  const Expander *e = lookup(pin, bit);
+  if (e == nullptr) {
+    return LOW;
+  }
+  // Served from the cache; the bus is only touched when INT fires
+  bool output = !(e->shadow[SH_IODIR][bit / 8] & (1 << (bit % 8)));
+  if (output) {
+    return (e->shadow[SH_OLAT][bit / 8] >> (bit % 8)) & 1;
+  }
+  return (e->inputs >> bit) & 1;
+}
+
+void HSC_Expanders::digitalWrite(int pin, uint8_t level) {
+  if (pin < EXPANDER_PIN_BASE) {
+    ::digitalWrite(pin, level);
+    return;
+  }
+  uint8_t bit;
+  Expander *e = lookup(pin, bit);
+  if (e != nullptr) {
+    setShadow(*e, SH_OLAT, bit, level != LOW);
+  }
+}
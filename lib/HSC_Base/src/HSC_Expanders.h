@@ -0,0 +1,147 @@
+#ifndef HSC_EXPANDERS_H
+#define HSC_EXPANDERS_H
+
+#include "HSC_Base.h"
+#include <Wire.h>
+
+// Register access used by the expander manager, so the I2C driver can be
+// swapped for a simulated bus
+class HSC_ExpanderBus {
+public:
+  virtual ~HSC_ExpanderBus() {}
+  virtual bool write(uint8_t addr, uint8_t reg, const uint8_t *data,
+                     uint8_t len) = 0;
+  virtual bool read(uint8_t addr, uint8_t reg, uint8_t *data,
+                    uint8_t len) = 0;
+};
+
+class HSC_WireBus : public HSC_ExpanderBus {
+public:
+  explicit HSC_WireBus(TwoWire &wire) : wire(wire) {}
+  bool write(uint8_t addr, uint8_t reg, const uint8_t *data,
+             uint8_t len) override;
+  bool read(uint8_t addr, uint8_t reg, uint8_t *data, uint8_t len) override;
+
+private:
+  TwoWire &wire;
+};
+
+// In-memory MCP23017s for running without hardware. setInput() changes an
+// input pin; call HSC_Expanders::notifyInterrupt() afterwards, as the INT
+// line would.
+class HSC_SimExpanderBus : public HSC_ExpanderBus {
+public:
+  static const uint8_t MAX_CHIPS = 8; // Addresses 0x20-0x27
+
+  HSC_SimExpanderBus();
+  bool write(uint8_t addr, uint8_t reg, const uint8_t *data,
+             uint8_t len) override;
+  bool read(uint8_t addr, uint8_t reg, uint8_t *data, uint8_t len) override;
+
+  void setInput(uint8_t addr, uint8_t pin, bool level);
+  uint8_t reg(uint8_t addr, uint8_t reg) const;
+
+  uint32_t reads = 0;
+  uint32_t writes = 0;
+
+private:
+  uint8_t regs[MAX_CHIPS][0x16];
+};
+
+struct ExpanderStats {
+  uint32_t interrupts;
+  uint32_t reads;      // Batched GPIO reads
+  uint32_t writes;     // Register writes (one per changed run of bytes)
+  uint32_t busErrors;
+  uint32_t changes;    // Input pin changes reported
+};
+
+// MCP23017 manager. Expander pins are numbered from EXPANDER_PIN_BASE
+// (16 per chip, in the order added) and share one pinMode() /
+// digitalRead() / digitalWrite() API with native GPIO, which is passed
+// through unchanged.
+//
+// Inputs are only read when a chip's INT line fires, in a single two-byte
+// transaction that also clears the interrupt. Writes go to a shadow
+// register image and loop() sends only the bytes that changed, so an idle
+// bus carries no traffic. Several chips may share one INT line (outputs
+// are configured open-drain and mirrored).
+class HSC_Expanders {
+public:
+  static const int EXPANDER_PIN_BASE = 100;
+  static const uint8_t MAX_EXPANDERS = 8;
+
+  typedef std::function<void(int pin, bool level)> ChangeHandler;
+
+  // bus defaults to the Wire driver
+  explicit HSC_Expanders(HSC_Base &base, HSC_ExpanderBus *bus = nullptr);
+
+  // Add a chip at 0x20-0x27 before begin(). intPin is the native GPIO its
+  // INT output is wired to, or -1 to poll it every pollMs instead.
+  // Returns the first pin number of the chip, or -1.
+  int add(uint8_t address, int intPin = -1);
+
+  bool begin(uint32_t clockHz = 400000);
+  void loop();
+
+  void pinMode(int pin, uint8_t mode);
+  int digitalRead(int pin) const;
+  void digitalWrite(int pin, uint8_t level);
+
+  void onChange(ChangeHandler handler) { changeHandler = handler; }
+
+  // Mark an INT line as fired; called from the GPIO interrupt, or by hand
+  // with a simulated bus
+  void notifyInterrupt(int intPin);
+
+  // Send pending shadow register changes now instead of at the next loop()
+  void flush();
+
+  void setPollInterval(uint16_t ms) { pollMs = ms; }
+  const ExpanderStats &getStats() const { return stats; }
+
+private:
+  // Shadowed registers, as A/B pairs in the order flush() writes them
+  enum Shadow : uint8_t { SH_OLAT, SH_GPPU, SH_IODIR, SH_GPINTEN, SH_COUNT };
+
+  struct Expander {
+    uint8_t address;
+    int intPin;
+    uint8_t shadow[SH_COUNT][2];
+    uint8_t dirty[SH_COUNT]; // Bit 0 = port A, bit 1 = port B
+    uint16_t inputs;         // Last read GPIO state
+    bool inputsValid;
+    bool online; // Answered at begin()
+  };
+
+  HSC_Base &base;
+  HSC_ExpanderBus *bus;
+  HSC_WireBus wireBus;
+  Expander expanders[MAX_EXPANDERS];
+  uint8_t expanderCount = 0;
+  bool started = false;
+
+  // Native GPIOs carrying INT lines; bit n of pendingLines = lines[n] fired
+  struct IntLine {
+    HSC_Expanders *owner;
+    int pin;
+  };
+  IntLine lines[MAX_EXPANDERS];
+  uint8_t lineCount = 0;
+  volatile uint32_t pendingLines = 0;
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+  uint16_t pollMs = 50;
+  unsigned long lastPoll = 0;
+
+  ChangeHandler changeHandler;
+  ExpanderStats stats = {};
+
+  Expander *lookup(int pin, uint8_t &bit);
+  const Expander *lookup(int pin, uint8_t &bit) const;
+  void setShadow(Expander &e, Shadow reg, uint8_t bit, bool value);
+  void readInputs(Expander &e);
+
+  static void IRAM_ATTR onInterrupt(void *arg);
+};
+
+#endif
@@ -0,0 +1,269 @@
+#include "HSC_FastClock.h"
+#include <esp_timer.h>
+
+static const char FC_TOPIC[] = "HSC/clock";
+static const char FC_SET_TOPIC[] = "HSC/clock/set";
+
+static const int64_t FC_DAY_MS = 86400000LL;
+static const unsigned long FC_BROADCAST_INTERVAL_MS = 60000;
+
+// Errors up to this many fast milliseconds are slewed out over
+// FC_SLEW_US; anything larger (missed syncs, master reset) is a jump
+static const int64_t FC_STEP_LIMIT_MS = 5000;
+static const int64_t FC_SLEW_US = 5000000;
+
+// Syncs closer together than this are too noisy to estimate drift from
+static const int64_t FC_MIN_DRIFT_INTERVAL_US = 10000000;
+static const int32_t FC_MAX_DRIFT_PPM = 1000;
+
+HSC_FastClock::HSC_FastClock(HSC_Base &base) : base(base) {}
+
+void HSC_FastClock::begin(bool isMaster) {
+  master = isMaster;
+  anchor(0);
+  if (master) {
+    newEpoch();
+  }
+  // The master runs from midnight until it is set or picks up the last
+  // retained broadcast
+  synced = master;
+
+  base.onMqtt(FC_TOPIC, [this](const char *topic, const uint8_t *payload,
+                               unsigned int length) {
+    handleSync(payload, length);
+  });
+  if (master) {
+    base.onMqtt(FC_SET_TOPIC, [this](const char *topic,
+                                     const uint8_t *payload,
+                                     unsigned int length) {
+      handleSet(payload, length);
+    });
+  }
+
+  base.addTemplateVar("FAST_TIME", [this](char *buf, size_t len) {
+    if (!synced) {
+      return snprintf(buf, len, "Not synced");
+    }
+    uint8_t h, m, s;
+    getTime(h, m, s);
+    return snprintf(buf, len, "%02u:%02u:%02u", h, m, s);
+  });
+  base.addTemplateVar("FAST_RATE", [this](char *buf, size_t len) {
+    return snprintf(buf, len, "%g:1", rate);
+  });
+
+  HSC_LOG("Fast clock started as %s", master ? "master" : "follower");
+}
+
+void HSC_FastClock::loop() {
+  if (synced) {
+    int32_t minute = secondsOfDay() / 60;
+    if (minute != lastMinute) {
+      lastMinute = minute;
+      if (minuteHandler) {
+        minuteHandler(minute / 60, minute % 60);
+      }
+    }
+  }
+
+  if (master && (broadcastPending ||
+                 millis() - lastBroadcast >= FC_BROADCAST_INTERVAL_MS)) {
+    broadcast();
+  }
+}
+
+int64_t HSC_FastClock::nowFastMs() {
+  if (!running) {
+    return anchorFastMs;
+  }
+  int64_t elapsedUs = esp_timer_get_time() - anchorLocalUs;
+  double scaled = elapsedUs / 1000.0 * rate * (1.0 + driftPpm / 1e6);
+  int64_t slew = elapsedUs >= FC_SLEW_US ? slewMs
+                                         : slewMs * elapsedUs / FC_SLEW_US;
+  return anchorFastMs + (int64_t)scaled + slew;
+}
+
+void HSC_FastClock::anchor(int64_t fastMs) {
+  anchorLocalUs = esp_timer_get_time();
+  anchorFastMs = fastMs;
+  slewMs = 0;
+}
+
+// Master only: followers accept the next broadcast whatever its time
+void HSC_FastClock::newEpoch() {
+  uint32_t previous = epoch;
+  do {
+    epoch = esp_random();
+  } while (epoch == previous);
+  seq = 0;
+}
+
+uint32_t HSC_FastClock::secondsOfDay() {
+  int64_t ms = nowFastMs() % FC_DAY_MS;
+  if (ms < 0) {
+    ms += FC_DAY_MS;
+  }
+  return ms / 1000;
+}
+
+void HSC_FastClock::getTime(uint8_t &hour, uint8_t &minute, uint8_t &second) {
+  uint32_t s = secondsOfDay();
+  hour = s / 3600;
+  minute = (s / 60) % 60;
+  second = s % 60;
+}
+
+void HSC_FastClock::setTime(uint8_t hour, uint8_t minute, uint8_t second) {
+  if (!master) {
+    return;
+  }
+  anchor(((int64_t)hour * 3600 + minute * 60 + second) * 1000);
+  synced = true;
+  lastMinute = -1;
+  newEpoch();
+  broadcastPending = true;
+}
+
+void HSC_FastClock::setRate(float newRate) {
+  if (!master || newRate <= 0) {
+    return;
+  }
+  anchor(nowFastMs());
+  rate = newRate;
+  newEpoch();
+  broadcastPending = true;
+}
+
+void HSC_FastClock::setRunning(bool run) {
+  if (!master) {
+    return;
+  }
+  anchor(nowFastMs());
+  running = run;
+  newEpoch();
+  broadcastPending = true;
+}
+
+void HSC_FastClock::broadcast() {
+  PubSubClient &mqtt = base.getMqttClient();
+  if (!mqtt.connected()) {
+    return;
+  }
+  uint8_t h, m, s;
+  getTime(h, m, s);
+  char time[12];
+  snprintf(time, sizeof(time), "%02u:%02u:%02u", h, m, s);
+
+  StaticJsonDocument<160> doc;
+  doc["time"] = time;
+  doc["ms"] = (uint32_t)(((nowFastMs() % FC_DAY_MS) + FC_DAY_MS) % FC_DAY_MS);
+  doc["rate"] = rate;
+  doc["running"] = running;
+  doc["epoch"] = epoch;
+  doc["seq"] = ++seq;
+  char buf[160];
+  serializeJson(doc, buf);
+  mqtt.publish(FC_TOPIC, buf, true);
+  lastBroadcast = millis();
+  broadcastPending = false;
+}
+
+void HSC_FastClock::handleSync(const uint8_t *payload, unsigned int length) {
+  // The master only listens to pick up its retained state after a reboot
+  if (master && lastBroadcast != 0) {
+    return;
+  }
+  StaticJsonDocument<160> doc;
+  if (deserializeJson(doc, payload, length) || !doc["ms"].is<uint32_t>()) {
+    return;
+  }
+  int64_t masterMs = doc["ms"].as<uint32_t>();
+  float newRate = doc["rate"] | 1.0f;
+  bool newRunning = doc["running"] | true;
+  int64_t localUs = esp_timer_get_time();
+
+  // A restarting master keeps its new epoch, so followers take the time
+  // it restored as a set
+  bool reset = false;
+  if (!master && doc["epoch"].is<uint32_t>()) {
+    uint32_t syncEpoch = doc["epoch"];
+    uint32_t syncSeq = doc["seq"] | 0;
+    if (synced && syncEpoch == epoch && syncSeq <= seq) {
+      // Retained copy redelivered on reconnect, behind our estimate
+      return;
+    }
+    reset = syncEpoch != epoch;
+    epoch = syncEpoch;
+    seq = syncSeq;
+  }
+
+  if (!synced || master || reset || newRate != rate ||
+      newRunning != running || !newRunning) {
+    rate = newRate;
+    running = newRunning;
+    anchor(masterMs);
+    synced = true;
+    lastSyncLocalUs = localUs;
+    if (master) {
+      broadcastPending = true;
+    }
+    return;
+  }
+
+  // Compare against our estimate, taking the shorter way round midnight
+  int64_t estimate = nowFastMs();
+  int64_t error = (masterMs - estimate) % FC_DAY_MS;
+  if (error < -FC_DAY_MS / 2) {
+    error += FC_DAY_MS;
+  } else if (error >= FC_DAY_MS / 2) {
+    error -= FC_DAY_MS;
+  }
+
+  if (error > FC_STEP_LIMIT_MS || error < -FC_STEP_LIMIT_MS) {
+    anchor(estimate + error);
+    HSC_LOG("Fast clock stepped by %ld ms", (long)error);
+  } else {
+    // The previous correction has been fully slewed in by now, so what
+    // remains is frequency error accumulated since the last sync
+    int64_t intervalUs = localUs - lastSyncLocalUs;
+    if (intervalUs >= FC_MIN_DRIFT_INTERVAL_US && running) {
+      int32_t ppm = (int32_t)(error * 1e9 / (intervalUs * (double)rate));
+      driftPpm += ppm / 2;
+      if (driftPpm > FC_MAX_DRIFT_PPM) {
+        driftPpm = FC_MAX_DRIFT_PPM;
+      } else if (driftPpm < -FC_MAX_DRIFT_PPM) {
+        driftPpm = -FC_MAX_DRIFT_PPM;
+      }
+    }
+    anchor(estimate);
+    slewMs = error;
+  }
+  lastSyncLocalUs = localUs;
+}
+
+void HSC_FastClock::handleSet(const uint8_t *payload, unsigned int length) {
+  StaticJsonDocument<128> doc;
+  if (deserializeJson(doc, payload, length)) {
+    return;
+  }
+  if (doc["rate"].is<float>()) {
+    setRate(doc["rate"].as<float>());
+  }
+  if (doc["running"].is<bool>()) {
+    setRunning(doc["running"].as<bool>());
+  }
+  int64_t ms;
+  if (doc["time"].is<const char *>() && parseTime(doc["time"], ms)) {
+    setTime(ms / 3600000, (ms / 60000) % 60, (ms / 1000) % 60);
+  }
+}
+
+bool HSC_FastClock::parseTime(const char *text, int64_t &fastMs) {
+  unsigned h = 0, m = 0, s = 0;
+  if (sscanf(text, "%u:%u:%u", &h, &m, &s) < 2 || h > 23 || m > 59 ||
+      s > 59) {
+    return false;
+  }
+  fastMs = ((int64_t)h * 3600 + m * 60 + s) * 1000;
+  return true;
+}
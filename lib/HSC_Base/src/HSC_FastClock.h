@@ -0,0 +1,80 @@
+#ifndef HSC_FASTCLOCK_H
+#define HSC_FASTCLOCK_H
+
+#include "HSC_Base.h"
+
+// Layout fast clock. One board runs as master and broadcasts the clock as
+// retained JSON on HSC/clock once a minute and whenever it is set; every
+// other board follows it and runs the clock locally at the scale rate in
+// between, so displays tick smoothly without polling.
+//
+// Followers estimate their crystal's drift against the master from
+// consecutive syncs and slew small errors out over a few seconds instead
+// of jumping, so the displayed time never runs backwards.
+//
+// Each broadcast carries an epoch, new at every master boot and every set,
+// and a sequence number within it. A follower ignores a sync that is not
+// newer than the last one it took, such as the retained copy redelivered
+// on every reconnect; only a new epoch may move the clock backwards.
+//
+// Template variables: %FAST_TIME% (HH:MM:SS) and %FAST_RATE% (e.g. 4:1).
+class HSC_FastClock {
+public:
+  typedef std::function<void(uint8_t hour, uint8_t minute)> MinuteHandler;
+
+  explicit HSC_FastClock(HSC_Base &base);
+
+  // master: broadcast this board's clock and accept HSC/clock/set
+  void begin(bool master = false);
+  void loop();
+
+  // Master only; followers take these from the broadcast
+  void setTime(uint8_t hour, uint8_t minute, uint8_t second = 0);
+  void setRate(float rate);
+  void setRunning(bool running);
+
+  bool isSynced() const { return synced; }
+  bool isRunning() const { return running; }
+  float getRate() const { return rate; }
+  int32_t getDriftPpm() const { return driftPpm; }
+
+  // Fast time of day
+  uint32_t secondsOfDay();
+  void getTime(uint8_t &hour, uint8_t &minute, uint8_t &second);
+
+  // Called from loop() each time the fast minute changes
+  void onMinute(MinuteHandler handler) { minuteHandler = handler; }
+
+private:
+  HSC_Base &base;
+  bool master = false;
+  bool synced = false;
+  bool running = true;
+  float rate = 1.0f;
+
+  // Fast time is anchorFastMs plus scaled local time since anchorLocalUs
+  int64_t anchorLocalUs = 0;
+  int64_t anchorFastMs = 0;
+  int32_t driftPpm = 0;   // Local clock error relative to the master
+  int32_t slewMs = 0;     // Correction being phased in after a sync
+  int64_t lastSyncLocalUs = 0;
+
+  // Broadcast identity: sent by the master, last taken by a follower
+  uint32_t epoch = 0;
+  uint32_t seq = 0;
+
+  int32_t lastMinute = -1;
+  unsigned long lastBroadcast = 0;
+  bool broadcastPending = false;
+  MinuteHandler minuteHandler;
+
+  int64_t nowFastMs();
+  void anchor(int64_t fastMs);
+  void newEpoch();
+  void handleSync(const uint8_t *payload, unsigned int length);
+  void handleSet(const uint8_t *payload, unsigned int length);
+  void broadcast();
+  static bool parseTime(const char *text, int64_t &fastMs);
+};
+
+#endif
@@ -0,0 +1,207 @@
+#include "HSC_LedStrip.h"
+
+// WS2812 bit timing at 40 MHz RMT clock (25 ns per tick)
+static const uint8_t LED_RMT_CLK_DIV = 2;
+static const uint32_t T0H_TICKS = 14; // 350 ns
+static const uint32_t T0L_TICKS = 36; // 900 ns
+static const uint32_t T1H_TICKS = 36;
+static const uint32_t T1L_TICKS = 14;
+
+// rmt_item32_t values: duration0 | level0 << 15 | duration1 << 16
+static const uint32_t ITEM_BIT0 = T0H_TICKS | (1UL << 15) | (T0L_TICKS << 16);
+static const uint32_t ITEM_BIT1 = T1H_TICKS | (1UL << 15) | (T1L_TICKS << 16);
+
+// 1.25 us per bit, and newer WS2812B parts need 280 us low to latch
+static const uint32_t LED_US_PER_PIXEL = 30;
+static const uint32_t LED_LATCH_US = 300;
+
+static const unsigned long LED_FRAME_INTERVAL_MS = 20;
+
+HSC_LedStrip::HSC_LedStrip(HSC_Base &base, uint16_t count, int pin,
+                           rmt_channel_t channel)
+    : base(base), ledCount(count),
+      pin(pin < 0 ? HSC_Board::PIN_LED_STRIP : pin), channel(channel) {}
+
+bool HSC_LedStrip::begin() {
+  back = new LedColor[ledCount];
+  front = new uint8_t[ledCount * 3];
+  effects = new PixelEffect[ledCount];
+  memset(back, 0, ledCount * sizeof(LedColor));
+  memset(effects, 0, ledCount * sizeof(PixelEffect));
+  // Force the first frame to cover the whole strip
+  memset(front, 0xFF, ledCount * 3);
+
+  rmt_config_t cfg = RMT_DEFAULT_CONFIG_TX((gpio_num_t)pin, channel);
+  cfg.clk_div = LED_RMT_CLK_DIV;
+  // Two blocks give the refill interrupt more slack under WiFi load
+  cfg.mem_block_num = 2;
+
+  if (rmt_config(&cfg) != ESP_OK ||
+      rmt_driver_install(channel, 0, 0) != ESP_OK ||
+      rmt_translator_init(channel, translate) != ESP_OK) {
+    HSC_LOG("LED strip: RMT setup failed");
+    return false;
+  }
+
+  started = true;
+  HSC_LOG("LED strip: %u pixels on GPIO %d (RMT channel %d)", ledCount, pin,
+          (int)channel);
+  return true;
+}
+
+void HSC_LedStrip::loop() {
+  if (!started) {
+    return;
+  }
+  unsigned long now = millis();
+  if (now - lastFrame < LED_FRAME_INTERVAL_MS) {
+    return;
+  }
+  lastFrame = now;
+  runEffects(now);
+  show();
+}
+
+void HSC_LedStrip::setPixel(uint16_t index, LedColor color) {
+  if (index >= ledCount || back == nullptr) {
+    return;
+  }
+  effects[index].type = EFFECT_NONE;
+  back[index] = color;
+}
+
+void HSC_LedStrip::fill(LedColor color) {
+  for (uint16_t i = 0; i < ledCount; i++) {
+    setPixel(i, color);
+  }
+}
+
+LedColor HSC_LedStrip::getPixel(uint16_t index) const {
+  LedColor off = {0, 0, 0};
+  return index < ledCount && back != nullptr ? back[index] : off;
+}
+
+void HSC_LedStrip::fadeTo(uint16_t index, LedColor color,
+                          uint16_t durationMs) {
+  if (index >= ledCount || back == nullptr) {
+    return;
+  }
+  if (durationMs == 0) {
+    setPixel(index, color);
+    return;
+  }
+  PixelEffect &e = effects[index];
+  e.type = EFFECT_FADE;
+  e.from = back[index];
+  e.to = color;
+  e.startMs = millis();
+  e.periodMs = durationMs;
+  activeEffects++;
+}
+
+void HSC_LedStrip::flash(uint16_t index, LedColor color, uint16_t periodMs,
+                         uint8_t dutyPercent) {
+  if (index >= ledCount || back == nullptr || periodMs == 0) {
+    return;
+  }
+  PixelEffect &e = effects[index];
+  e.type = EFFECT_FLASH;
+  e.to = color;
+  e.startMs = millis();
+  e.periodMs = periodMs;
+  e.onMs = (uint32_t)periodMs * (dutyPercent > 100 ? 100 : dutyPercent) / 100;
+  activeEffects++;
+}
+
+void HSC_LedStrip::setBrightness(uint8_t value) { brightness = value; }
+
+uint8_t HSC_LedStrip::lerp8(uint8_t a, uint8_t b, uint16_t t) {
+  return a + (((int32_t)b - (int32_t)a) * t >> 16);
+}
+
+void HSC_LedStrip::runEffects(uint32_t now) {
+  if (activeEffects == 0) {
+    return;
+  }
+  uint16_t running = 0;
+  for (uint16_t i = 0; i < ledCount; i++) {
+    PixelEffect &e = effects[i];
+    uint32_t elapsed = now - e.startMs;
+    if (e.type == EFFECT_FADE) {
+      if (elapsed >= e.periodMs) {
+        back[i] = e.to;
+        e.type = EFFECT_NONE;
+        continue;
+      }
+      uint16_t t = (elapsed << 16) / e.periodMs;
+      back[i].r = lerp8(e.from.r, e.to.r, t);
+      back[i].g = lerp8(e.from.g, e.to.g, t);
+      back[i].b = lerp8(e.from.b, e.to.b, t);
+      running++;
+    } else if (e.type == EFFECT_FLASH) {
+      LedColor off = {0, 0, 0};
+      back[i] = elapsed % e.periodMs < e.onMs ? e.to : off;
+      running++;
+    }
+  }
+  activeEffects = running;
+}
+
+bool HSC_LedStrip::show() {
+  if (!started) {
+    return false;
+  }
+  // front is read by the RMT interrupt until the frame and latch are done
+  if (micros() - txStartMicros < txDurationMicros ||
+      rmt_wait_tx_done(channel, 0) != ESP_OK) {
+    stats.framesDeferred++;
+    return false;
+  }
+
+  // Copy the scaled back buffer into front, noting the last pixel that
+  // differs from what the strip is already showing
+  int32_t lastDirty = -1;
+  uint16_t scale = (uint16_t)brightness + 1;
+  for (uint16_t i = 0; i < ledCount; i++) {
+    uint8_t *p = &front[i * 3];
+    uint8_t g = (back[i].g * scale) >> 8;
+    uint8_t r = (back[i].r * scale) >> 8;
+    uint8_t b = (back[i].b * scale) >> 8;
+    if (p[0] != g || p[1] != r || p[2] != b) {
+      p[0] = g;
+      p[1] = r;
+      p[2] = b;
+      lastDirty = i;
+    }
+  }
+  if (lastDirty < 0) {
+    stats.framesSkipped++;
+    return false;
+  }
+
+  uint16_t pixels = lastDirty + 1;
+  txStartMicros = micros();
+  txDurationMicros = pixels * LED_US_PER_PIXEL + LED_LATCH_US;
+  rmt_write_sample(channel, front, pixels * 3, false);
+  stats.framesSent++;
+  stats.pixelsSent += pixels;
+  return true;
+}
+
+void IRAM_ATTR HSC_LedStrip::translate(const void *src, rmt_item32_t *dest,
+                                       size_t srcSize, size_t wantedNum,
+                                       size_t *translatedSize,
+                                       size_t *itemNum) {
+  const uint8_t *in = static_cast<const uint8_t *>(src);
+  size_t size = 0;
+  size_t num = 0;
+  while (size < srcSize && num + 8 <= wantedNum) {
+    uint8_t byte = in[size++];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      dest[num++].val = (byte & 0x80) ? ITEM_BIT1 : ITEM_BIT0;
+      byte <<= 1;
+    }
+  }
+  *translatedSize = size;
+  *itemNum = num;
+}
@@ -0,0 +1,100 @@
+#ifndef HSC_LEDSTRIP_H
+#define HSC_LEDSTRIP_H
+
+#include "HSC_Base.h"
+#include <driver/rmt.h>
+
+struct LedColor {
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+
+  bool operator==(const LedColor &o) const {
+    return r == o.r && g == o.g && b == o.b;
+  }
+  bool operator!=(const LedColor &o) const { return !(*this == o); }
+};
+
+struct LedStripStats {
+  uint32_t framesSent;
+  uint32_t framesSkipped; // Nothing changed since the last frame
+  uint32_t framesDeferred; // Previous frame still transmitting
+  uint32_t pixelsSent;
+};
+
+// WS2812 driver for panel and signal LEDs. The RMT peripheral generates the
+// bit timing from a translator running in its interrupt, so interrupts are
+// never disabled and WiFi keeps running during a transmit.
+//
+// Pixels are written to a back buffer; each frame is compared against the
+// last transmitted one and only sent if something changed, and then only
+// up to the last changed pixel (WS2812s keep their colour when fewer
+// pixels are shifted in). Fades and flashes run in Q8/Q16 fixed point.
+class HSC_LedStrip {
+public:
+  // Pin defaults (-1) to PIN_LED_STRIP from HSC_Board.h. The channel uses two
+  // RMT memory blocks, so channel + 1 must be free as well.
+  HSC_LedStrip(HSC_Base &base, uint16_t count, int pin = -1,
+               rmt_channel_t channel = RMT_CHANNEL_0);
+
+  bool begin();
+  void loop();
+
+  uint16_t count() const { return ledCount; }
+
+  // Set a pixel, cancelling any effect running on it
+  void setPixel(uint16_t index, LedColor color);
+  void fill(LedColor color);
+  LedColor getPixel(uint16_t index) const;
+
+  // Fade from the current colour to color over durationMs
+  void fadeTo(uint16_t index, LedColor color, uint16_t durationMs);
+
+  // Alternate between color and off; dutyPercent is the on share
+  void flash(uint16_t index, LedColor color, uint16_t periodMs,
+             uint8_t dutyPercent = 50);
+
+  void setBrightness(uint8_t brightness);
+
+  // Send the back buffer if it differs from the last frame. Called by
+  // loop() every frame; returns true if a transmit was started.
+  bool show();
+
+  const LedStripStats &getStats() const { return stats; }
+
+private:
+  enum Effect : uint8_t { EFFECT_NONE, EFFECT_FADE, EFFECT_FLASH };
+
+  struct PixelEffect {
+    Effect type;
+    LedColor from;
+    LedColor to;
+    uint32_t startMs;
+    uint16_t periodMs; // Fade duration or flash period
+    uint16_t onMs;     // Flash on time
+  };
+
+  HSC_Base &base;
+  uint16_t ledCount;
+  int pin;
+  rmt_channel_t channel;
+  bool started = false;
+
+  LedColor *back = nullptr;  // Written by the application and effects
+  uint8_t *front = nullptr;  // Last frame sent, GRB, read by the RMT ISR
+  PixelEffect *effects = nullptr;
+  uint16_t activeEffects = 0;
+  uint8_t brightness = 255;
+  unsigned long lastFrame = 0;
+  unsigned long txStartMicros = 0;
+  unsigned long txDurationMicros = 0; // Frame time plus latch gap
+  LedStripStats stats = {};
+
+  void runEffects(uint32_t now);
+  static uint8_t lerp8(uint8_t a, uint8_t b, uint16_t t);
+  static void IRAM_ATTR translate(const void *src, rmt_item32_t *dest,
+                                  size_t srcSize, size_t wantedNum,
+                                  size_t *translatedSize, size_t *itemNum);
+};
+
+#endif
@@ -0,0 +1,588 @@
+#include "HSC_LocoNet.h"
+#include <driver/gpio.h>
+#include <esp_rom_gpio.h>
+#include <hal/uart_ll.h>
+#include <soc/gpio_sig_map.h>
+
+// LocoNet runs at 16457 baud: one bit is ~60.8 us
+static const int LN_BAUD = 16457;
+static const unsigned long LN_BIT_US = 61;
+// Carrier-detect backoff: the line must be idle this long before sending
+static const unsigned long LN_CD_BACKOFF_US = 20 * LN_BIT_US;
+// Extra random delay after a collision, in bit times
+static const uint32_t LN_PRIORITY_BITS = 20;
+// Break length sent to signal a collision, in bit times
+static const uint8_t LN_BREAK_BITS = 15;
+static const uint8_t LN_MAX_RETRIES = 10;
+
+static const size_t LN_RX_BUFFER = 1024;
+static const int LN_EVENT_QUEUE = 16;
+// Above loop(), below the WiFi and lwIP tasks
+static const UBaseType_t LN_RX_TASK_PRIORITY = 12;
+static const unsigned long LN_PUBLISH_INTERVAL_MS = 50;
+
+static const char LN_TOPIC_ROOT[] = "HSC/loconet/";
+
+HSC_LocoNet::HSC_LocoNet(HSC_Base &base, uart_port_t uart, int rxPin,
+                         int txPin)
+    : base(base), uart(uart),
+      rxPin(rxPin < 0 ? HSC_Board::PIN_LOCONET_RX : rxPin),
+      txPin(txPin < 0 ? HSC_Board::PIN_LOCONET_TX : txPin) {
+  memset(sensorState, 0, sizeof(sensorState));
+  memset(sensorKnown, 0, sizeof(sensorKnown));
+  memset(sensorDirty, 0, sizeof(sensorDirty));
+  memset(switchState, 0, sizeof(switchState));
+  memset(switchKnown, 0, sizeof(switchKnown));
+  memset(switchDirty, 0, sizeof(switchDirty));
+  memset(slots, 0, sizeof(slots));
+  memset(slotDirty, 0, sizeof(slotDirty));
+  rxMsg.len = 0;
+}
+
+bool HSC_LocoNet::begin(bool invert) {
+  uart_config_t cfg = {};
+  cfg.baud_rate = LN_BAUD;
+  cfg.data_bits = UART_DATA_8_BITS;
+  cfg.parity = UART_PARITY_DISABLE;
+  cfg.stop_bits = UART_STOP_BITS_1;
+  cfg.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+  cfg.source_clk = UART_SCLK_APB;
+
+  // The driver's RX interrupt fills a ring buffer and wakes rxTaskMain
+  if (uart_driver_install(uart, LN_RX_BUFFER, 0, LN_EVENT_QUEUE, &uartEvents,
+                          0) != ESP_OK ||
+      uart_param_config(uart, &cfg) != ESP_OK ||
+      uart_set_pin(uart, txPin, rxPin, UART_PIN_NO_CHANGE,
+                   UART_PIN_NO_CHANGE) != ESP_OK) {
+    HSC_LOG("LocoNet: UART setup failed");
+    return false;
+  }
+  inverted = invert;
+  if (invert) {
+    uart_set_line_inverse(uart, UART_SIGNAL_RXD_INV | UART_SIGNAL_TXD_INV);
+  }
+  // Deliver bytes after 2 idle symbols instead of waiting for a full FIFO
+  uart_set_rx_timeout(uart, 2);
+  uart_set_rx_full_threshold(uart, 1);
+
+  esp_timer_create_args_t timerArgs = {};
+  timerArgs.callback = onBreakEnd;
+  timerArgs.arg = this;
+  timerArgs.name = "ln_break";
+  rxBytes = xQueueCreate(LN_RX_BUFFER, 1);
+  if (rxBytes == nullptr ||
+      esp_timer_create(&timerArgs, &breakTimer) != ESP_OK ||
+      xTaskCreatePinnedToCore(rxTaskMain, "loconet_rx", 3072, this,
+                              LN_RX_TASK_PRIORITY, &rxTask, 1) != pdPASS) {
+    HSC_LOG("LocoNet: receive task setup failed");
+    return false;
+  }
+
+  base.onMqtt(String(LN_TOPIC_ROOT) + "cmd/#",
+              [this](const char *topic, const uint8_t *payload,
+                     unsigned int length) {
+                handleCommand(topic, payload, length);
+              });
+
+  lastRxMicros = micros();
+  started = true;
+  HSC_LOG("LocoNet gateway on UART%d (RX %d, TX %d)", (int)uart, rxPin,
+          txPin);
+  return true;
+}
+
+void HSC_LocoNet::loop() {
+  if (!started) {
+    return;
+  }
+  readRx();
+  processTx();
+  if (millis() - lastPublish >= LN_PUBLISH_INTERVAL_MS) {
+    lastPublish = millis();
+    publishPending();
+  }
+}
+
+// --- Receive ---
+
+void HSC_LocoNet::rxTaskMain(void *arg) {
+  HSC_LocoNet *self = static_cast<HSC_LocoNet *>(arg);
+  uart_event_t event;
+  uint8_t buf[64];
+  for (;;) {
+    if (xQueueReceive(self->uartEvents, &event, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+    if (event.type == UART_DATA) {
+      int n;
+      while ((n = uart_read_bytes(self->uart, buf, sizeof(buf), 0)) > 0) {
+        self->receive(buf, n);
+      }
+    } else if (event.type == UART_FIFO_OVF ||
+               event.type == UART_BUFFER_FULL) {
+      uart_flush_input(self->uart);
+      xQueueReset(self->uartEvents);
+      self->stats.rxDropped++;
+    }
+  }
+}
+
+// Receive task: check the echo byte by byte, then hand the bytes to loop()
+void HSC_LocoNet::receive(const uint8_t *buf, int n) {
+  lastRxMicros = micros();
+  if (breaking) {
+    return; // Our own break and the garbled echo before it
+  }
+  for (int i = 0; i < n; i++) {
+    bool jam = false;
+    portENTER_CRITICAL(&echoMux);
+    if (echoState == ECHO_WAIT) {
+      if (buf[i] != echoMsg->data[echoIndex]) {
+        echoState = ECHO_COLLISION;
+        jam = true;
+      } else if (++echoIndex == echoMsg->len) {
+        echoState = ECHO_OK;
+      }
+    }
+    portEXIT_CRITICAL(&echoMux);
+    if (jam) {
+      startBreak();
+      return;
+    }
+    if (xQueueSend(rxBytes, &buf[i], 0) != pdTRUE) {
+      stats.rxDropped++;
+    }
+  }
+}
+
+void HSC_LocoNet::readRx() {
+  uint8_t b;
+  while (xQueueReceive(rxBytes, &b, 0) == pdTRUE) {
+    feedByte(b);
+  }
+}
+
+uint8_t HSC_LocoNet::messageLength(uint8_t opcode, uint8_t secondByte) {
+  switch (opcode & 0x60) {
+  case 0x00:
+    return 2;
+  case 0x20:
+    return 4;
+  case 0x40:
+    return 6;
+  default:
+    return secondByte; // Variable length, 0 until the count byte is known
+  }
+}
+
+bool HSC_LocoNet::checksumValid(const uint8_t *data, uint8_t len) {
+  uint8_t sum = 0;
+  for (uint8_t i = 0; i < len; i++) {
+    sum ^= data[i];
+  }
+  return sum == 0xFF;
+}
+
+void HSC_LocoNet::feedByte(uint8_t b) {
+  if (b & 0x80) {
+    if (rxMsg.len != 0) {
+      stats.rxDropped++; // Opcode inside a message: previous one was cut off
+    }
+    rxMsg.data[0] = b;
+    rxMsg.len = 1;
+    rxExpected = messageLength(b, 0);
+    return;
+  }
+  if (rxMsg.len == 0) {
+    return; // Data byte with no opcode; wait for the next opcode
+  }
+
+  rxMsg.data[rxMsg.len++] = b;
+  if (rxMsg.len == 2 && rxExpected == 0) {
+    rxExpected = b;
+    if (rxExpected < 3 || rxExpected > LN_MAX_LEN) {
+      stats.rxDropped++;
+      rxMsg.len = 0;
+      return;
+    }
+  }
+  if (rxMsg.len == rxExpected) {
+    if (checksumValid(rxMsg.data, rxMsg.len)) {
+      handleMessage(rxMsg);
+    } else {
+      stats.rxChecksumErrors++;
+    }
+    rxMsg.len = 0;
+  }
+}
+
+bool HSC_LocoNet::decodeSensor(const LocoNetMessage &msg, LocoNetSensor &out) {
+  if (msg.opcode() != OPC_INPUT_REP) {
+    return false;
+  }
+  uint8_t in1 = msg.data[1];
+  uint8_t in2 = msg.data[2];
+  out.address =
+      ((((uint16_t)(in2 & 0x0F) << 7) | in1) << 1 | ((in2 >> 5) & 0x01)) + 1;
+  out.active = (in2 & 0x10) != 0;
+  return true;
+}
+
+bool HSC_LocoNet::decodeSwitch(const LocoNetMessage &msg, LocoNetSwitch &out) {
+  if (msg.opcode() != OPC_SW_REQ && msg.opcode() != OPC_SW_REP) {
+    return false;
+  }
+  uint8_t sw1 = msg.data[1];
+  uint8_t sw2 = msg.data[2];
+  out.address = (((uint16_t)(sw2 & 0x0F) << 7) | sw1) + 1;
+  if (msg.opcode() == OPC_SW_REQ) {
+    // Bit 5: direction (0 = thrown), bit 4: output on
+    out.thrown = (sw2 & 0x20) == 0;
+    out.on = (sw2 & 0x10) != 0;
+    return true;
+  }
+  // OPC_SW_REP with bit 6 set is a sensor-input report, not output state
+  if (sw2 & 0x40) {
+    return false;
+  }
+  // Output report: bit 5 is the closed (C) output level, bit 4 the thrown
+  // (T) one. With neither (or both) on the position is unknown.
+  bool closedOn = (sw2 & 0x20) != 0;
+  bool thrownOn = (sw2 & 0x10) != 0;
+  if (closedOn == thrownOn) {
+    return false;
+  }
+  out.thrown = thrownOn;
+  out.on = true;
+  return true;
+}
+
+void HSC_LocoNet::handleMessage(const LocoNetMessage &msg) {
+  LocoNetSensor sensor;
+  LocoNetSwitch sw;
+
+  if (decodeSensor(msg, sensor)) {
+    uint16_t i = sensor.address - 1;
+    if (i < MAX_SENSORS && (!getBit(sensorKnown, i) ||
+                            getBit(sensorState, i) != sensor.active)) {
+      setBit(sensorKnown, i, true);
+      setBit(sensorState, i, sensor.active);
+      setBit(sensorDirty, i, true);
+    }
+  } else if (decodeSwitch(msg, sw)) {
+    uint16_t i = sw.address - 1;
+    if (i < MAX_SWITCHES && (!getBit(switchKnown, i) ||
+                             getBit(switchState, i) != sw.thrown)) {
+      setBit(switchKnown, i, true);
+      setBit(switchState, i, sw.thrown);
+      setBit(switchDirty, i, true);
+    }
+  } else if (msg.opcode() == OPC_GPON || msg.opcode() == OPC_GPOFF) {
+    int8_t on = msg.opcode() == OPC_GPON ? 1 : 0;
+    if (powerState != on) {
+      powerState = on;
+      powerDirty = true;
+    }
+  } else if (msg.opcode() == OPC_LOCO_SPD || msg.opcode() == OPC_LOCO_DIRF ||
+             msg.opcode() == OPC_LOCO_SND ||
+             (msg.opcode() == OPC_SL_RD_DATA && msg.len >= 14)) {
+    uint8_t op = msg.opcode();
+    uint8_t s = op == OPC_SL_RD_DATA ? msg.data[2] : msg.data[1];
+    if (s < MAX_SLOTS) {
+      LocoNetSlot &slot = slots[s];
+      LocoNetSlot before = slot;
+      slot.slot = s;
+      if (op == OPC_LOCO_SPD) {
+        slot.speed = msg.data[2];
+      } else if (op == OPC_LOCO_DIRF) {
+        uint8_t dirf = msg.data[2];
+        slot.forward = (dirf & 0x20) == 0;
+        slot.functions = (slot.functions & ~0x1F) | ((dirf >> 4) & 0x01) |
+                         ((dirf & 0x0F) << 1);
+      } else if (op == OPC_LOCO_SND) {
+        slot.functions =
+            (slot.functions & ~0x1E0) | ((msg.data[2] & 0x0F) << 5);
+      } else {
+        uint8_t dirf = msg.data[6];
+        slot.address = ((uint16_t)msg.data[9] << 7) | msg.data[4];
+        slot.speed = msg.data[5];
+        slot.forward = (dirf & 0x20) == 0;
+        slot.functions = ((dirf >> 4) & 0x01) | ((dirf & 0x0F) << 1) |
+                         ((msg.data[10] & 0x0F) << 5);
+      }
+      if (slot.address != before.address || slot.speed != before.speed ||
+          slot.forward != before.forward ||
+          slot.functions != before.functions) {
+        setBit(slotDirty, s, true);
+      }
+    }
+  }
+
+  if (messageHandler) {
+    messageHandler(msg);
+  }
+}
+
+// --- Transmit ---
+
+bool HSC_LocoNet::send(const uint8_t *data, uint8_t lenWithoutChecksum) {
+  if (lenWithoutChecksum == 0 || lenWithoutChecksum >= LN_MAX_LEN ||
+      txCount == TX_QUEUE_LEN) {
+    return false;
+  }
+  LocoNetMessage &msg = txQueue[(txHead + txCount) % TX_QUEUE_LEN];
+  uint8_t sum = 0xFF;
+  for (uint8_t i = 0; i < lenWithoutChecksum; i++) {
+    msg.data[i] = data[i];
+    sum ^= data[i];
+  }
+  msg.data[lenWithoutChecksum] = sum;
+  msg.len = lenWithoutChecksum + 1;
+  txCount++;
+  return true;
+}
+
+bool HSC_LocoNet::requestSwitch(uint16_t address, bool thrown) {
+  if (address == 0 || address > MAX_SWITCHES) {
+    return false;
+  }
+  uint16_t a = address - 1;
+  uint8_t sw2 = ((a >> 7) & 0x0F) | (thrown ? 0x00 : 0x20);
+  // Output on, then off again to release the accessory decoder
+  uint8_t on[] = {OPC_SW_REQ, (uint8_t)(a & 0x7F), (uint8_t)(sw2 | 0x10)};
+  uint8_t off[] = {OPC_SW_REQ, (uint8_t)(a & 0x7F), sw2};
+  // Both or neither, so the output is never left energised
+  if (TX_QUEUE_LEN - txCount < 2) {
+    return false;
+  }
+  return send(on, sizeof(on)) && send(off, sizeof(off));
+}
+
+bool HSC_LocoNet::setPower(bool on) {
+  uint8_t msg[] = {on ? (uint8_t)OPC_GPON : (uint8_t)OPC_GPOFF};
+  return send(msg, sizeof(msg));
+}
+
+void HSC_LocoNet::processTx() {
+  unsigned long now = micros();
+
+  if (txState == TX_WAIT_ECHO) {
+    // No echo means the bus is not connected or our bytes were lost
+    unsigned long timeout = txQueue[txHead].len * 10 * LN_BIT_US + 5000;
+    bool timedOut = false;
+    portENTER_CRITICAL(&echoMux);
+    uint8_t echo = echoState;
+    if (echo == ECHO_WAIT && now - txStartMicros > timeout) {
+      timedOut = true;
+    }
+    if (echo != ECHO_WAIT || timedOut) {
+      echoState = ECHO_IDLE;
+    }
+    portEXIT_CRITICAL(&echoMux);
+
+    if (echo == ECHO_OK) {
+      stats.txMessages++;
+      txHead = (txHead + 1) % TX_QUEUE_LEN;
+      txCount--;
+      txAttempts = 0;
+      txState = TX_IDLE;
+    } else if (echo == ECHO_COLLISION || timedOut) {
+      if (timedOut) {
+        startBreak();
+      }
+      collision();
+    }
+    return;
+  }
+  if (txState == TX_BACKOFF) {
+    if ((long)(now - txBackoffUntil) < 0) {
+      return;
+    }
+    txState = TX_IDLE;
+  }
+  if (txCount == 0) {
+    return;
+  }
+
+  size_t pending = 0;
+  uart_get_buffered_data_len(uart, &pending);
+  if (breaking || pending > 0 || now - lastRxMicros < LN_CD_BACKOFF_US) {
+    return; // Bus busy
+  }
+
+  const LocoNetMessage &msg = txQueue[txHead];
+  portENTER_CRITICAL(&echoMux);
+  echoMsg = &msg;
+  echoIndex = 0;
+  echoState = ECHO_WAIT;
+  portEXIT_CRITICAL(&echoMux);
+  txStartMicros = now;
+  txState = TX_WAIT_ECHO;
+  uart_write_bytes(uart, (const char *)msg.data, msg.len);
+}
+
+// The break is already on the bus; count the attempt and back off
+void HSC_LocoNet::collision() {
+  stats.txCollisions++;
+  rxMsg.len = 0;
+
+  if (++txAttempts >= LN_MAX_RETRIES) {
+    HSC_LOG("LocoNet: dropping message 0x%02X after %d attempts",
+            txQueue[txHead].opcode(), txAttempts);
+    stats.txFailed++;
+    txHead = (txHead + 1) % TX_QUEUE_LEN;
+    txCount--;
+    txAttempts = 0;
+    txState = TX_IDLE;
+    return;
+  }
+  txBackoffUntil = micros() + LN_CD_BACKOFF_US +
+                   (LN_BREAK_BITS + esp_random() % LN_PRIORITY_BITS) *
+                       LN_BIT_US;
+  txState = TX_BACKOFF;
+}
+
+// Jams the bus with a break so every node discards the corrupted message.
+// The TX pin is taken from the UART and held at the space level until
+// endBreak(), LN_BREAK_BITS later.
+void HSC_LocoNet::startBreak() {
+  portENTER_CRITICAL(&echoMux);
+  bool already = breaking;
+  breaking = true;
+  portEXIT_CRITICAL(&echoMux);
+  if (already) {
+    return;
+  }
+  gpio_set_level((gpio_num_t)txPin, inverted ? 1 : 0);
+  esp_rom_gpio_connect_out_signal(txPin, SIG_GPIO_OUT_IDX, false, false);
+  esp_timer_start_once(breakTimer, LN_BREAK_BITS * LN_BIT_US);
+}
+
+void HSC_LocoNet::onBreakEnd(void *arg) {
+  static_cast<HSC_LocoNet *>(arg)->endBreak();
+}
+
+void HSC_LocoNet::endBreak() {
+  // The rest of the failed message is still in the TX FIFO; discard it
+  // rather than send it once the pin is back
+  uart_ll_txfifo_rst(UART_LL_GET_HW(uart));
+  uart_set_pin(uart, txPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE,
+               UART_PIN_NO_CHANGE);
+  breaking = false;
+}
+
+// --- MQTT mapping ---
+
+void HSC_LocoNet::publishPending() {
+  PubSubClient &mqtt = base.getMqttClient();
+  if (!mqtt.connected()) {
+    return; // Dirty flags are kept until the broker is back
+  }
+  char topic[64];
+
+  for (uint16_t byte = 0; byte < sizeof(sensorDirty); byte++) {
+    if (!sensorDirty[byte]) {
+      continue;
+    }
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      uint16_t i = byte * 8 + bit;
+      if (getBit(sensorDirty, i)) {
+        snprintf(topic, sizeof(topic), "%ssensor/%u", LN_TOPIC_ROOT, i + 1);
+        mqtt.publish(topic, getBit(sensorState, i) ? "ACTIVE" : "INACTIVE",
+                     true);
+        stats.mqttPublished++;
+      }
+    }
+    sensorDirty[byte] = 0;
+  }
+
+  for (uint16_t byte = 0; byte < sizeof(switchDirty); byte++) {
+    if (!switchDirty[byte]) {
+      continue;
+    }
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      uint16_t i = byte * 8 + bit;
+      if (getBit(switchDirty, i)) {
+        snprintf(topic, sizeof(topic), "%sswitch/%u", LN_TOPIC_ROOT, i + 1);
+        mqtt.publish(topic, getBit(switchState, i) ? "THROWN" : "CLOSED",
+                     true);
+        stats.mqttPublished++;
+      }
+    }
+    switchDirty[byte] = 0;
+  }
+
+  for (uint8_t s = 0; s < MAX_SLOTS; s++) {
+    if (!getBit(slotDirty, s)) {
+      continue;
+    }
+    setBit(slotDirty, s, false);
+    const LocoNetSlot &slot = slots[s];
+    StaticJsonDocument<128> doc;
+    doc["address"] = slot.address;
+    doc["speed"] = slot.speed;
+    doc["direction"] = slot.forward ? "forward" : "reverse";
+    doc["functions"] = slot.functions;
+    char buf[128];
+    serializeJson(doc, buf);
+    snprintf(topic, sizeof(topic), "%sslot/%u", LN_TOPIC_ROOT, s);
+    mqtt.publish(topic, buf, true);
+    stats.mqttPublished++;
+  }
+
+  if (powerDirty) {
+    powerDirty = false;
+    snprintf(topic, sizeof(topic), "%spower", LN_TOPIC_ROOT);
+    mqtt.publish(topic, powerState ? "ON" : "OFF", true);
+    stats.mqttPublished++;
+  }
+}
+
+void HSC_LocoNet::handleCommand(const char *topic, const uint8_t *payload,
+                                unsigned int length) {
+  const char *cmd = topic + strlen(LN_TOPIC_ROOT) + strlen("cmd/");
+  char value[64];
+  size_t n = length < sizeof(value) - 1 ? length : sizeof(value) - 1;
+  memcpy(value, payload, n);
+  value[n] = '\0';
+
+  if (strncmp(cmd, "switch/", 7) == 0) {
+    uint16_t address = atoi(cmd + 7);
+    bool thrown = strcasecmp(value, "THROWN") == 0;
+    if (!thrown && strcasecmp(value, "CLOSED") != 0) {
+      return;
+    }
+    requestSwitch(address, thrown);
+  } else if (strcmp(cmd, "power") == 0) {
+    setPower(strcasecmp(value, "ON") == 0);
+  } else if (strcmp(cmd, "raw") == 0) {
+    // Hex bytes without checksum, e.g. "B0 12 30"
+    uint8_t msg[LN_MAX_LEN];
+    uint8_t len = 0;
+    char *p = value;
+    while (*p && len < LN_MAX_LEN - 1) {
+      char *end;
+      long b = strtol(p, &end, 16);
+      if (end == p) {
+        break;
+      }
+      msg[len++] = (uint8_t)b;
+      p = end;
+    }
+    if (len > 0) {
+      send(msg, len);
+    }
+  }
+}
+
+void HSC_LocoNet::setBit(uint8_t *bits, uint16_t i, bool v) {
+  if (v) {
+    bits[i >> 3] |= (1 << (i & 7));
+  } else {
+    bits[i >> 3] &= ~(1 << (i & 7));
+  }
+}
+
+bool HSC_LocoNet::getBit(const uint8_t *bits, uint16_t i) {
+  return (bits[i >> 3] >> (i & 7)) & 1;
+}
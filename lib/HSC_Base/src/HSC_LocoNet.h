@@ -0,0 +1,178 @@
+#ifndef HSC_LOCONET_H
+#define HSC_LOCONET_H
+
+#include "HSC_Base.h"
+#include <driver/uart.h>
+#include <esp_timer.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+// LocoNet opcodes understood by the gateway
+enum LocoNetOpcode : uint8_t {
+  OPC_GPOFF = 0x82,
+  OPC_GPON = 0x83,
+  OPC_LOCO_SPD = 0xA0,
+  OPC_LOCO_DIRF = 0xA1,
+  OPC_LOCO_SND = 0xA2,
+  OPC_SW_REQ = 0xB0,
+  OPC_SW_REP = 0xB1,
+  OPC_INPUT_REP = 0xB2,
+  OPC_SL_RD_DATA = 0xE7,
+};
+
+// Longest message buffered; longer variable-length messages are dropped
+static const uint8_t LN_MAX_LEN = 32;
+
+struct LocoNetMessage {
+  uint8_t data[LN_MAX_LEN];
+  uint8_t len;
+
+  uint8_t opcode() const { return data[0]; }
+};
+
+// Typed views of the messages the gateway maps to MQTT
+struct LocoNetSensor {
+  uint16_t address; // 1-based
+  bool active;
+};
+
+struct LocoNetSwitch {
+  uint16_t address; // 1-based
+  bool thrown;
+  bool on;
+};
+
+struct LocoNetSlot {
+  uint8_t slot;
+  uint16_t address;
+  uint8_t speed;
+  bool forward;
+  uint16_t functions; // bit n = Fn, F0..F8
+};
+
+struct LocoNetStats {
+  uint32_t rxMessages;
+  uint32_t rxChecksumErrors;
+  uint32_t rxDropped;
+  uint32_t txMessages;
+  uint32_t txCollisions;
+  uint32_t txFailed;
+  uint32_t mqttPublished;
+};
+
+// LocoNet gateway: interrupt-driven UART receive, collision-checked
+// transmit, and a mapping of sensor, switch, slot and power messages to
+// retained MQTT topics under HSC/loconet/. Commands are accepted on
+// HSC/loconet/cmd/#.
+//
+// A receive task woken by the UART driver compares the echo of our own
+// transmission as each byte arrives, and on a mismatch jams the bus with
+// a break timed by esp_timer, so neither waits on loop().
+//
+// Changes are coalesced and published at most every LN_PUBLISH_INTERVAL_MS,
+// so a burst of detector chatter produces one message per address.
+class HSC_LocoNet {
+public:
+  typedef std::function<void(const LocoNetMessage &msg)> MessageHandler;
+
+  // Pins default (-1) to PIN_LOCONET_RX/PIN_LOCONET_TX from HSC_Board.h
+  HSC_LocoNet(HSC_Base &base, uart_port_t uart = UART_NUM_2, int rxPin = -1,
+              int txPin = -1);
+
+  // invert: set for interfaces whose RX/TX transistors invert the line
+  bool begin(bool invert = false);
+  void loop();
+
+  // Queue a message; the checksum byte is computed and appended
+  bool send(const uint8_t *data, uint8_t lenWithoutChecksum);
+  bool requestSwitch(uint16_t address, bool thrown);
+  bool setPower(bool on);
+
+  void onMessage(MessageHandler handler) { messageHandler = handler; }
+  const LocoNetStats &getStats() const { return stats; }
+
+  // Message decoding helpers
+  static uint8_t messageLength(uint8_t opcode, uint8_t secondByte);
+  static bool checksumValid(const uint8_t *data, uint8_t len);
+  static bool decodeSensor(const LocoNetMessage &msg, LocoNetSensor &out);
+  static bool decodeSwitch(const LocoNetMessage &msg, LocoNetSwitch &out);
+
+private:
+  static const uint16_t MAX_SENSORS = 4096;
+  static const uint16_t MAX_SWITCHES = 2048;
+  static const uint8_t MAX_SLOTS = 120;
+  static const uint8_t TX_QUEUE_LEN = 8;
+
+  enum TxState { TX_IDLE, TX_WAIT_ECHO, TX_BACKOFF };
+
+  HSC_Base &base;
+  uart_port_t uart;
+  int rxPin;
+  int txPin;
+  bool inverted = false;
+  bool started = false;
+
+  // Receive task: UART events in, received bytes out to loop()
+  QueueHandle_t uartEvents = nullptr;
+  QueueHandle_t rxBytes = nullptr;
+  TaskHandle_t rxTask = nullptr;
+  volatile unsigned long lastRxMicros = 0;
+
+  // Receive parser, loop() only
+  LocoNetMessage rxMsg;
+  uint8_t rxExpected = 0;
+
+  // Transmit queue and collision handling
+  LocoNetMessage txQueue[TX_QUEUE_LEN];
+  uint8_t txHead = 0;
+  uint8_t txCount = 0;
+  TxState txState = TX_IDLE;
+  uint8_t txAttempts = 0;
+  unsigned long txStartMicros = 0;
+  unsigned long txBackoffUntil = 0;
+
+  // Echo check, shared with the receive task and guarded by echoMux
+  enum EchoState : uint8_t { ECHO_IDLE, ECHO_WAIT, ECHO_OK, ECHO_COLLISION };
+  portMUX_TYPE echoMux = portMUX_INITIALIZER_UNLOCKED;
+  volatile uint8_t echoState = ECHO_IDLE;
+  const LocoNetMessage *echoMsg = nullptr;
+  uint8_t echoIndex = 0;
+  esp_timer_handle_t breakTimer = nullptr;
+  volatile bool breaking = false;
+
+  // Last known layout state and pending MQTT updates
+  uint8_t sensorState[MAX_SENSORS / 8];
+  uint8_t sensorKnown[MAX_SENSORS / 8];
+  uint8_t sensorDirty[MAX_SENSORS / 8];
+  uint8_t switchState[MAX_SWITCHES / 8];
+  uint8_t switchKnown[MAX_SWITCHES / 8];
+  uint8_t switchDirty[MAX_SWITCHES / 8];
+  LocoNetSlot slots[MAX_SLOTS];
+  uint8_t slotDirty[(MAX_SLOTS + 7) / 8];
+  int8_t powerState = -1;
+  bool powerDirty = false;
+  unsigned long lastPublish = 0;
+
+  MessageHandler messageHandler;
+  LocoNetStats stats = {};
+
+  static void rxTaskMain(void *arg);
+  static void onBreakEnd(void *arg);
+  void receive(const uint8_t *buf, int n);
+  void startBreak();
+  void endBreak();
+
+  void readRx();
+  void feedByte(uint8_t b);
+  void handleMessage(const LocoNetMessage &msg);
+  void processTx();
+  void collision();
+  void publishPending();
+  void handleCommand(const char *topic, const uint8_t *payload,
+                     unsigned int length);
+
+  static void setBit(uint8_t *bits, uint16_t i, bool v);
+  static bool getBit(const uint8_t *bits, uint16_t i);
+};
+
+#endif
@@ -0,0 +1,106 @@
+#include "HSC_Log.h"
+
+// Batched MQTT frames are flushed at this size or after this interval
+static const size_t MQTT_BATCH_BYTES = 192;
+static const unsigned long MQTT_BATCH_INTERVAL_MS = 1000;
+
+static uint8_t mqttBatch[MQTT_BATCH_BYTES + HSC_LogFrame::MAX_LEN + 3];
+static size_t mqttBatchLen = 0;
+static unsigned long mqttBatchStart = 0;
+static portMUX_TYPE mqttBatchMux = portMUX_INITIALIZER_UNLOCKED;
+
+PubSubClient *HSC_Log::_mqtt = nullptr;
+String HSC_Log::_mqttTopic;
+uint32_t HSC_Log::_framesSent = 0;
+uint32_t HSC_Log::_bytesSent = 0;
+
+HSC_LogFrame::HSC_LogFrame(const char *fmt) {
+  _buf[0] = SYNC;
+  _len = 2;
+  putRaw((uint32_t)(uintptr_t)fmt, 4);
+  putRaw((uint32_t)millis(), 4);
+}
+
+void HSC_LogFrame::putRaw(uint64_t value, size_t bytes) {
+  if (_len + bytes > MAX_LEN + 2) {
+    return;
+  }
+  for (size_t i = 0; i < bytes; i++) {
+    _buf[_len++] = (uint8_t)(value >> (8 * i));
+  }
+}
+
+void HSC_LogFrame::put(const char *str) {
+  if (str == nullptr) {
+    str = "(null)";
+  }
+  size_t n = strnlen(str, MAX_STRING);
+  if (_len + 1 + n > MAX_LEN + 2) {
+    n = 0;
+    if (_len + 1 > MAX_LEN + 2) {
+      return;
+    }
+  }
+  _buf[_len++] = (uint8_t)n;
+  memcpy(&_buf[_len], str, n);
+  _len += n;
+}
+
+size_t HSC_LogFrame::finish() {
+  _buf[1] = (uint8_t)(_len - 2);
+  uint8_t check = 0;
+  for (size_t i = 2; i < _len; i++) {
+    check ^= _buf[i];
+  }
+  _buf[_len] = check;
+  return _len + 1;
+}
+
+void HSC_Log::emit(const uint8_t *data, size_t len) {
+  Serial.write(data, len);
+  _framesSent++;
+  _bytesSent += len;
+
+  if (_mqtt == nullptr) {
+    return;
+  }
+  portENTER_CRITICAL(&mqttBatchMux);
+  if (mqttBatchLen + len <= sizeof(mqttBatch)) {
+    if (mqttBatchLen == 0) {
+      mqttBatchStart = millis();
+    }
+    memcpy(&mqttBatch[mqttBatchLen], data, len);
+    mqttBatchLen += len;
+  }
+  portEXIT_CRITICAL(&mqttBatchMux);
+}
+
+void HSC_Log::attachMqtt(PubSubClient *client, const String &topic) {
+  _mqttTopic = topic;
+  _mqtt = client;
+}
+
+void HSC_Log::detachMqtt() { _mqtt = nullptr; }
+
+void HSC_Log::loop() {
+  if (_mqtt == nullptr || mqttBatchLen == 0) {
+    return;
+  }
+  if (mqttBatchLen < MQTT_BATCH_BYTES &&
+      millis() - mqttBatchStart < MQTT_BATCH_INTERVAL_MS) {
+    return;
+  }
+  if (!_mqtt->connected()) {
+    return;
+  }
+
+  uint8_t batch[sizeof(mqttBatch)];
+  size_t len;
+  portENTER_CRITICAL(&mqttBatchMux);
+  len = mqttBatchLen;
+  memcpy(batch, mqttBatch, len);
+  mqttBatchLen = 0;
+  portEXIT_CRITICAL(&mqttBatchMux);
+
+  _mqtt->publish(_mqttTopic.c_str(), batch, len, false);
+}
@@ -0,0 +1,114 @@
+#ifndef HSC_LOG_H
+#define HSC_LOG_H
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include <type_traits>
+
+// Logging for the library and device code.
+//
+// By default HSC_LOG() is a plain Serial.printf() with a trailing newline.
+// Building with -DHSC_LOG_COMPACT switches to deferred formatting: only the
+// address of the format string and the binary arguments are sent, and
+// hsc_logdecode.py rebuilds the text on the host from the firmware ELF.
+//
+// Compact frame layout:
+//   0x1E | len | fmt address (u32) | millis (u32) | args... | xor checksum
+// len counts the bytes from the address to the end of the args. Integers up
+// to 32 bits are sent as 4 bytes, 64-bit integers and floating point values
+// as 8 bytes, strings as a length byte followed by the characters.
+//
+// The format string must be a literal so it stays in flash at a fixed
+// address. Pass String values as .c_str() so both modes behave the same.
+
+#ifdef HSC_LOG_COMPACT
+#define HSC_LOG(fmt, ...) HSC_Log::frame(fmt, ##__VA_ARGS__)
+#else
+#define HSC_LOG(fmt, ...) Serial.printf(fmt "\n", ##__VA_ARGS__)
+#endif
+
+class HSC_LogFrame {
+public:
+  static const uint8_t SYNC = 0x1E;
+  static const size_t MAX_LEN = 250;
+  static const size_t MAX_STRING = 63;
+
+  explicit HSC_LogFrame(const char *fmt);
+
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value && sizeof(T) <= 4>::type
+  put(T value) {
+    putRaw(static_cast<uint32_t>(value), 4);
+  }
+
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value && sizeof(T) == 8>::type
+  put(T value) {
+    putRaw(static_cast<uint64_t>(value), 8);
+  }
+
+  template <typename T>
+  typename std::enable_if<std::is_enum<T>::value>::type put(T value) {
+    putRaw(static_cast<uint32_t>(value), 4);
+  }
+
+  template <typename T>
+  typename std::enable_if<std::is_floating_point<T>::value>::type
+  put(T value) {
+    double d = value;
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    putRaw(bits, 8);
+  }
+
+  void put(const char *str);
+  void put(const String &str) { put(str.c_str()); }
+  void put(const void *ptr) { putRaw((uint32_t)(uintptr_t)ptr, 4); }
+
+  // Finish the frame; returns the number of bytes in data()
+  size_t finish();
+  const uint8_t *data() const { return _buf; }
+
+private:
+  uint8_t _buf[MAX_LEN + 3];
+  size_t _len;
+
+  void putRaw(uint64_t value, size_t bytes);
+};
+
+class HSC_Log {
+public:
+  template <typename... Args>
+  static void frame(const char *fmt, const Args &...args) {
+    HSC_LogFrame f(fmt);
+    encode(f, args...);
+    emit(f.data(), f.finish());
+  }
+
+  // Also batch compact frames to an MQTT topic. Frames are published from
+  // loop() so callers on other tasks never touch the MQTT client.
+  static void attachMqtt(PubSubClient *client, const String &topic);
+  static void detachMqtt();
+  static void loop();
+
+  static uint32_t framesSent() { return _framesSent; }
+  static uint32_t bytesSent() { return _bytesSent; }
+
+private:
+  static void encode(HSC_LogFrame &) {}
+
+  template <typename T, typename... Rest>
+  static void encode(HSC_LogFrame &f, const T &value, const Rest &...rest) {
+    f.put(value);
+    encode(f, rest...);
+  }
+
+  static void emit(const uint8_t *data, size_t len);
+
+  static PubSubClient *_mqtt;
+  static String _mqttTopic;
+  static uint32_t _framesSent;
+  static uint32_t _bytesSent;
+};
+
+#endif
@@ -0,0 +1,288 @@
+#include "HSC_Motor.h"
+
+static const uint32_t MOTOR_PWM_HZ = 20000;
+static const mcpwm_timer_t MOTOR_TIMER = MCPWM_TIMER_0;
+
+// Back-EMF below this (of 1000) counts as stopped when reversing
+static const uint16_t MOTOR_STOPPED_BEMF = 20;
+static const uint8_t MOTOR_ADC_SAMPLES = 4;
+
+static const unsigned long MOTOR_TELEMETRY_MOVING_MS = 500;
+static const unsigned long MOTOR_TELEMETRY_IDLE_MS = 10000;
+
+HSC_Motor::HSC_Motor(HSC_Base &base, int in1Pin, int in2Pin, int bemfPin,
+                     int bemf2Pin, mcpwm_unit_t unit)
+    : base(base), in1Pin(in1Pin < 0 ? HSC_Board::PIN_MOTOR_IN1 : in1Pin),
+      in2Pin(in2Pin < 0 ? HSC_Board::PIN_MOTOR_IN2 : in2Pin),
+      bemfPin(bemfPin < 0 ? HSC_Board::PIN_MOTOR_BEMF : bemfPin),
+      bemf2Pin(bemf2Pin < 0 ? HSC_Board::PIN_MOTOR_BEMF2 : bemf2Pin),
+      unit(unit) {
+  telemetry.forward = true;
+}
+
+bool HSC_Motor::begin(uint16_t period, uint16_t settle) {
+  // The coast and sample must fit well inside one control period
+  if ((uint32_t)settle * 2 > (uint32_t)period * 1000) {
+    HSC_LOG("Motor: settle time %u us too long for %u ms period", settle,
+            period);
+    return false;
+  }
+  periodMs = period;
+  settleUs = settle;
+
+  mcpwm_gpio_init(unit, MCPWM0A, in1Pin);
+  mcpwm_gpio_init(unit, MCPWM0B, in2Pin);
+  mcpwm_config_t pwm = {};
+  pwm.frequency = MOTOR_PWM_HZ;
+  pwm.cmpr_a = 0;
+  pwm.cmpr_b = 0;
+  pwm.duty_mode = MCPWM_DUTY_MODE_0;
+  pwm.counter_mode = MCPWM_UP_COUNTER;
+  if (mcpwm_init(unit, MOTOR_TIMER, &pwm) != ESP_OK) {
+    HSC_LOG("Motor: MCPWM setup failed");
+    return false;
+  }
+  coast();
+  pinMode(bemfPin, INPUT);
+  pinMode(bemf2Pin, INPUT);
+
+  esp_timer_create_args_t args = {};
+  args.callback = onControl;
+  args.arg = this;
+  args.name = "motor_ctl";
+  esp_timer_create_args_t sampleArgs = {};
+  sampleArgs.callback = onSample;
+  sampleArgs.arg = this;
+  sampleArgs.name = "motor_bemf";
+  if (esp_timer_create(&args, &controlTimer) != ESP_OK ||
+      esp_timer_create(&sampleArgs, &sampleTimer) != ESP_OK ||
+      esp_timer_start_periodic(controlTimer, (uint64_t)periodMs * 1000) !=
+          ESP_OK) {
+    HSC_LOG("Motor: timer setup failed");
+    return false;
+  }
+
+  base.onMqtt(base.deviceTopic("motor/set"),
+              [this](const char *topic, const uint8_t *payload,
+                     unsigned int length) { handleCommand(payload, length); });
+
+  started = true;
+  HSC_LOG("Motor on GPIO %d/%d, back-EMF GPIO %d/%d, %u ms control period",
+          in1Pin, in2Pin, bemfPin, bemf2Pin, periodMs);
+  return true;
+}
+
+void HSC_Motor::setSpeed(uint16_t speed, bool forward) {
+  portENTER_CRITICAL(&mux);
+  telemetry.target = speed > 1000 ? 1000 : speed;
+  targetForward = forward;
+  portEXIT_CRITICAL(&mux);
+}
+
+void HSC_Motor::emergencyStop() {
+  portENTER_CRITICAL(&mux);
+  telemetry.target = 0;
+  estop = true;
+  portEXIT_CRITICAL(&mux);
+}
+
+void HSC_Motor::setAcceleration(uint16_t a, uint16_t d) {
+  portENTER_CRITICAL(&mux);
+  accel = a;
+  decel = d;
+  portEXIT_CRITICAL(&mux);
+}
+
+void HSC_Motor::setGains(float p, float i, float d) {
+  portENTER_CRITICAL(&mux);
+  kp = p;
+  ki = i;
+  kd = d;
+  portEXIT_CRITICAL(&mux);
+}
+
+MotorTelemetry HSC_Motor::getTelemetry() {
+  portENTER_CRITICAL(&mux);
+  MotorTelemetry t = telemetry;
+  portEXIT_CRITICAL(&mux);
+  return t;
+}
+
+// --- Control timer ---
+
+void HSC_Motor::onControl(void *arg) {
+  HSC_Motor *self = static_cast<HSC_Motor *>(arg);
+  // Phase 1: let the motor coast so its terminal shows the back-EMF
+  self->coast();
+  esp_timer_start_once(self->sampleTimer, self->settleUs);
+}
+
+void HSC_Motor::onSample(void *arg) {
+  // Phase 2: sample, update the controller and drive again
+  static_cast<HSC_Motor *>(arg)->sampleAndControl();
+}
+
+void HSC_Motor::coast() {
+  mcpwm_set_signal_low(unit, MOTOR_TIMER, MCPWM_OPR_A);
+  mcpwm_set_signal_low(unit, MOTOR_TIMER, MCPWM_OPR_B);
+}
+
+void HSC_Motor::drive(float duty, bool forward) {
+  mcpwm_generator_t on = forward ? MCPWM_OPR_A : MCPWM_OPR_B;
+  mcpwm_generator_t off = forward ? MCPWM_OPR_B : MCPWM_OPR_A;
+  mcpwm_set_signal_low(unit, MOTOR_TIMER, off);
+  if (duty <= 0) {
+    mcpwm_set_signal_low(unit, MOTOR_TIMER, on);
+    return;
+  }
+  mcpwm_set_duty(unit, MOTOR_TIMER, on, duty);
+  // Leaves the forced-low state set by coast()
+  mcpwm_set_duty_type(unit, MOTOR_TIMER, on, MCPWM_DUTY_MODE_0);
+}
+
+uint32_t HSC_Motor::readBemf(int pin) {
+  uint32_t raw = 0;
+  for (uint8_t i = 0; i < MOTOR_ADC_SAMPLES; i++) {
+    raw += analogRead(pin);
+  }
+  return raw / MOTOR_ADC_SAMPLES;
+}
+
+void HSC_Motor::sampleAndControl() {
+  // The terminal driven high generates the back-EMF: IN1 forward, IN2 in
+  // reverse. A negative difference means the motor turns the other way.
+  int32_t diff = (int32_t)readBemf(bemfPin) - (int32_t)readBemf(bemf2Pin);
+  float speed = (diff < 0 ? -diff : diff) * 1000.0f / bemfFullScale;
+  if (speed > 1000) {
+    speed = 1000;
+  }
+  bool turningForward = diff >= 0;
+  // Speed in the driven direction, for the controller
+  float measured = turningForward == driveForward ? speed : 0;
+
+  portENTER_CRITICAL(&mux);
+  uint16_t target = telemetry.target;
+  bool wantForward = targetForward;
+  bool stopNow = estop;
+  estop = false;
+  float p = kp, i = ki, d = kd;
+  float up = accel, down = decel;
+  portEXIT_CRITICAL(&mux);
+
+  float dt = periodMs / 1000.0f;
+  if (stopNow) {
+    rampedSetpoint = 0;
+    integral = 0;
+  }
+
+  // Reversing: ramp down to zero and wait for the motor to stop first
+  float desired = wantForward == driveForward ? target : 0;
+  if (rampedSetpoint < desired) {
+    rampedSetpoint += up * dt;
+    if (rampedSetpoint > desired) {
+      rampedSetpoint = desired;
+    }
+  } else if (rampedSetpoint > desired) {
+    rampedSetpoint -= down * dt;
+    if (rampedSetpoint < desired) {
+      rampedSetpoint = desired;
+    }
+  }
+  if (rampedSetpoint == 0 && wantForward != driveForward &&
+      speed < MOTOR_STOPPED_BEMF) {
+    driveForward = wantForward;
+  }
+
+  float duty = 0;
+  if (rampedSetpoint > 0) {
+    float error = rampedSetpoint - measured;
+    integral += error * dt;
+    // Anti-windup: keep the integral term within the duty range
+    if (i > 0) {
+      float limit = 100.0f / i;
+      integral = integral > limit ? limit : integral < 0 ? 0 : integral;
+    }
+    duty = p * error + i * integral + d * (error - lastError) / dt;
+    duty = duty > 100 ? 100 : duty < 0 ? 0 : duty;
+    lastError = error;
+  } else {
+    integral = 0;
+    lastError = 0;
+  }
+  drive(duty, driveForward);
+
+  portENTER_CRITICAL(&mux);
+  telemetry.setpoint = rampedSetpoint;
+  telemetry.measured = measured;
+  telemetry.duty = duty;
+  telemetry.forward = driveForward;
+  portEXIT_CRITICAL(&mux);
+}
+
+// --- MQTT ---
+
+void HSC_Motor::loop() {
+  if (!started) {
+    return;
+  }
+  MotorTelemetry t = getTelemetry();
+  bool moving = t.target > 0 || t.setpoint > 0 || t.measured > 0;
+  unsigned long interval =
+      moving ? MOTOR_TELEMETRY_MOVING_MS : MOTOR_TELEMETRY_IDLE_MS;
+  if (millis() - lastTelemetry >= interval) {
+    lastTelemetry = millis();
+    publishTelemetry();
+  }
+}
+
+void HSC_Motor::publishTelemetry() {
+  PubSubClient &mqtt = base.getMqttClient();
+  if (!mqtt.connected()) {
+    return;
+  }
+  MotorTelemetry t = getTelemetry();
+  StaticJsonDocument<192> doc;
+  doc["target"] = t.target;
+  doc["setpoint"] = t.setpoint;
+  doc["measured"] = t.measured;
+  doc["duty"] = (int)(t.duty + 0.5f);
+  doc["direction"] = t.forward ? "forward" : "reverse";
+  char buf[192];
+  serializeJson(doc, buf);
+  char topic[HSC_Base::TOPIC_MAX];
+  base.deviceTopic(topic, sizeof(topic), "motor");
+  mqtt.publish(topic, buf);
+}
+
+void HSC_Motor::handleCommand(const uint8_t *payload, unsigned int length) {
+  if (length == 5 && strncasecmp((const char *)payload, "ESTOP", 5) == 0) {
+    emergencyStop();
+    return;
+  }
+  if (length == 4 && strncasecmp((const char *)payload, "STOP", 4) == 0) {
+    stop();
+    return;
+  }
+  StaticJsonDocument<192> doc;
+  if (deserializeJson(doc, payload, length)) {
+    return;
+  }
+  if (doc["estop"] | false) {
+    emergencyStop();
+    return;
+  }
+  if (doc["accel"].is<int>() || doc["decel"].is<int>()) {
+    setAcceleration(doc["accel"] | accel, doc["decel"] | decel);
+  }
+  MotorTelemetry t = getTelemetry();
+  bool forward = t.forward;
+  if (doc["direction"].is<const char *>()) {
+    forward = strcasecmp(doc["direction"], "reverse") != 0;
+  }
+  if (doc["speed"].is<int>()) {
+    setSpeed(doc["speed"].as<int>() < 0 ? 0 : doc["speed"].as<int>(),
+             forward);
+  } else if (forward != t.forward) {
+    setSpeed(t.target, forward);
+  }
+}
@@ -0,0 +1,99 @@
+#ifndef HSC_MOTOR_H
+#define HSC_MOTOR_H
+
+#include "HSC_Base.h"
+#include <driver/mcpwm.h>
+#include <esp_timer.h>
+
+struct MotorTelemetry {
+  uint16_t target;   // Requested speed, 0-1000
+  uint16_t setpoint; // Ramped speed the controller is chasing
+  uint16_t measured; // Back-EMF speed, 0-1000
+  float duty;        // PWM duty, percent
+  bool forward;
+};
+
+// Closed-loop DC motor control for shuttle trains and turntables. An
+// H-bridge is driven from MCPWM at 20 kHz. Every control period a timer
+// lets the motor coast, waits for the inductive spike to settle, samples
+// the back-EMF on the ADC, runs the PID and re-enables the drive, so speed
+// regulation is independent of loop() and network load.
+//
+// Each motor terminal has its own divider to an ADC pin. The back-EMF is
+// the difference between them, so it reads the same in both directions
+// and a motor still turning either way is seen before reversing.
+//
+// Speeds are in thousandths of the back-EMF at full speed (see
+// setBemfFullScale()). Commands are accepted on
+// HSC/devices/{id}/motor/set and telemetry is published on
+// HSC/devices/{id}/motor.
+class HSC_Motor {
+public:
+  // Pins default (-1) to the board's PIN_MOTOR_IN1/IN2/BEMF/BEMF2
+  // (HSC_Board.h); bemfPin senses the IN1 terminal, bemf2Pin the IN2 one
+  HSC_Motor(HSC_Base &base, int in1Pin = -1, int in2Pin = -1,
+            int bemfPin = -1, int bemf2Pin = -1,
+            mcpwm_unit_t unit = MCPWM_UNIT_0);
+
+  // periodMs: control rate; settleUs: coast time before sampling
+  bool begin(uint16_t periodMs = 10, uint16_t settleUs = 800);
+  void loop();
+
+  // Ramped change to speed (0-1000); reversing ramps through zero first
+  void setSpeed(uint16_t speed, bool forward);
+  void stop() { setSpeed(0, telemetry.forward); }
+  void emergencyStop();
+
+  // Acceleration and deceleration in speed units per second
+  void setAcceleration(uint16_t accel, uint16_t decel);
+  void setGains(float kp, float ki, float kd);
+  // Difference of the two ADC readings at full speed
+  void setBemfFullScale(uint16_t adcCounts) { bemfFullScale = adcCounts; }
+
+  MotorTelemetry getTelemetry();
+
+private:
+  HSC_Base &base;
+  int in1Pin;
+  int in2Pin;
+  int bemfPin;
+  int bemf2Pin;
+  mcpwm_unit_t unit;
+  bool started = false;
+
+  esp_timer_handle_t controlTimer = nullptr;
+  esp_timer_handle_t sampleTimer = nullptr;
+  uint16_t periodMs = 10;
+  uint16_t settleUs = 800;
+
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+  // Shared with the timer callbacks, guarded by mux
+  MotorTelemetry telemetry = {};
+  bool targetForward = true;
+  bool estop = false;
+  float kp = 0.08f;
+  float ki = 0.6f;
+  float kd = 0.0f;
+  uint16_t accel = 500;
+  uint16_t decel = 800;
+
+  // Controller state, timer task only
+  bool driveForward = true;
+  float integral = 0;
+  float lastError = 0;
+  float rampedSetpoint = 0;
+  uint16_t bemfFullScale = 4095;
+
+  unsigned long lastTelemetry = 0;
+
+  static void onControl(void *arg);
+  static void onSample(void *arg);
+  void coast();
+  uint32_t readBemf(int pin);
+  void sampleAndControl();
+  void drive(float duty, bool forward);
+  void handleCommand(const uint8_t *payload, unsigned int length);
+  void publishTelemetry();
+};
+
+#endif
@@ -0,0 +1,755 @@
+#include "HSC_MqttBroker.h"
+#include "HSC_Stall.h"
+#include <StreamString.h>
+
+// Packets larger than this close the connection
+static const size_t BROKER_MAX_PACKET = 2048;
+// Per-client bytes waiting for the TCP send window
+static const size_t BROKER_QUEUE_BYTES = 4096;
+static const size_t BROKER_MAX_RETAINED = 256;
+// A new connection must send CONNECT within this time
+static const unsigned long BROKER_CONNECT_TIMEOUT_MS = 10000;
+static const unsigned long BROKER_METRICS_MS = 10000;
+
+// Packet types (upper nibble of the fixed header)
+static const uint8_t MQTT_CONNECT = 1;
+static const uint8_t MQTT_PUBLISH = 3;
+static const uint8_t MQTT_PUBACK = 4;
+static const uint8_t MQTT_SUBSCRIBE = 8;
+static const uint8_t MQTT_UNSUBSCRIBE = 10;
+static const uint8_t MQTT_PINGREQ = 12;
+static const uint8_t MQTT_DISCONNECT = 14;
+
+// Bounds-checked reader over one packet body
+struct PacketReader {
+  const uint8_t *p;
+  size_t len;
+  size_t pos;
+  bool ok;
+
+  PacketReader(const uint8_t *data, size_t n) : p(data), len(n), pos(0) {
+    ok = true;
+  }
+  size_t remaining() const { return len - pos; }
+  uint8_t byte() {
+    if (pos + 1 > len) {
+      ok = false;
+      return 0;
+    }
+    return p[pos++];
+  }
+  uint16_t u16() {
+    if (pos + 2 > len) {
+      ok = false;
+      return 0;
+    }
+    uint16_t v = (p[pos] << 8) | p[pos + 1];
+    pos += 2;
+    return v;
+  }
+  // Length-prefixed field; data points into the packet
+  bool field(const uint8_t *&data, size_t &n) {
+    n = u16();
+    if (!ok || pos + n > len) {
+      ok = false;
+      return false;
+    }
+    data = p + pos;
+    pos += n;
+    return true;
+  }
+  String str() {
+    const uint8_t *data;
+    size_t n;
+    String s;
+    if (field(data, n)) {
+      s.concat((const char *)data, n);
+    }
+    return s;
+  }
+};
+
+static void putLength(std::vector<uint8_t> &out, size_t len) {
+  do {
+    uint8_t b = len % 128;
+    len /= 128;
+    if (len > 0) {
+      b |= 0x80;
+    }
+    out.push_back(b);
+  } while (len > 0);
+}
+
+static void putString(std::vector<uint8_t> &out, const String &s) {
+  out.push_back(s.length() >> 8);
+  out.push_back(s.length() & 0xFF);
+  out.insert(out.end(), s.c_str(), s.c_str() + s.length());
+}
+
+static size_t publishSize(const String &topic, size_t len, uint8_t qos) {
+  // Fixed header is at most 5 bytes
+  return 5 + 2 + topic.length() + (qos > 0 ? 2 : 0) + len;
+}
+
+static void splitTopic(const String &topic, std::vector<String> &levels) {
+  int start = 0;
+  while (true) {
+    int slash = topic.indexOf('/', start);
+    if (slash < 0) {
+      levels.push_back(topic.substring(start));
+      return;
+    }
+    levels.push_back(topic.substring(start, slash));
+    start = slash + 1;
+  }
+}
+
+// + and # must fill a whole level, # only as the last one
+static bool validFilter(const String &filter) {
+  if (filter.length() == 0) {
+    return false;
+  }
+  std::vector<String> levels;
+  splitTopic(filter, levels);
+  for (size_t i = 0; i < levels.size(); i++) {
+    const String &l = levels[i];
+    if (l.indexOf('#') >= 0 && (l != "#" || i + 1 != levels.size())) {
+      return false;
+    }
+    if (l.indexOf('+') >= 0 && l != "+") {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool validTopic(const String &topic) {
+  return topic.length() > 0 && topic.indexOf('+') < 0 &&
+         topic.indexOf('#') < 0;
+}
+
+HSC_MqttBroker::HSC_MqttBroker(HSC_Base &base, uint16_t port,
+                               uint8_t maxClients)
+    : base(base), server(port), port(port), maxClients(maxClients) {}
+
+void HSC_MqttBroker::begin() {
+  server.onClient(
+      [](void *arg, AsyncClient *client) {
+        static_cast<HSC_MqttBroker *>(arg)->accept(client);
+      },
+      this);
+  server.setNoDelay(true);
+  server.begin();
+  base.getNetStats().labelLocalPort(port, "mqtt_broker");
+
+  base.registerJsonApi("/api/broker", [this](Print &out) { writeStats(out); });
+  HSC_LOG("MQTT broker on port %u, up to %u clients", port, maxClients);
+}
+
+void HSC_MqttBroker::loop() {
+  if (millis() - lastMetrics < BROKER_METRICS_MS) {
+    return;
+  }
+  lastMetrics = millis();
+  PubSubClient &mqtt = base.getMqttClient();
+  if (!mqtt.connected()) {
+    return;
+  }
+  StreamString json;
+  writeStats(json);
+  char topic[HSC_Base::TOPIC_MAX];
+  base.deviceTopic(topic, sizeof(topic), "broker");
+  mqtt.publish(topic, json.c_str());
+}
+
+void HSC_MqttBroker::writeStats(Print &out) {
+  MqttBrokerStats s = stats;
+  StaticJsonDocument<384> doc;
+  doc["clients"] = s.clients;
+  doc["peak_clients"] = s.peakClients;
+  doc["max_clients"] = maxClients;
+  doc["connects"] = s.connects;
+  doc["messages_in"] = s.messagesIn;
+  doc["messages_out"] = s.messagesOut;
+  doc["bytes_in"] = s.bytesIn;
+  doc["bytes_out"] = s.bytesOut;
+  doc["dropped"] = s.dropped;
+  doc["subscriptions"] = s.subscriptions;
+  doc["retained"] = s.retained;
+  doc["retained_rejected"] = s.retainedRejected;
+  serializeJson(doc, out);
+}
+
+// --- Connections ---
+
+void HSC_MqttBroker::accept(AsyncClient *client) {
+  if (sessions.size() >= maxClients) {
+    client->close(true);
+    delete client;
+    return;
+  }
+  Session *s = new Session();
+  s->broker = this;
+  s->client = client;
+  s->connected = false;
+  s->closing = false;
+  s->closeStarted = false;
+  s->keepAlive = 0;
+  s->lastRx = millis();
+  s->nextPacketId = 1;
+  s->replayPos = 0;
+  s->hasWill = false;
+  s->willQos = 0;
+  s->willRetain = false;
+  sessions.push_back(s);
+
+  client->setNoDelay(true);
+  client->onData(
+      [](void *arg, AsyncClient *, void *data, size_t len) {
+        Session *s = static_cast<Session *>(arg);
+        s->broker->onData(s, static_cast<const uint8_t *>(data), len);
+      },
+      s);
+  client->onAck(
+      [](void *arg, AsyncClient *, size_t, uint32_t) {
+        Session *s = static_cast<Session *>(arg);
+        s->broker->flush(s);
+      },
+      s);
+  client->onPoll(
+      [](void *arg, AsyncClient *) {
+        Session *s = static_cast<Session *>(arg);
+        s->broker->onPoll(s);
+      },
+      s);
+  client->onError(
+      [](void *, AsyncClient *client, int8_t) { client->close(true); }, s);
+  client->onTimeout(
+      [](void *, AsyncClient *client, uint32_t) { client->close(true); }, s);
+  client->onDisconnect(
+      [](void *arg, AsyncClient *) {
+        Session *s = static_cast<Session *>(arg);
+        s->broker->removeSession(s);
+      },
+      s);
+}
+
+void HSC_MqttBroker::removeSession(Session *s) {
+  for (size_t i = 0; i < sessions.size(); i++) {
+    if (sessions[i] == s) {
+      sessions.erase(sessions.begin() + i);
+      break;
+    }
+  }
+  for (const String &filter : s->filters) {
+    std::vector<String> levels;
+    splitTopic(filter, levels);
+    if (removeSubscriber(&root, levels, 0, s)) {
+      stats.subscriptions--;
+    }
+  }
+  if (s->connected) {
+    stats.clients--;
+  }
+  // Unexpected loss: publish the will once the session is gone
+  if (s->hasWill) {
+    stats.messagesIn++;
+    route(s->willTopic, s->willPayload.data(), s->willPayload.size(),
+          s->willQos, s->willRetain);
+  }
+  AsyncClient *client = s->client;
+  delete s;
+  delete client;
+  reap();
+}
+
+// Closes sessions marked by kick(). close() calls removeSession()
+// synchronously, so the list is searched again after every close.
+void HSC_MqttBroker::reap() {
+  while (true) {
+    Session *victim = nullptr;
+    for (Session *s : sessions) {
+      if (s->closing && !s->closeStarted) {
+        victim = s;
+        break;
+      }
+    }
+    if (victim == nullptr) {
+      return;
+    }
+    victim->closeStarted = true;
+    victim->client->close();
+  }
+}
+
+void HSC_MqttBroker::onPoll(Session *s) {
+  unsigned long idle = millis() - s->lastRx;
+  if (!s->connected && idle >= BROKER_CONNECT_TIMEOUT_MS) {
+    kick(s);
+  } else if (s->keepAlive > 0 && idle >= s->keepAlive * 1500UL) {
+    // 1.5 keepalive periods without a packet, as the spec allows
+    kick(s);
+  }
+  reap();
+}
+
+void HSC_MqttBroker::onData(Session *s, const uint8_t *data, size_t len) {
+  HSC_STALL_SPAN("mqtt_broker");
+  s->lastRx = millis();
+  stats.bytesIn += len;
+  if (s->closing) {
+    return;
+  }
+  s->rx.insert(s->rx.end(), data, data + len);
+
+  size_t consumed = 0;
+  while (!s->closing) {
+    const uint8_t *p = s->rx.data() + consumed;
+    size_t avail = s->rx.size() - consumed;
+    if (avail < 2) {
+      break;
+    }
+    // Remaining length: 1-4 bytes, 7 bits each
+    size_t bodyLen = 0;
+    size_t pos = 1;
+    bool complete = false;
+    while (pos < avail && pos <= 4) {
+      bodyLen |= (size_t)(p[pos] & 0x7F) << (7 * (pos - 1));
+      if (!(p[pos++] & 0x80)) {
+        complete = true;
+        break;
+      }
+    }
+    if (!complete) {
+      if (pos > 4) {
+        kick(s);
+      }
+      break;
+    }
+    if (bodyLen > BROKER_MAX_PACKET) {
+      kick(s);
+      break;
+    }
+    if (avail < pos + bodyLen) {
+      break;
+    }
+    handlePacket(s, p[0], p + pos, bodyLen);
+    consumed += pos + bodyLen;
+  }
+  s->rx.erase(s->rx.begin(), s->rx.begin() + consumed);
+  flush(s);
+  reap(); // May delete s
+}
+
+// --- Packets ---
+
+void HSC_MqttBroker::handlePacket(Session *s, uint8_t header,
+                                  const uint8_t *body, size_t len) {
+  uint8_t type = header >> 4;
+  if (!s->connected && type != MQTT_CONNECT) {
+    kick(s);
+    return;
+  }
+  switch (type) {
+  case MQTT_CONNECT:
+    if (s->connected) {
+      kick(s); // A second CONNECT is a protocol violation
+    } else {
+      handleConnect(s, body, len);
+    }
+    break;
+  case MQTT_PUBLISH:
+    handlePublish(s, header, body, len);
+    break;
+  case MQTT_PUBACK:
+    // Sessions are clean and nothing is retransmitted
+    break;
+  case MQTT_SUBSCRIBE:
+    handleSubscribe(s, body, len);
+    break;
+  case MQTT_UNSUBSCRIBE:
+    handleUnsubscribe(s, body, len);
+    break;
+  case MQTT_PINGREQ: {
+    const uint8_t pingresp[] = {0xD0, 0x00};
+    sendPacket(s, pingresp, sizeof(pingresp));
+    break;
+  }
+  case MQTT_DISCONNECT:
+    s->hasWill = false;
+    kick(s);
+    break;
+  default:
+    kick(s);
+    break;
+  }
+}
+
+void HSC_MqttBroker::handleConnect(Session *s, const uint8_t *body,
+                                   size_t len) {
+  PacketReader r(body, len);
+  String protocol = r.str();
+  uint8_t level = r.byte();
+  uint8_t flags = r.byte();
+  s->keepAlive = r.u16();
+  String clientId = r.str();
+  if (!r.ok) {
+    kick(s);
+    return;
+  }
+  // 3.1.1 ("MQTT", 4) and 3.1 ("MQIsdp", 3) framing are the same here
+  if (!((protocol == "MQTT" && level == 4) ||
+        (protocol == "MQIsdp" && level == 3))) {
+    const uint8_t refused[] = {0x20, 0x02, 0x00, 0x01};
+    sendPacket(s, refused, sizeof(refused));
+    kick(s);
+    return;
+  }
+  if (flags & 0x04) {
+    s->willTopic = r.str();
+    const uint8_t *payload;
+    size_t n;
+    if (r.field(payload, n)) {
+      s->willPayload.assign(payload, payload + n);
+    }
+    s->willQos = (flags >> 3) & 0x03;
+    s->willRetain = flags & 0x20;
+    if (!r.ok || s->willQos > 1 || !validTopic(s->willTopic)) {
+      kick(s);
+      return;
+    }
+  }
+  // Username and password are read past but not checked
+
+  if (clientId.length() == 0) {
+    clientId = "hsc-" + String((uint32_t)(uintptr_t)s, HEX);
+  }
+  // Takeover: a reconnecting client replaces its stale session
+  for (Session *other : sessions) {
+    if (other != s && other->connected && !other->closing &&
+        other->clientId == clientId) {
+      kick(other);
+    }
+  }
+  s->clientId = clientId;
+  s->hasWill = flags & 0x04;
+  s->connected = true;
+  stats.connects++;
+  stats.clients++;
+  if (stats.clients > stats.peakClients) {
+    stats.peakClients = stats.clients;
+  }
+  const uint8_t connack[] = {0x20, 0x02, 0x00, 0x00};
+  sendPacket(s, connack, sizeof(connack));
+}
+
+void HSC_MqttBroker::handlePublish(Session *s, uint8_t header,
+                                   const uint8_t *body, size_t len) {
+  uint8_t qos = (header >> 1) & 0x03;
+  bool retain = header & 0x01;
+  PacketReader r(body, len);
+  String topic = r.str();
+  uint16_t packetId = qos > 0 ? r.u16() : 0;
+  if (!r.ok || qos > 1 || !validTopic(topic)) {
+    kick(s);
+    return;
+  }
+  stats.messagesIn++;
+  route(topic, body + r.pos, r.remaining(), qos, retain);
+  if (qos == 1) {
+    const uint8_t puback[] = {0x40, 0x02, (uint8_t)(packetId >> 8),
+                              (uint8_t)(packetId & 0xFF)};
+    sendPacket(s, puback, sizeof(puback));
+  }
+}
+
+void HSC_MqttBroker::handleSubscribe(Session *s, const uint8_t *body,
+                                     size_t len) {
+  PacketReader r(body, len);
+  uint16_t packetId = r.u16();
+  std::vector<uint8_t> suback;
+  suback.push_back(0x90);
+  std::vector<uint8_t> codes;
+  std::vector<String> added;
+  std::vector<uint8_t> granted;
+  while (r.ok && r.remaining() > 0) {
+    String filter = r.str();
+    uint8_t qos = r.byte() & 0x03;
+    if (!r.ok) {
+      break;
+    }
+    if (!validFilter(filter)) {
+      codes.push_back(0x80);
+      continue;
+    }
+    qos = qos > 1 ? 1 : qos; // QoS 2 is granted as 1
+    subscribe(s, filter, qos);
+    codes.push_back(qos);
+    added.push_back(filter);
+    granted.push_back(qos);
+  }
+  if (!r.ok || codes.empty()) {
+    kick(s);
+    return;
+  }
+  putLength(suback, 2 + codes.size());
+  suback.push_back(packetId >> 8);
+  suback.push_back(packetId & 0xFF);
+  suback.insert(suback.end(), codes.begin(), codes.end());
+  sendPacket(s, suback.data(), suback.size());
+
+  // Retained messages follow the SUBACK, sent by flush() as the queue
+  // drains
+  for (size_t i = 0; i < added.size(); i++) {
+    const String &filter = added[i];
+    bool wildFirst = filter[0] == '+' || filter[0] == '#';
+    for (const auto &entry : retained) {
+      // Wildcards at the first level do not match $-topics
+      if (wildFirst && entry.first[0] == '$') {
+        continue;
+      }
+      if (HSC_Base::topicMatches(filter.c_str(), entry.first.c_str())) {
+        s->replay.push_back({entry.first, granted[i]});
+      }
+    }
+  }
+}
+
+void HSC_MqttBroker::handleUnsubscribe(Session *s, const uint8_t *body,
+                                       size_t len) {
+  PacketReader r(body, len);
+  uint16_t packetId = r.u16();
+  while (r.ok && r.remaining() > 0) {
+    String filter = r.str();
+    if (r.ok) {
+      unsubscribe(s, filter);
+    }
+  }
+  if (!r.ok) {
+    kick(s);
+    return;
+  }
+  const uint8_t unsuback[] = {0xB0, 0x02, (uint8_t)(packetId >> 8),
+                              (uint8_t)(packetId & 0xFF)};
+  sendPacket(s, unsuback, sizeof(unsuback));
+}
+
+// --- Routing ---
+
+void HSC_MqttBroker::route(const String &topic, const uint8_t *payload,
+                           size_t len, uint8_t qos, bool retain) {
+  if (retain) {
+    if (len == 0) {
+      retained.erase(topic);
+    } else {
+      auto it = retained.find(topic);
+      if (it == retained.end() && retained.size() >= BROKER_MAX_RETAINED) {
+        stats.retainedRejected++;
+      } else {
+        Retained &r = retained[topic];
+        r.payload.assign(payload, payload + len);
+        r.qos = qos;
+      }
+    }
+    stats.retained = retained.size();
+  }
+
+  std::vector<String> levels;
+  splitTopic(topic, levels);
+  std::vector<Subscriber> matches;
+  match(&root, levels, 0, matches);
+
+  // Overlapping subscriptions deliver once, at the highest granted QoS
+  std::vector<Subscriber> targets;
+  for (const Subscriber &m : matches) {
+    bool seen = false;
+    for (Subscriber &t : targets) {
+      if (t.session == m.session) {
+        t.qos = m.qos > t.qos ? m.qos : t.qos;
+        seen = true;
+        break;
+      }
+    }
+    if (!seen) {
+      targets.push_back(m);
+    }
+  }
+  for (const Subscriber &t : targets) {
+    if (!t.session->closing) {
+      deliver(t.session, topic, payload, len, qos < t.qos ? qos : t.qos,
+              false);
+      flush(t.session);
+    }
+  }
+}
+
+void HSC_MqttBroker::deliver(Session *s, const String &topic,
+                             const uint8_t *payload, size_t len, uint8_t qos,
+                             bool retain) {
+  size_t bodyLen = 2 + topic.length() + (qos > 0 ? 2 : 0) + len;
+  if (s->tx.size() + publishSize(topic, len, qos) > BROKER_QUEUE_BYTES) {
+    if (qos == 0) {
+      stats.dropped++;
+    } else {
+      // Losing a QoS 1 message silently would break its guarantee
+      kick(s);
+    }
+    return;
+  }
+  std::vector<uint8_t> &out = s->tx;
+  out.push_back((MQTT_PUBLISH << 4) | (qos << 1) | (retain ? 1 : 0));
+  putLength(out, bodyLen);
+  putString(out, topic);
+  if (qos > 0) {
+    uint16_t id = s->nextPacketId++;
+    if (s->nextPacketId == 0) {
+      s->nextPacketId = 1;
+    }
+    out.push_back(id >> 8);
+    out.push_back(id & 0xFF);
+  }
+  out.insert(out.end(), payload, payload + len);
+  stats.messagesOut++;
+}
+
+void HSC_MqttBroker::sendPacket(Session *s, const uint8_t *packet,
+                                size_t len) {
+  s->tx.insert(s->tx.end(), packet, packet + len);
+}
+
+void HSC_MqttBroker::flush(Session *s) {
+  if (s->closeStarted) {
+    return;
+  }
+  while (true) {
+    pumpReplay(s);
+    size_t space = s->client->space();
+    size_t n = s->tx.size() < space ? s->tx.size() : space;
+    if (n == 0) {
+      return; // Continued from onAck
+    }
+    s->client->add((const char *)s->tx.data(), n);
+    s->client->send();
+    stats.bytesOut += n;
+    s->tx.erase(s->tx.begin(), s->tx.begin() + n);
+    if (s->replayPos == s->replay.size()) {
+      return;
+    }
+  }
+}
+
+void HSC_MqttBroker::pumpReplay(Session *s) {
+  while (s->replayPos < s->replay.size()) {
+    const ReplayItem &item = s->replay[s->replayPos];
+    auto it = retained.find(item.topic);
+    if (it != retained.end()) {
+      const Retained &r = it->second;
+      uint8_t qos = r.qos < item.qos ? r.qos : item.qos;
+      size_t size = publishSize(item.topic, r.payload.size(), qos);
+      if (size > BROKER_QUEUE_BYTES) {
+        stats.dropped++; // Can never fit
+      } else if (s->tx.size() + size > BROKER_QUEUE_BYTES) {
+        return;
+      } else {
+        deliver(s, item.topic, r.payload.data(), r.payload.size(), qos,
+                true);
+      }
+    }
+    s->replayPos++;
+  }
+  s->replay.clear();
+  s->replayPos = 0;
+}
+
+// --- Topic trie ---
+
+bool HSC_MqttBroker::subscribe(Session *s, const String &filter,
+                               uint8_t qos) {
+  std::vector<String> levels;
+  splitTopic(filter, levels);
+  TopicNode *node = &root;
+  for (const String &level : levels) {
+    TopicNode *&child = node->children[level];
+    if (child == nullptr) {
+      child = new TopicNode();
+    }
+    node = child;
+  }
+  for (Subscriber &sub : node->subscribers) {
+    if (sub.session == s) {
+      sub.qos = qos; // Resubscribing replaces the QoS
+      return false;
+    }
+  }
+  node->subscribers.push_back({s, qos});
+  s->filters.push_back(filter);
+  stats.subscriptions++;
+  return true;
+}
+
+bool HSC_MqttBroker::unsubscribe(Session *s, const String &filter) {
+  for (size_t i = 0; i < s->filters.size(); i++) {
+    if (s->filters[i] == filter) {
+      s->filters.erase(s->filters.begin() + i);
+      std::vector<String> levels;
+      splitTopic(filter, levels);
+      if (removeSubscriber(&root, levels, 0, s)) {
+        stats.subscriptions--;
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns true if s was subscribed at this filter. Empty nodes below the
+// root are deleted on the way back up.
+bool HSC_MqttBroker::removeSubscriber(TopicNode *node,
+                                      const std::vector<String> &levels,
+                                      size_t depth, Session *s) {
+  if (depth == levels.size()) {
+    for (size_t i = 0; i < node->subscribers.size(); i++) {
+      if (node->subscribers[i].session == s) {
+        node->subscribers.erase(node->subscribers.begin() + i);
+        return true;
+      }
+    }
+    return false;
+  }
+  auto it = node->children.find(levels[depth]);
+  if (it == node->children.end()) {
+    return false;
+  }
+  TopicNode *child = it->second;
+  bool removed = removeSubscriber(child, levels, depth + 1, s);
+  if (child->subscribers.empty() && child->children.empty()) {
+    delete child;
+    node->children.erase(it);
+  }
+  return removed;
+}
+
+void HSC_MqttBroker::match(TopicNode *node, const std::vector<String> &levels,
+                           size_t depth, std::vector<Subscriber> &out) {
+  // Wildcards at the first level do not match $-topics
+  bool wild = depth > 0 || levels[0][0] != '$';
+  auto hash = node->children.find("#");
+  if (wild && hash != node->children.end()) {
+    // "a/#" also matches "a" itself
+    const std::vector<Subscriber> &subs = hash->second->subscribers;
+    out.insert(out.end(), subs.begin(), subs.end());
+  }
+  if (depth == levels.size()) {
+    out.insert(out.end(), node->subscribers.begin(),
+               node->subscribers.end());
+    return;
+  }
+  auto plus = node->children.find("+");
+  if (wild && plus != node->children.end()) {
+    match(plus->second, levels, depth + 1, out);
+  }
+  auto exact = node->children.find(levels[depth]);
+  if (exact != node->children.end()) {
+    match(exact->second, levels, depth + 1, out);
+  }
+}
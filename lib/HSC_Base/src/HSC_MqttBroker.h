@@ -0,0 +1,135 @@
+#ifndef HSC_MQTTBROKER_H
+#define HSC_MQTTBROKER_H
+
+#include "HSC_Base.h"
+#include <AsyncTCP.h>
+#include <map>
+#include <vector>
+
+struct MqttBrokerStats {
+  uint32_t connects;
+  uint32_t messagesIn;  // PUBLISH packets received, wills included
+  uint32_t messagesOut; // PUBLISH packets queued to subscribers
+  uint32_t bytesIn;
+  uint32_t bytesOut;
+  uint32_t dropped;          // QoS 0 deliveries dropped on a full queue
+  uint32_t retainedRejected; // New retained topics refused when full
+  uint16_t clients;
+  uint16_t peakClients;
+  uint16_t subscriptions;
+  uint16_t retained;
+};
+
+// Minimal MQTT 3.1.1 broker so a layout without a server can run from one
+// board: the other boards (and this one, via 127.0.0.1) use its IP as
+// their MQTT server. Supports QoS 0 and 1, retained messages, wills,
+// + and # wildcards (matched through a topic trie) and client takeover.
+// Sessions are always clean; QoS 2 is not supported.
+//
+// Everything runs in AsyncTCP callbacks. Each client has a bounded send
+// queue: QoS 0 messages are dropped when it is full, a client that cannot
+// keep up with QoS 1 is disconnected. Metrics are served on /api/broker
+// and published to HSC/devices/{id}/broker.
+class HSC_MqttBroker {
+public:
+  // Each client takes an lwIP TCP PCB; the Arduino build has 16 in total,
+  // shared with the web servers
+  HSC_MqttBroker(HSC_Base &base, uint16_t port = 1883,
+                 uint8_t maxClients = 12);
+
+  void begin();
+  void loop();
+
+  // Counters are updated on the async_tcp task; read them as a snapshot
+  MqttBrokerStats getStats() const { return stats; }
+
+private:
+  struct ReplayItem {
+    String topic;
+    uint8_t qos;
+  };
+
+  struct Session {
+    HSC_MqttBroker *broker;
+    AsyncClient *client;
+    std::vector<uint8_t> rx;
+    std::vector<uint8_t> tx; // Not yet accepted by the TCP stack
+    String clientId;
+    bool connected;     // CONNECT accepted
+    bool closing;       // Close from reap()
+    bool closeStarted;
+    uint16_t keepAlive; // Seconds, 0 for none
+    unsigned long lastRx;
+    uint16_t nextPacketId;
+    std::vector<String> filters;
+    // Retained topics still to send after a SUBSCRIBE, fed into tx as
+    // the queue drains so a large retained set never overflows it
+    std::vector<ReplayItem> replay;
+    size_t replayPos;
+
+    bool hasWill;
+    String willTopic;
+    std::vector<uint8_t> willPayload;
+    uint8_t willQos;
+    bool willRetain;
+  };
+
+  struct Subscriber {
+    Session *session;
+    uint8_t qos;
+  };
+
+  struct TopicNode {
+    std::map<String, TopicNode *> children;
+    std::vector<Subscriber> subscribers;
+  };
+
+  struct Retained {
+    std::vector<uint8_t> payload;
+    uint8_t qos;
+  };
+
+  HSC_Base &base;
+  AsyncServer server;
+  uint16_t port;
+  uint8_t maxClients;
+  std::vector<Session *> sessions;
+  TopicNode root;
+  std::map<String, Retained> retained;
+  MqttBrokerStats stats = {};
+  unsigned long lastMetrics = 0;
+
+  void accept(AsyncClient *client);
+  void onData(Session *s, const uint8_t *data, size_t len);
+  void onPoll(Session *s);
+  void removeSession(Session *s);
+  void kick(Session *s) { s->closing = true; }
+  void reap();
+
+  void handlePacket(Session *s, uint8_t header, const uint8_t *body,
+                    size_t len);
+  void handleConnect(Session *s, const uint8_t *body, size_t len);
+  void handlePublish(Session *s, uint8_t header, const uint8_t *body,
+                     size_t len);
+  void handleSubscribe(Session *s, const uint8_t *body, size_t len);
+  void handleUnsubscribe(Session *s, const uint8_t *body, size_t len);
+
+  void route(const String &topic, const uint8_t *payload, size_t len,
+             uint8_t qos, bool retain);
+  void deliver(Session *s, const String &topic, const uint8_t *payload,
+               size_t len, uint8_t qos, bool retain);
+  void sendPacket(Session *s, const uint8_t *packet, size_t len);
+  void flush(Session *s);
+  void pumpReplay(Session *s);
+
+  bool subscribe(Session *s, const String &filter, uint8_t qos);
+  bool unsubscribe(Session *s, const String &filter);
+  void match(TopicNode *node, const std::vector<String> &levels,
+             size_t depth, std::vector<Subscriber> &out);
+  bool removeSubscriber(TopicNode *node, const std::vector<String> &levels,
+                        size_t depth, Session *s);
+
+  void writeStats(Print &out);
+};
+
+#endif
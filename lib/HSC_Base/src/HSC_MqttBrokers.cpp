@@ -0,0 +1,280 @@
+#include "HSC_MqttBrokers.h"
+#include "HSC_Log.h"
+#include <lwip/dns.h>
+#include <lwip/priv/tcpip_priv.h>
+#include <lwip/sockets.h>
+
+// Wait between rounds once every broker has failed
+static const unsigned long MQTT_RETRY_MS = 5000;
+// One recorded failure is forgotten per interval
+static const unsigned long MQTT_FAILURE_DECAY_MS = 60000;
+static const uint32_t MQTT_FAILURE_WEIGHT = 1000;
+static const uint32_t MQTT_RANK_WEIGHT = 250;
+static const uint32_t MQTT_MAX_LATENCY = 5000;
+
+static const unsigned long MQTT_PROBE_INTERVAL_MS = 10000;
+static const unsigned long MQTT_PROBE_TIMEOUT_MS = 3000;
+// Consecutive successful probes before failing back
+static const uint8_t MQTT_FAILBACK_PROBES = 2;
+
+enum { LOOKUP_IDLE, LOOKUP_PENDING, LOOKUP_DONE, LOOKUP_FAILED };
+
+struct PrimaryLookup {
+  volatile uint8_t state = LOOKUP_IDLE;
+  volatile uint32_t addr = 0;
+};
+
+struct DnsStart {
+  struct tcpip_api_call_data call; // Must be first
+  const char *host;
+  PrimaryLookup *lookup;
+};
+
+// Runs on the lwIP thread, immediately or once the DNS server answers
+static void dnsFound(const char *name, const ip_addr_t *ip, void *arg) {
+  PrimaryLookup *lookup = (PrimaryLookup *)arg;
+  if (ip != NULL && IP_IS_V4(ip)) {
+    lookup->addr = ip4_addr_get_u32(ip_2_ip4(ip));
+    lookup->state = LOOKUP_DONE;
+  } else {
+    lookup->state = LOOKUP_FAILED;
+  }
+}
+
+// Runs on the lwIP thread; dns_gethostbyname() must not be called from
+// another task
+static err_t dnsStart(struct tcpip_api_call_data *call) {
+  DnsStart *start = (DnsStart *)call;
+  ip_addr_t ip;
+  err_t err = dns_gethostbyname(start->host, &ip, dnsFound, start->lookup);
+  if (err == ERR_OK) {
+    dnsFound(start->host, &ip, start->lookup); // Cached
+  } else if (err != ERR_INPROGRESS) {
+    dnsFound(start->host, NULL, start->lookup);
+  }
+  return ERR_OK;
+}
+
+HSC_MqttBrokers::~HSC_MqttBrokers() {
+  closeProbe();
+  // A lookup still pending is answered later into its struct; leak it
+  if (lookup != nullptr && lookup->state != LOOKUP_PENDING) {
+    delete lookup;
+  }
+}
+
+void HSC_MqttBrokers::add(const String &host, int port) {
+  brokers.push_back({host, port, 0, 0, 0, false});
+}
+
+uint8_t HSC_MqttBrokers::recentFailures(const Broker &b,
+                                        unsigned long now) const {
+  unsigned long forgotten = (now - b.lastFailure) / MQTT_FAILURE_DECAY_MS;
+  return forgotten >= b.failures ? 0 : b.failures - forgotten;
+}
+
+uint32_t HSC_MqttBrokers::score(int i, unsigned long now) const {
+  const Broker &b = brokers[i];
+  uint32_t latency =
+      b.latencyMs > MQTT_MAX_LATENCY ? MQTT_MAX_LATENCY : b.latencyMs;
+  return recentFailures(b, now) * MQTT_FAILURE_WEIGHT +
+         i * MQTT_RANK_WEIGHT + latency;
+}
+
+int HSC_MqttBrokers::next(unsigned long now) {
+  if (brokers.empty()) {
+    return -1;
+  }
+  if (waiting) {
+    if (now - roundFailedAt < MQTT_RETRY_MS) {
+      return -1;
+    }
+    waiting = false;
+    for (Broker &b : brokers) {
+      b.tried = false;
+    }
+  }
+  int best = forced;
+  forced = -1;
+  if (best < 0) {
+    for (size_t i = 0; i < brokers.size(); i++) {
+      if (!brokers[i].tried &&
+          (best < 0 || score(i, now) < score(best, now))) {
+        best = i;
+      }
+    }
+  }
+  if (best < 0) {
+    // Every broker was tried without failed() being called
+    waiting = true;
+    roundFailedAt = now;
+    return -1;
+  }
+  brokers[best].tried = true;
+  return best;
+}
+
+void HSC_MqttBrokers::connected(int i, uint32_t latencyMs) {
+  Broker &b = brokers[i];
+  // Smoothed, so one slow handshake does not reorder the list
+  b.latencyMs =
+      b.latencyMs == 0 ? latencyMs : (b.latencyMs * 3 + latencyMs) / 4;
+  b.failures = 0;
+  for (Broker &other : brokers) {
+    other.tried = false;
+  }
+  waiting = false;
+  if (i == 0) {
+    // Re-resolve the primary on the next failover
+    primaryResolved = false;
+    if (lookup != nullptr && lookup->state != LOOKUP_PENDING) {
+      lookup->state = LOOKUP_IDLE;
+    }
+  }
+}
+
+void HSC_MqttBrokers::failed(int i, unsigned long now) {
+  Broker &b = brokers[i];
+  b.failures = recentFailures(b, now) + 1;
+  if (b.failures > 10) {
+    b.failures = 10;
+  }
+  b.lastFailure = now;
+  b.tried = true;
+
+  for (const Broker &other : brokers) {
+    if (!other.tried) {
+      return;
+    }
+  }
+  waiting = true;
+  roundFailedAt = now;
+}
+
+bool HSC_MqttBrokers::failbackReady(int current, unsigned long now) {
+  if (current <= 0) {
+    closeProbe();
+    probeSuccesses = 0;
+    return false;
+  }
+  if (probeSocket < 0) {
+    // A pending lookup is polled every call, within the same probe
+    bool resolving = lookup != nullptr && lookup->state == LOOKUP_PENDING;
+    if (resolving || now - lastProbe >= MQTT_PROBE_INTERVAL_MS) {
+      if (!resolving) {
+        lastProbe = now;
+      }
+      int started = startProbe();
+      if (started > 0) {
+        probeStarted = now;
+      } else if (started < 0) {
+        probeSuccesses = 0;
+      }
+    }
+    return false;
+  }
+
+  int result = pollProbe(now);
+  if (result < 0) {
+    return false;
+  }
+  closeProbe();
+  if (result == 0) {
+    probeSuccesses = 0;
+    return false;
+  }
+  if (++probeSuccesses < MQTT_FAILBACK_PROBES) {
+    return false;
+  }
+  probeSuccesses = 0;
+  brokers[0].failures = 0;
+  forced = 0;
+  waiting = false;
+  return true;
+}
+
+// --- Failback probe ---
+
+// Resolved once per failover; an IP literal needs no lookup
+int HSC_MqttBrokers::resolvePrimary() {
+  if (primaryResolved) {
+    return 1;
+  }
+  const char *host = brokers[0].host.c_str();
+  if (primaryAddr.fromString(host)) {
+    primaryResolved = true;
+    return 1;
+  }
+  if (lookup == nullptr) {
+    lookup = new PrimaryLookup();
+  }
+  if (lookup->state == LOOKUP_IDLE) {
+    lookup->state = LOOKUP_PENDING;
+    DnsStart start = {};
+    start.host = host;
+    start.lookup = lookup;
+    tcpip_api_call(dnsStart, &start.call);
+  }
+  switch (lookup->state) {
+  case LOOKUP_PENDING:
+    return 0;
+  case LOOKUP_DONE:
+    primaryAddr = IPAddress((uint32_t)lookup->addr);
+    primaryResolved = true;
+    return 1;
+  default:
+    HSC_LOG("MQTT: Cannot resolve primary broker %s", host);
+    lookup->state = LOOKUP_IDLE; // Retried at the next probe
+    return -1;
+  }
+}
+
+int HSC_MqttBrokers::startProbe() {
+  int resolved = resolvePrimary();
+  if (resolved <= 0) {
+    return resolved;
+  }
+
+  const Broker &primary = brokers[0];
+  int s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (s < 0) {
+    return -1;
+  }
+  fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(primary.port);
+  addr.sin_addr.s_addr = (uint32_t)primaryAddr;
+  if (connect(s, (struct sockaddr *)&addr, sizeof(addr)) < 0 &&
+      errno != EINPROGRESS) {
+    close(s);
+    return -1;
+  }
+  probeSocket = s;
+  return 1;
+}
+
+int HSC_MqttBrokers::pollProbe(unsigned long now) {
+  fd_set writable;
+  FD_ZERO(&writable);
+  FD_SET(probeSocket, &writable);
+  struct timeval tv = {0, 0};
+  int n = select(probeSocket + 1, NULL, &writable, NULL, &tv);
+  if (n == 0) {
+    return now - probeStarted >= MQTT_PROBE_TIMEOUT_MS ? 0 : -1;
+  }
+  if (n < 0) {
+    return 0;
+  }
+  int err = 0;
+  socklen_t len = sizeof(err);
+  getsockopt(probeSocket, SOL_SOCKET, SO_ERROR, &err, &len);
+  return err == 0 ? 1 : 0;
+}
+
+void HSC_MqttBrokers::closeProbe() {
+  if (probeSocket >= 0) {
+    close(probeSocket);
+    probeSocket = -1;
+  }
+}
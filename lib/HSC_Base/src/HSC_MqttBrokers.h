@@ -0,0 +1,77 @@
+#ifndef HSC_MQTTBROKERS_H
+#define HSC_MQTTBROKERS_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <vector>
+
+// Ordered MQTT broker list with health-based selection. The first broker
+// is the primary. Each broker is scored from its recent connection
+// failures (forgotten over time), its connect latency and its rank; when a
+// connection is lost every broker is tried back to back, best score first,
+// before the normal retry interval applies.
+//
+// While connected to a fallback broker the primary is probed in the
+// background with a non-blocking TCP connect; once it answers repeatedly
+// failbackReady() tells the caller to move back to it. A primary given by
+// name is looked up asynchronously, so the probe never blocks loop().
+struct PrimaryLookup;
+
+class HSC_MqttBrokers {
+public:
+  ~HSC_MqttBrokers();
+
+  void add(const String &host, int port);
+  size_t count() const { return brokers.size(); }
+  const char *host(int i) const { return brokers[i].host.c_str(); }
+  int port(int i) const { return brokers[i].port; }
+
+  // Broker to try now, or -1 while waiting for the retry interval
+  int next(unsigned long now);
+  void connected(int i, uint32_t latencyMs);
+  // A connect attempt failed or an established connection was lost
+  void failed(int i, unsigned long now);
+
+  // Call from loop() while connected to broker current. Returns true when
+  // the primary has recovered; the caller disconnects and next() then
+  // returns the primary.
+  bool failbackReady(int current, unsigned long now);
+
+  // Lower is better
+  uint32_t score(int i, unsigned long now) const;
+  uint32_t getLatency(int i) const { return brokers[i].latencyMs; }
+
+private:
+  struct Broker {
+    String host;
+    int port;
+    uint32_t latencyMs;
+    uint8_t failures;
+    unsigned long lastFailure;
+    bool tried; // In the current round
+  };
+  std::vector<Broker> brokers;
+  bool waiting = false;
+  int forced = -1; // Returned by next() ahead of the scores
+  unsigned long roundFailedAt = 0;
+
+  // Failback probe of the primary
+  int probeSocket = -1;
+  unsigned long probeStarted = 0;
+  unsigned long lastProbe = 0;
+  uint8_t probeSuccesses = 0;
+  IPAddress primaryAddr;
+  bool primaryResolved = false;
+  PrimaryLookup *lookup = nullptr; // Written by the lwIP thread
+
+  uint8_t recentFailures(const Broker &b, unsigned long now) const;
+  // 1 connecting, 0 waiting for the primary's address, -1 failed
+  int startProbe();
+  // 1 resolved, 0 pending, -1 failed
+  int resolvePrimary();
+  // 1 reachable, 0 unreachable, -1 still pending
+  int pollProbe(unsigned long now);
+  void closeProbe();
+};
+
+#endif
@@ -0,0 +1,206 @@
+#include "HSC_NetStats.h"
+#include <ArduinoJson.h>
+#include <WiFi.h>
+#include <esp_wifi.h>
+#include <lwip/opt.h>
+#include <lwip/priv/tcp_priv.h>
+#include <lwip/priv/tcpip_priv.h>
+#include <lwip/stats.h>
+#include <lwip/tcp.h>
+
+static const uint8_t MAX_CONNECTIONS = 16;
+
+struct NetConnection {
+  uint8_t state;
+  uint16_t localPort;
+  uint16_t remotePort;
+  char remote[IPADDR_STRLEN_MAX];
+  uint16_t sendQueue; // Segments queued or unacknowledged
+  uint32_t sendBuffer;
+  uint32_t receiveWindow;
+  uint32_t rtoMs;
+  uint8_t retries; // Retransmissions of the oldest unacked segment
+};
+
+struct TcpWalk {
+  struct tcpip_api_call_data call; // Must be first
+  uint16_t active;
+  uint16_t timeWait;
+  uint16_t listen;
+  uint16_t retrying;
+  uint8_t count;
+  NetConnection connections[MAX_CONNECTIONS];
+};
+
+// Runs on the lwIP thread
+static err_t walkPcbs(struct tcpip_api_call_data *call) {
+  TcpWalk *walk = (TcpWalk *)call;
+  for (struct tcp_pcb *pcb = tcp_active_pcbs; pcb != NULL; pcb = pcb->next) {
+    walk->active++;
+    if (pcb->nrtx > 0) {
+      walk->retrying++;
+    }
+    if (walk->count >= MAX_CONNECTIONS) {
+      continue;
+    }
+    NetConnection &c = walk->connections[walk->count++];
+    c.state = pcb->state;
+    c.localPort = pcb->local_port;
+    c.remotePort = pcb->remote_port;
+    ipaddr_ntoa_r(&pcb->remote_ip, c.remote, sizeof(c.remote));
+    c.sendQueue = pcb->snd_queuelen;
+    c.sendBuffer = pcb->snd_buf;
+    c.receiveWindow = pcb->rcv_wnd;
+    c.rtoMs = (uint32_t)pcb->rto * TCP_SLOW_INTERVAL;
+    c.retries = pcb->nrtx;
+  }
+  for (struct tcp_pcb *pcb = tcp_tw_pcbs; pcb != NULL; pcb = pcb->next) {
+    walk->timeWait++;
+  }
+  for (struct tcp_pcb_listen *pcb = tcp_listen_pcbs.listen_pcbs; pcb != NULL;
+       pcb = pcb->next) {
+    walk->listen++;
+  }
+  return ERR_OK;
+}
+
+void HSC_NetStats::begin() {
+  WiFi.onEvent(
+      [this](WiFiEvent_t event, WiFiEventInfo_t info) {
+        wifiDisconnects = wifiDisconnects + 1;
+        lastDisconnectReason = info.wifi_sta_disconnected.reason;
+      },
+      ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+}
+
+void HSC_NetStats::labelLocalPort(uint16_t port, const char *name) {
+  Label label = {port, true, name};
+  labels.push_back(label);
+}
+
+void HSC_NetStats::labelRemotePort(uint16_t port, const char *name) {
+  Label label = {port, false, name};
+  labels.push_back(label);
+}
+
+const char *HSC_NetStats::labelFor(uint16_t localPort,
+                                   uint16_t remotePort) const {
+  for (const Label &l : labels) {
+    if (l.port == (l.local ? localPort : remotePort)) {
+      return l.name;
+    }
+  }
+  return nullptr;
+}
+
+#if LWIP_STATS && MEMP_STATS
+static void writePool(JsonObject pools, const char *name, int index) {
+  const struct stats_mem *mem = lwip_stats.memp[index];
+  if (mem == NULL) {
+    return;
+  }
+  JsonObject pool = pools.createNestedObject(name);
+  pool["used"] = mem->used;
+  pool["max"] = mem->max;
+  pool["avail"] = mem->avail;
+  pool["err"] = mem->err;
+}
+#endif
+
+void HSC_NetStats::write(Print &out, bool connections) {
+  TcpWalk walk = {};
+  tcpip_api_call(walkPcbs, &walk.call);
+
+  StaticJsonDocument<1024> doc;
+  JsonObject tcp = doc.createNestedObject("tcp");
+  tcp["active"] = walk.active;
+  tcp["time_wait"] = walk.timeWait;
+  tcp["listen"] = walk.listen;
+  tcp["pcb_max"] = MEMP_NUM_TCP_PCB;
+  tcp["retrying"] = walk.retrying;
+#if LWIP_STATS && TCP_STATS
+  tcp["xmit"] = lwip_stats.tcp.xmit;
+  tcp["recv"] = lwip_stats.tcp.recv;
+  tcp["drop"] = lwip_stats.tcp.drop;
+  tcp["chkerr"] = lwip_stats.tcp.chkerr;
+  tcp["memerr"] = lwip_stats.tcp.memerr;
+  tcp["proterr"] = lwip_stats.tcp.proterr;
+#endif
+#if LWIP_STATS && MIB2_STATS
+  tcp["retransmits"] = lwip_stats.mib2.tcpretranssegs;
+  tcp["in_errors"] = lwip_stats.mib2.tcpinerrs;
+  tcp["resets_sent"] = lwip_stats.mib2.tcpoutrsts;
+#endif
+  doc["lwip_stats"] = LWIP_STATS ? true : false;
+
+#if LWIP_STATS && MEMP_STATS
+  JsonObject pools = doc.createNestedObject("pools");
+  writePool(pools, "tcp_pcb", MEMP_TCP_PCB);
+  writePool(pools, "tcp_seg", MEMP_TCP_SEG);
+  writePool(pools, "pbuf", MEMP_PBUF);
+  writePool(pools, "pbuf_pool", MEMP_PBUF_POOL);
+#endif
+
+#if LWIP_STATS && LINK_STATS
+  JsonObject link = doc.createNestedObject("link");
+  link["xmit"] = lwip_stats.link.xmit;
+  link["recv"] = lwip_stats.link.recv;
+  link["drop"] = lwip_stats.link.drop;
+  link["memerr"] = lwip_stats.link.memerr;
+#endif
+
+  JsonObject wifi = doc.createNestedObject("wifi");
+  wifi["disconnects"] = wifiDisconnects;
+  wifi["last_reason"] = lastDisconnectReason;
+  wifi_ap_record_t ap;
+  if (WiFi.status() == WL_CONNECTED &&
+      esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+    wifi["rssi"] = ap.rssi;
+    wifi["channel"] = ap.primary;
+    wifi["phy"] = ap.phy_11n ? "11n" : ap.phy_11g ? "11g" : "11b";
+    wifi_bandwidth_t bandwidth;
+    if (esp_wifi_get_bandwidth(WIFI_IF_STA, &bandwidth) == ESP_OK) {
+      wifi["bandwidth_mhz"] = bandwidth == WIFI_BW_HT40 ? 40 : 20;
+    }
+  }
+  int8_t power;
+  if (esp_wifi_get_max_tx_power(&power) == ESP_OK) {
+    wifi["tx_power_dbm"] = power / 4.0; // In 0.25 dBm steps
+  }
+
+  if (!connections) {
+    serializeJson(doc, out);
+    return;
+  }
+
+  // The list is streamed after the summary rather than built in one
+  // document, which would need room for every connection at once
+  doc.createNestedArray("connections");
+  String summary;
+  serializeJson(doc, summary);
+  // Drop the empty array and closing brace to append the entries
+  summary.remove(summary.length() - 2);
+  out.print(summary);
+  for (uint8_t i = 0; i < walk.count; i++) {
+    const NetConnection &c = walk.connections[i];
+    StaticJsonDocument<320> entry;
+    const char *name = labelFor(c.localPort, c.remotePort);
+    if (name != nullptr) {
+      entry["label"] = name;
+    }
+    entry["state"] = tcp_debug_state_str((enum tcp_state)c.state);
+    entry["local_port"] = c.localPort;
+    entry["remote"] = c.remote;
+    entry["remote_port"] = c.remotePort;
+    entry["send_queue"] = c.sendQueue;
+    entry["send_buffer"] = c.sendBuffer;
+    entry["receive_window"] = c.receiveWindow;
+    entry["rto_ms"] = c.rtoMs;
+    entry["retries"] = c.retries;
+    if (i > 0) {
+      out.print(',');
+    }
+    serializeJson(entry, out);
+  }
+  out.print("]}");
+}
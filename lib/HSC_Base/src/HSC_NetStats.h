@@ -0,0 +1,38 @@
+#ifndef HSC_NETSTATS_H
+#define HSC_NETSTATS_H
+
+#include <Arduino.h>
+#include <vector>
+
+// Network stack counters as JSON: lwIP TCP counters and memory pools
+// (when the stack is built with LWIP_STATS), every TCP PCB with its state,
+// send queue and retransmission count, and the WiFi link. Connections are
+// named by the ports registered with labelLocalPort()/labelRemotePort().
+//
+// The PCB lists belong to the lwIP thread, so they are copied there
+// through tcpip_api_call() and serialized afterwards.
+class HSC_NetStats {
+public:
+  void begin();
+  // Connections accepted on a local port (servers)
+  void labelLocalPort(uint16_t port, const char *name);
+  // Connections made to a remote port (clients)
+  void labelRemotePort(uint16_t port, const char *name);
+
+  // connections=false leaves out the per-connection list
+  void write(Print &out, bool connections);
+
+private:
+  struct Label {
+    uint16_t port;
+    bool local;
+    const char *name;
+  };
+  std::vector<Label> labels;
+  volatile uint32_t wifiDisconnects = 0;
+  volatile uint8_t lastDisconnectReason = 0;
+
+  const char *labelFor(uint16_t localPort, uint16_t remotePort) const;
+};
+
+#endif
@@ -0,0 +1,250 @@
+#include "HSC_OtaUpload.h"
+#include "HSC_Log.h"
+#include "HSC_Stall.h"
+#include <ArduinoJson.h>
+#include <SPIFFS.h>
+#include <Update.h>
+
+// Progress is logged every this many bytes
+static const size_t OTA_LOG_INTERVAL = 256 * 1024;
+
+static bool parseHex(const String &hex, uint8_t *out, size_t len) {
+  if (hex.length() != len * 2) {
+    return false;
+  }
+  for (size_t i = 0; i < len * 2; i++) {
+    char c = hex[i];
+    uint8_t v;
+    if (c >= '0' && c <= '9') {
+      v = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      v = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      v = c - 'A' + 10;
+    } else {
+      return false;
+    }
+    out[i / 2] = (i % 2) ? (out[i / 2] | v) : (v << 4);
+  }
+  return true;
+}
+
+void HSC_OtaUpload::begin(AsyncWebServer &server, const char *uri,
+                          std::function<void()> handler) {
+  onSuccess = handler;
+  server.on(
+      uri, HTTP_POST,
+      [this](AsyncWebServerRequest *request) { respond(request); },
+      // multipart/form-data
+      [this](AsyncWebServerRequest *request, const String &filename,
+             size_t index, uint8_t *data, size_t len, bool final) {
+        if (index == 0 && !start(request, UPDATE_SIZE_UNKNOWN)) {
+          return;
+        }
+        if (request != owner) {
+          return;
+        }
+        write(data, len);
+        if (final) {
+          finish();
+        }
+      },
+      // application/octet-stream
+      [this](AsyncWebServerRequest *request, uint8_t *data, size_t len,
+             size_t index, size_t total) {
+        if (index == 0 && !start(request, total)) {
+          return;
+        }
+        if (request != owner) {
+          return;
+        }
+        write(data, len);
+        if (index + len == total) {
+          finish();
+        }
+      });
+}
+
+bool HSC_OtaUpload::start(AsyncWebServerRequest *request, size_t size) {
+  if (owner == request) {
+    fail("only one file per upload");
+    return false;
+  }
+  if (owner != nullptr) {
+    return false;
+  }
+  reset();
+  owner = request;
+  startMs = millis();
+
+  bool fs = request->hasParam("target") &&
+            request->getParam("target")->value() == "fs";
+  command = fs ? U_SPIFFS : U_FLASH;
+
+  // Drop the update if the browser goes away half way
+  request->onDisconnect([this, request]() {
+    if (owner == request) {
+      if (!finished) {
+        Update.abort();
+        HSC_LOG("OTA upload: client disconnected after %u bytes",
+                (unsigned)written);
+      }
+      reset();
+    }
+  });
+
+  // The partition is about to be overwritten; stop serving from it
+  if (fs) {
+    SPIFFS.end();
+    fsUnmounted = true;
+  }
+
+  if (!Update.begin(size, command)) {
+    fail(String("begin: ") + Update.errorString());
+    return true;
+  }
+  if (request->hasParam("md5")) {
+    if (!Update.setMD5(request->getParam("md5")->value().c_str())) {
+      fail("invalid md5");
+      return true;
+    }
+  }
+  if (request->hasParam("sha256")) {
+    if (!parseHex(request->getParam("sha256")->value(), expectedSha256,
+                  sizeof(expectedSha256))) {
+      fail("invalid sha256");
+      return true;
+    }
+    checkSha256 = true;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+  }
+  HSC_LOG("OTA upload: writing %s image", fs ? "filesystem" : "firmware");
+  return true;
+}
+
+void HSC_OtaUpload::write(uint8_t *data, size_t len) {
+  if (failed || len == 0) {
+    return;
+  }
+  // Flash erases happen here, a sector at a time
+  HSC_STALL_SPAN("ota_upload");
+  if (checkSha256) {
+    mbedtls_sha256_update(&sha, data, len);
+  }
+  if (Update.write(data, len) != len) {
+    fail(String("write: ") + Update.errorString());
+    return;
+  }
+  written += len;
+  if (written - lastLogged >= OTA_LOG_INTERVAL) {
+    lastLogged = written;
+    HSC_LOG("OTA upload: %u KB", (unsigned)(written / 1024));
+  }
+}
+
+void HSC_OtaUpload::finish() {
+  if (failed) {
+    return;
+  }
+  if (checkSha256) {
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    checkSha256 = false;
+    if (memcmp(digest, expectedSha256, sizeof(digest)) != 0) {
+      fail("sha256 mismatch");
+      return;
+    }
+  }
+  // Also verifies the MD5 if one was given
+  if (!Update.end(true)) {
+    fail(String("end: ") + Update.errorString());
+    return;
+  }
+  finished = true;
+  unsigned long elapsed = millis() - startMs;
+  HSC_LOG("OTA upload: %u bytes in %lu ms (%lu KB/s)", (unsigned)written,
+          elapsed, elapsed ? (unsigned long)(written / elapsed) : 0UL);
+}
+
+void HSC_OtaUpload::fail(const String &reason) {
+  if (failed) {
+    return;
+  }
+  failed = true;
+  error = reason;
+  if (checkSha256) {
+    mbedtls_sha256_free(&sha);
+    checkSha256 = false;
+  }
+  Update.abort();
+  HSC_LOG("OTA upload failed: %s", reason.c_str());
+  remountFs();
+}
+
+// After a filesystem upload, complete or not. A partly written image may
+// no longer mount; it is not formatted, so the next upload can replace it.
+void HSC_OtaUpload::remountFs() {
+  if (!fsUnmounted) {
+    return;
+  }
+  fsUnmounted = false;
+  if (!SPIFFS.begin(false)) {
+    HSC_LOG("OTA upload: filesystem does not mount, upload a complete image");
+  }
+}
+
+void HSC_OtaUpload::reset() {
+  remountFs();
+  if (checkSha256) {
+    mbedtls_sha256_free(&sha);
+    checkSha256 = false;
+  }
+  owner = nullptr;
+  written = 0;
+  lastLogged = 0;
+  failed = false;
+  finished = false;
+  error = "";
+}
+
+void HSC_OtaUpload::respond(AsyncWebServerRequest *request) {
+  if (request != owner) {
+    if (owner != nullptr) {
+      request->send(409, "application/json",
+                    "{\"status\":\"error\",\"message\":\"Another upload is "
+                    "in progress\"}");
+    } else {
+      request->send(400, "application/json",
+                    "{\"status\":\"error\",\"message\":\"No image "
+                    "received\"}");
+    }
+    return;
+  }
+
+  if (!finished) {
+    // Body ended before the image did
+    fail(failed ? error : String("incomplete upload"));
+    StaticJsonDocument<192> doc;
+    doc["status"] = "error";
+    doc["message"] = error;
+    String body;
+    serializeJson(doc, body);
+    request->send(400, "application/json", body);
+    reset();
+    return;
+  }
+
+  StaticJsonDocument<128> doc;
+  doc["status"] = "success";
+  doc["bytes"] = written;
+  doc["message"] = "Update written. Device will reboot...";
+  String body;
+  serializeJson(doc, body);
+  request->send(200, "application/json", body);
+  reset();
+  if (onSuccess) {
+    onSuccess();
+  }
+}
@@ -0,0 +1,52 @@
+#ifndef HSC_OTAUPLOAD_H
+#define HSC_OTAUPLOAD_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <functional>
+#include <mbedtls/sha256.h>
+
+// Browser-pushed firmware and filesystem updates. The image is written to
+// the inactive OTA partition (or the SPIFFS partition with ?target=fs) as
+// each chunk arrives from the TCP stack, so it is never held in RAM.
+// Accepts a multipart form upload or a raw application/octet-stream body.
+//
+// An expected hash can be given as ?md5=<32 hex> (checked by the Update
+// library) and/or ?sha256=<64 hex> (hashed chunk by chunk here); a
+// mismatch aborts the update and the running firmware stays active.
+class HSC_OtaUpload {
+public:
+  // onSuccess runs once a complete image has been verified and activated
+  void begin(AsyncWebServer &server, const char *uri,
+             std::function<void()> onSuccess);
+
+  bool inProgress() const { return owner != nullptr; }
+
+private:
+  std::function<void()> onSuccess;
+
+  // Only one upload at a time; other requests are refused
+  AsyncWebServerRequest *owner = nullptr;
+  int command = 0;
+  size_t written = 0;
+  size_t lastLogged = 0;
+  unsigned long startMs = 0;
+  bool failed = false;
+  bool finished = false;
+  bool fsUnmounted = false; // SPIFFS taken down for a ?target=fs upload
+  String error;
+
+  bool checkSha256 = false;
+  uint8_t expectedSha256[32];
+  mbedtls_sha256_context sha;
+
+  bool start(AsyncWebServerRequest *request, size_t size);
+  void write(uint8_t *data, size_t len);
+  void finish();
+  void fail(const String &reason);
+  void remountFs();
+  void reset();
+  void respond(AsyncWebServerRequest *request);
+};
+
+#endif
@@ -0,0 +1,246 @@
+#include "HSC_RfSurvey.h"
+#include <StreamString.h>
+#include <math.h>
+
+// Active scan dwell per channel; 13 channels take about 1.5 s, during
+// which the board is off its own channel between beacons
+static const uint32_t SCAN_DWELL_MS = 120;
+static const unsigned long SCAN_TIMEOUT_MS = 10000;
+static const uint8_t CHANNELS = 13;
+// 2.4 GHz channels 5 or more apart do not overlap
+static const int OVERLAP_SPAN = 5;
+
+static void formatBssid(char *out, const uint8_t *bssid) {
+  sprintf(out, "%02X:%02X:%02X:%02X:%02X:%02X", bssid[0], bssid[1],
+          bssid[2], bssid[3], bssid[4], bssid[5]);
+}
+
+HSC_RfSurvey::HSC_RfSurvey(HSC_Base &base, uint32_t intervalMs)
+    : base(base), intervalMs(intervalMs) {
+  memset(aps, 0, sizeof(aps));
+  linkSsid[0] = '\0';
+  memset(linkBssid, 0, sizeof(linkBssid));
+}
+
+void HSC_RfSurvey::begin() {
+  lock = xSemaphoreCreateMutex();
+  scheduleNext();
+
+  base.onMqtt(base.deviceTopic("rf/scan/set"),
+              [this](const char *, const uint8_t *, unsigned int) {
+                scan("mqtt");
+              });
+  base.onMqtt("HSC/rf/scan/set",
+              [this](const char *, const uint8_t *, unsigned int) {
+                scan("fleet");
+              });
+
+  base.registerJsonApi("/api/rf/scan", [this](Print &out) {
+    if (hasResult) {
+      writeResult(out);
+    } else {
+      out.print("{}");
+    }
+  });
+  base.registerApi("/api/rf/scan", HTTP_POST,
+                   [this](AsyncWebServerRequest *request) {
+                     if (scan("api")) {
+                       request->send(202, "application/json",
+                                     "{\"status\":\"scanning\"}");
+                     } else {
+                       request->send(409, "application/json",
+                                     "{\"status\":\"busy\"}");
+                     }
+                   });
+}
+
+bool HSC_RfSurvey::scan(const char *why) {
+  if (scanning || requested != nullptr) {
+    return false;
+  }
+  // Started from loop(), whichever task asked
+  requested = why;
+  return true;
+}
+
+void HSC_RfSurvey::scheduleNext() {
+  if (intervalMs > 0) {
+    nextScan = millis() + intervalMs + esp_random() % (intervalMs / 10 + 1);
+  }
+}
+
+void HSC_RfSurvey::loop() {
+  if (!scanning) {
+    const char *why = requested;
+    bool due = intervalMs > 0 && (long)(millis() - nextScan) >= 0;
+    if (why == nullptr && due) {
+      why = "schedule";
+      scheduleNext();
+    }
+    if (why == nullptr) {
+      return;
+    }
+    // Asynchronous, hidden networks included, active
+    int16_t rc = WiFi.scanNetworks(true, true, false, SCAN_DWELL_MS);
+    requested = nullptr;
+    if (rc == WIFI_SCAN_FAILED) {
+      HSC_LOG("RF scan could not start");
+      return;
+    }
+    scanning = true;
+    scanStarted = millis();
+    scanTrigger = why;
+    return;
+  }
+
+  int16_t count = WiFi.scanComplete();
+  if (count == WIFI_SCAN_RUNNING &&
+      millis() - scanStarted < SCAN_TIMEOUT_MS) {
+    return;
+  }
+  scanning = false;
+  if (count < 0) {
+    HSC_LOG("RF scan failed (%d)", count);
+    WiFi.scanDelete();
+    return;
+  }
+  collect(count);
+  WiFi.scanDelete();
+  HSC_LOG("RF scan: %d APs in %lu ms", count, (unsigned long)scanMs);
+  publish();
+}
+
+// Keeps the MAX_APS strongest of the scan results
+void HSC_RfSurvey::collect(int16_t count) {
+  xSemaphoreTake(lock, portMAX_DELAY);
+  scans++;
+  trigger = scanTrigger;
+  scanMs = millis() - scanStarted;
+  resultAt = millis();
+  visible = count;
+  apCount = 0;
+  for (int16_t i = 0; i < count; i++) {
+    int8_t rssi = WiFi.RSSI(i);
+    uint8_t slot = apCount;
+    if (apCount == MAX_APS) {
+      slot = 0;
+      for (uint8_t j = 1; j < apCount; j++) {
+        if (aps[j].rssi < aps[slot].rssi) {
+          slot = j;
+        }
+      }
+      if (aps[slot].rssi >= rssi) {
+        continue;
+      }
+    } else {
+      apCount++;
+    }
+    AccessPoint &ap = aps[slot];
+    strlcpy(ap.ssid, WiFi.SSID(i).c_str(), sizeof(ap.ssid));
+    memcpy(ap.bssid, WiFi.BSSID(i), sizeof(ap.bssid));
+    ap.rssi = rssi;
+    ap.channel = WiFi.channel(i);
+    ap.auth = WiFi.encryptionType(i);
+  }
+
+  linked = WiFi.status() == WL_CONNECTED;
+  if (linked) {
+    strlcpy(linkSsid, WiFi.SSID().c_str(), sizeof(linkSsid));
+    memcpy(linkBssid, WiFi.BSSID(), sizeof(linkBssid));
+    linkRssi = WiFi.RSSI();
+    linkChannel = WiFi.channel();
+  }
+  hasResult = true;
+  xSemaphoreGive(lock);
+}
+
+void HSC_RfSurvey::publish() {
+  PubSubClient &mqtt = base.getMqttClient();
+  if (!mqtt.connected()) {
+    return;
+  }
+  StreamString payload;
+  writeResult(payload);
+  // Larger than the client buffer, so streamed
+  char topic[HSC_Base::TOPIC_MAX];
+  base.deviceTopic(topic, sizeof(topic), "rf/scan");
+  if (mqtt.beginPublish(topic, payload.length(), true)) {
+    mqtt.write((const uint8_t *)payload.c_str(), payload.length());
+    mqtt.endPublish();
+  }
+}
+
+void HSC_RfSurvey::writeResult(Print &out) {
+  xSemaphoreTake(lock, portMAX_DELAY);
+  StaticJsonDocument<1536> doc;
+  char bssid[18];
+  doc["scan"] = scans;
+  doc["trigger"] = trigger;
+  doc["age_s"] = (millis() - resultAt) / 1000;
+  doc["scan_ms"] = scanMs;
+  doc["visible"] = visible;
+  if (linked) {
+    JsonObject link = doc.createNestedObject("link");
+    link["ssid"] = (const char *)linkSsid;
+    formatBssid(bssid, linkBssid);
+    link["bssid"] = bssid;
+    link["rssi"] = linkRssi;
+    link["channel"] = linkChannel;
+  }
+
+  // Congestion as this board hears it: APs on the channel, APs close
+  // enough to overlap, and their power summed in mW, each scaled down by
+  // the channel distance. The board's own AP is left out.
+  JsonArray channels = doc.createNestedArray("channels");
+  for (uint8_t ch = 1; ch <= CHANNELS; ch++) {
+    uint8_t on = 0;
+    uint8_t overlapping = 0;
+    float powerMw = 0;
+    for (uint8_t i = 0; i < apCount; i++) {
+      const AccessPoint &ap = aps[i];
+      if (linked && memcmp(ap.bssid, linkBssid, sizeof(linkBssid)) == 0) {
+        continue;
+      }
+      int distance = abs((int)ap.channel - ch);
+      if (distance >= OVERLAP_SPAN) {
+        continue;
+      }
+      if (distance == 0) {
+        on++;
+      }
+      overlapping++;
+      powerMw += powf(10, ap.rssi / 10.0f) *
+                 (1.0f - (float)distance / OVERLAP_SPAN);
+    }
+    JsonObject c = channels.createNestedObject();
+    c["channel"] = ch;
+    c["aps"] = on;
+    c["overlapping"] = overlapping;
+    if (powerMw > 0) {
+      c["interference_dbm"] = roundf(10 * log10f(powerMw) * 10) / 10;
+    }
+  }
+
+  // The AP list is streamed after the rest, as in HSC_NetStats
+  doc.createNestedArray("aps");
+  String head;
+  serializeJson(doc, head);
+  head.remove(head.length() - 2);
+  out.print(head);
+  for (uint8_t i = 0; i < apCount; i++) {
+    const AccessPoint &ap = aps[i];
+    StaticJsonDocument<192> entry;
+    entry["ssid"] = ap.ssid;
+    formatBssid(bssid, ap.bssid);
+    entry["bssid"] = bssid;
+    entry["channel"] = ap.channel;
+    entry["rssi"] = ap.rssi;
+    entry["open"] = ap.auth == WIFI_AUTH_OPEN;
+    if (i > 0) {
+      out.print(',');
+    }
+    serializeJson(entry, out);
+  }
+  out.print("]}");
+  xSemaphoreGive(lock);
+}
@@ -0,0 +1,71 @@
+#ifndef HSC_RFSURVEY_H
+#define HSC_RFSURVEY_H
+
+#include "HSC_Base.h"
+#include <freertos/semphr.h>
+
+// WiFi channel survey. Scans every 2.4 GHz channel with the non-blocking
+// WiFi.scanNetworks() and records the visible access points, this board's
+// own link, and the congestion on each channel: the number of APs on or
+// overlapping it and their summed signal power, weighted by how far apart
+// the channels are.
+//
+// Scans run every intervalMs (with up to 10% random delay so a fleet does
+// not leave its channel at once), on a message to
+// HSC/devices/{id}/rf/scan/set or to HSC/rf/scan/set for every board, or
+// on POST /api/rf/scan. The result is published retained to
+// HSC/devices/{id}/rf/scan and served on GET /api/rf/scan; rf_survey.py
+// builds a layout-wide report from them.
+class HSC_RfSurvey {
+public:
+  static const uint8_t MAX_APS = 32; // Strongest kept
+
+  // intervalMs 0 scans on request only
+  explicit HSC_RfSurvey(HSC_Base &base, uint32_t intervalMs = 3600000);
+
+  void begin();
+  void loop();
+
+  // Request a scan, from any task; false if one is already running
+  bool scan(const char *trigger);
+
+private:
+  struct AccessPoint {
+    char ssid[33];
+    uint8_t bssid[6];
+    int8_t rssi;
+    uint8_t channel;
+    uint8_t auth;
+  };
+
+  HSC_Base &base;
+  uint32_t intervalMs;
+  unsigned long nextScan = 0;
+  bool scanning = false;
+  const char *volatile requested = nullptr;
+  unsigned long scanStarted = 0;
+  const char *scanTrigger = "";
+  uint32_t scans = 0;
+
+  // Last result, guarded by lock against /api/rf/scan on async_tcp
+  SemaphoreHandle_t lock = nullptr;
+  bool hasResult = false;
+  unsigned long resultAt = 0;
+  const char *trigger = "";
+  uint32_t scanMs = 0;
+  AccessPoint aps[MAX_APS];
+  uint8_t apCount = 0;
+  uint16_t visible = 0; // Including those beyond MAX_APS
+  bool linked = false;
+  char linkSsid[33];
+  uint8_t linkBssid[6];
+  int8_t linkRssi = 0;
+  uint8_t linkChannel = 0;
+
+  void scheduleNext();
+  void collect(int16_t count);
+  void publish();
+  void writeResult(Print &out);
+};
+
+#endif
@@ -0,0 +1,152 @@
+#include "HSC_SpeedTrap.h"
+#include <esp_timer.h>
+
+HSC_SpeedTrap::HSC_SpeedTrap(HSC_Base &base)
+    : base(base), head(0), tail(0), overflows(0) {
+  memset(sensors, 0, sizeof(sensors));
+  memset(pairs, 0, sizeof(pairs));
+}
+
+int HSC_SpeedTrap::sensorFor(int pin) {
+  for (uint8_t i = 0; i < sensorCount; i++) {
+    if (sensors[i].pin == pin) {
+      return i;
+    }
+  }
+  if (sensorCount >= MAX_SENSORS) {
+    return -1;
+  }
+  Sensor &s = sensors[sensorCount];
+  s.owner = this;
+  s.pin = pin;
+  s.index = sensorCount;
+  return sensorCount++;
+}
+
+int HSC_SpeedTrap::addPair(int pinA, int pinB, uint32_t distanceMm) {
+  if (started || pairCount >= MAX_PAIRS || pinA == pinB || distanceMm == 0) {
+    return -1;
+  }
+  int a = sensorFor(pinA);
+  int b = sensorFor(pinB);
+  if (a < 0 || b < 0) {
+    return -1;
+  }
+  Pair &p = pairs[pairCount];
+  p.sensorA = a;
+  p.sensorB = b;
+  p.distanceMm = distanceMm;
+  p.firstSensor = -1;
+  return pairCount++;
+}
+
+bool HSC_SpeedTrap::begin(bool activeLow, uint16_t layoutScale) {
+  scale = layoutScale;
+  for (uint8_t i = 0; i < sensorCount; i++) {
+    pinMode(sensors[i].pin, activeLow ? INPUT_PULLUP : INPUT);
+    attachInterruptArg(sensors[i].pin, onEdge, &sensors[i],
+                       activeLow ? FALLING : RISING);
+  }
+  started = true;
+  HSC_LOG("Speed trap: %u pairs, %u sensors", pairCount, sensorCount);
+  return true;
+}
+
+// GPIO interrupts are dispatched one at a time from a single ISR on one
+// core, so this is the queue's only producer
+void IRAM_ATTR HSC_SpeedTrap::onEdge(void *arg) {
+  Sensor *sensor = static_cast<Sensor *>(arg);
+  HSC_SpeedTrap *self = sensor->owner;
+  int64_t now = esp_timer_get_time();
+
+  uint32_t h = self->head.load(std::memory_order_relaxed);
+  if (h - self->tail.load(std::memory_order_acquire) >= QUEUE_LEN) {
+    self->overflows.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  CaptureEvent &e = self->queue[h % QUEUE_LEN];
+  e.timeUs = now;
+  e.sensor = sensor->index;
+  self->head.store(h + 1, std::memory_order_release);
+}
+
+void HSC_SpeedTrap::loop() {
+  if (!started) {
+    return;
+  }
+  uint32_t t = tail.load(std::memory_order_relaxed);
+  uint32_t h = head.load(std::memory_order_acquire);
+  while (t != h) {
+    CaptureEvent event = queue[t % QUEUE_LEN];
+    tail.store(++t, std::memory_order_release);
+    stats.events++;
+    if (eventHandler) {
+      eventHandler(event);
+    }
+    handleEvent(event);
+  }
+  stats.overflows = overflows.load(std::memory_order_relaxed);
+
+  // Give up on measurements whose second sensor never triggered
+  int64_t now = esp_timer_get_time();
+  for (uint8_t i = 0; i < pairCount; i++) {
+    Pair &p = pairs[i];
+    if (p.firstSensor >= 0 && now - p.startUs > timeoutUs) {
+      p.firstSensor = -1;
+      stats.timeouts++;
+    }
+  }
+}
+
+void HSC_SpeedTrap::handleEvent(const CaptureEvent &event) {
+  for (uint8_t i = 0; i < pairCount; i++) {
+    Pair &p = pairs[i];
+    if (event.sensor != p.sensorA && event.sensor != p.sensorB) {
+      continue;
+    }
+    if (event.timeUs < p.holdoffUntilUs) {
+      continue; // Later axles of the train just measured
+    }
+    if (p.firstSensor < 0) {
+      p.firstSensor = event.sensor;
+      p.startUs = event.timeUs;
+    } else if (p.firstSensor != event.sensor) {
+      int64_t elapsedUs = event.timeUs - p.startUs;
+      publish(i, p, p.firstSensor == p.sensorA, elapsedUs);
+      stats.measurements++;
+      p.firstSensor = -1;
+      p.holdoffUntilUs = event.timeUs + holdoffUs;
+    }
+  }
+}
+
+void HSC_SpeedTrap::publish(uint8_t index, const Pair &pair, bool forward,
+                            int64_t elapsedUs) {
+  if (elapsedUs <= 0) {
+    return;
+  }
+  float mmPerSec = pair.distanceMm * 1e6f / elapsedUs;
+  HSC_LOG("Speed trap %u: %.1f mm/s %s (%ld us)", index, mmPerSec,
+          forward ? "A->B" : "B->A", (long)elapsedUs);
+
+  PubSubClient &mqtt = base.getMqttClient();
+  if (!mqtt.connected()) {
+    return;
+  }
+  StaticJsonDocument<192> doc;
+  doc["direction"] = forward ? "AB" : "BA";
+  doc["elapsed_us"] = (uint32_t)elapsedUs;
+  doc["mm_per_s"] = roundf(mmPerSec * 10) / 10;
+  if (scale > 0) {
+    // mm/s at layout scale -> full-size km/h
+    float kmh = mmPerSec * scale * 3.6f / 1000.0f;
+    doc["scale_kmh"] = roundf(kmh * 10) / 10;
+  }
+  char buf[192];
+  serializeJson(doc, buf);
+  char suffix[24];
+  snprintf(suffix, sizeof(suffix), "speedtrap/%u", index);
+  char topic[HSC_Base::TOPIC_MAX];
+  base.deviceTopic(topic, sizeof(topic), suffix);
+  mqtt.publish(topic, buf);
+}
@@ -0,0 +1,101 @@
+#ifndef HSC_SPEEDTRAP_H
+#define HSC_SPEEDTRAP_H
+
+#include "HSC_Base.h"
+#include <atomic>
+
+struct CaptureEvent {
+  int64_t timeUs; // esp_timer time of the edge
+  uint8_t sensor;
+};
+
+struct SpeedTrapStats {
+  uint32_t events;
+  uint32_t overflows; // Events lost because loop() fell behind
+  uint32_t measurements;
+  uint32_t timeouts;  // First sensor triggered but the second never did
+};
+
+// Speed measurement between pairs of track sensors. Sensor edges are
+// timestamped in the GPIO interrupt with the 64-bit esp_timer and passed
+// to loop() through a lock-free single-producer queue, so the measured
+// time is accurate to a few microseconds however late loop() runs.
+//
+// For each pair the first sensor to trigger starts the measurement and
+// the other one ends it; results are published on
+// HSC/devices/{id}/speedtrap/{n}.
+class HSC_SpeedTrap {
+public:
+  static const uint8_t MAX_SENSORS = 16;
+  static const uint8_t MAX_PAIRS = 8;
+
+  typedef std::function<void(const CaptureEvent &event)> EventHandler;
+
+  explicit HSC_SpeedTrap(HSC_Base &base);
+
+  // Add a sensor pair distanceMm apart before begin(); pins may be shared
+  // between pairs. Returns the pair index or -1.
+  int addPair(int pinA, int pinB, uint32_t distanceMm);
+
+  // activeLow: sensors pull the line low when occupied (the usual opto
+  // or reed wiring). scale: layout scale (87 for HO) used to report scale
+  // km/h, 0 to omit.
+  bool begin(bool activeLow = true, uint16_t scale = 87);
+  void loop();
+
+  // Every captured edge, before pair processing
+  void onEvent(EventHandler handler) { eventHandler = handler; }
+
+  // How long a pair waits for its second sensor, and ignores further
+  // edges after a measurement (the rest of the train)
+  void setTimeout(uint32_t ms) { timeoutUs = (int64_t)ms * 1000; }
+  void setHoldoff(uint32_t ms) { holdoffUs = (int64_t)ms * 1000; }
+
+  const SpeedTrapStats &getStats() const { return stats; }
+
+private:
+  static const uint8_t QUEUE_LEN = 64; // Power of two
+
+  struct Sensor {
+    HSC_SpeedTrap *owner;
+    int pin;
+    uint8_t index;
+  };
+
+  struct Pair {
+    uint8_t sensorA;
+    uint8_t sensorB;
+    uint32_t distanceMm;
+    int8_t firstSensor; // Sensor that started the measurement, -1 if idle
+    int64_t startUs;
+    int64_t holdoffUntilUs;
+  };
+
+  HSC_Base &base;
+  Sensor sensors[MAX_SENSORS];
+  uint8_t sensorCount = 0;
+  Pair pairs[MAX_PAIRS];
+  uint8_t pairCount = 0;
+  uint16_t scale = 0;
+  int64_t timeoutUs = 10000000;
+  int64_t holdoffUs = 3000000;
+  bool started = false;
+
+  // Written by the ISR (head) and loop() (tail) only
+  CaptureEvent queue[QUEUE_LEN];
+  std::atomic<uint32_t> head;
+  std::atomic<uint32_t> tail;
+  std::atomic<uint32_t> overflows;
+
+  EventHandler eventHandler;
+  SpeedTrapStats stats = {};
+
+  int sensorFor(int pin);
+  void handleEvent(const CaptureEvent &event);
+  void publish(uint8_t index, const Pair &pair, bool forward,
+               int64_t elapsedUs);
+
+  static void IRAM_ATTR onEdge(void *arg);
+};
+
+#endif
@@ -0,0 +1,315 @@
+#include "HSC_Stall.h"
+#include "HSC_Log.h"
+#include <ArduinoJson.h>
+#include <esp_attr.h>
+#include <esp_debug_helpers.h>
+#include <esp_ipc.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#if __has_include(<freertos/task_snapshot.h>)
+#include <freertos/task_snapshot.h>
+#endif
+#if CONFIG_IDF_TARGET_ARCH_XTENSA
+#include <freertos/xtensa_context.h>
+#endif
+
+static const uint32_t STALL_MAGIC = 0x5354414C;
+static const uint32_t CHECK_INTERVAL_MS = 100;
+static const uint8_t MAX_TASKS = 4;
+// Above async_tcp (3) and the loop task (1), below lwIP and WiFi
+static const UBaseType_t WATCH_PRIORITY = 5;
+
+struct Watched {
+  TaskHandle_t task;
+  bool heartbeat;             // Loop task: timed from beat to beat
+  volatile uint32_t since;    // Last beat, or entry to the outermost span
+  volatile uint8_t depth;     // Open spans
+  const char *volatile span;  // Innermost open span
+  volatile uint32_t allowMs;  // Raised limits of the open spans, 0 if none
+  bool captured;              // This stall has been recorded
+  bool restarting;
+  uint32_t capturedSince;
+};
+
+static Watched watched[MAX_TASKS];
+static volatile uint8_t watchedCount = 0;
+static Watched *loopSlot = nullptr;
+static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t budget = 0;
+static uint32_t restartLimit = 0;
+static TaskHandle_t watchTask = nullptr;
+
+// Survives esp_restart(), not a power cycle
+static RTC_NOINIT_ATTR StallRecord record;
+
+static uint32_t checksum(const StallRecord &r) {
+  const uint8_t *p = (const uint8_t *)&r;
+  uint32_t sum = 0x811C9DC5;
+  for (size_t i = 0; i < offsetof(StallRecord, checksum); i++) {
+    sum = (sum ^ p[i]) * 16777619;
+  }
+  return sum;
+}
+
+static bool recordValid() {
+  return record.magic == STALL_MAGIC && record.checksum == checksum(record);
+}
+
+static Watched *slotFor(TaskHandle_t task, bool create) {
+  uint8_t count = watchedCount;
+  for (uint8_t i = 0; i < count; i++) {
+    if (watched[i].task == task) {
+      return &watched[i];
+    }
+  }
+  if (!create) {
+    return nullptr;
+  }
+  Watched *w = nullptr;
+  portENTER_CRITICAL(&mux);
+  if (watchedCount < MAX_TASKS) {
+    w = &watched[watchedCount];
+    memset(w, 0, sizeof(*w));
+    w->task = task;
+    // Published last so the watcher never sees a half set up slot
+    watchedCount = watchedCount + 1;
+  }
+  portEXIT_CRITICAL(&mux);
+  return w;
+}
+
+// --- Backtrace ---
+
+struct Capture {
+  Watched *w;
+  StallRecord *out;
+};
+
+#if CONFIG_IDF_TARGET_ARCH_XTENSA
+// Return addresses carry the call window size in the top two bits and
+// point past the 3-byte call instruction
+static uint32_t callSite(uint32_t pc) {
+  if (pc & 0x80000000) {
+    pc = (pc & 0x3FFFFFFF) | 0x40000000;
+  }
+  return pc - 3;
+}
+#endif
+
+static void captureTask(void *arg) {
+  Capture *c = (Capture *)arg;
+  c->out->depth = 0;
+#if CONFIG_IDF_TARGET_ARCH_XTENSA
+  TaskSnapshot_t snapshot;
+  vTaskGetSnapshot(c->w->task, &snapshot);
+  // A task that blocked or yielded saved a solicited frame, one that was
+  // preempted a full exception frame
+  esp_backtrace_frame_t frame = {};
+  const XtExcFrame *exc = (const XtExcFrame *)snapshot.pxTopOfStack;
+  if (exc->exit == 0) {
+    const XtSolFrame *sol = (const XtSolFrame *)snapshot.pxTopOfStack;
+    frame.pc = sol->pc;
+    frame.sp = sol->a1;
+    frame.next_pc = sol->a0;
+  } else {
+    frame.pc = exc->pc;
+    frame.sp = exc->a1;
+    frame.next_pc = exc->a0;
+  }
+  c->out->pc[0] = frame.pc;
+  c->out->sp[0] = frame.sp;
+  c->out->depth = 1;
+  while (c->out->depth < STALL_MAX_FRAMES && frame.next_pc != 0 &&
+         esp_backtrace_get_next_frame(&frame)) {
+    c->out->pc[c->out->depth] = callSite(frame.pc);
+    c->out->sp[c->out->depth] = frame.sp;
+    c->out->depth++;
+  }
+#endif
+}
+
+static void capture(Watched &w, uint32_t now, uint32_t elapsed,
+                    bool restart) {
+  StallRecord r = {};
+  Capture c = {&w, &r};
+#if portNUM_PROCESSORS > 1
+  // A task running on the other core only saves its registers when it is
+  // switched out; the IPC task preempts it for the length of the capture.
+  // On this core the watcher itself is running, so nothing else is.
+  esp_ipc_call_blocking(xPortGetCoreID() ? 0 : 1, captureTask, &c);
+#else
+  captureTask(&c);
+#endif
+
+  strlcpy(r.task, pcTaskGetName(w.task), sizeof(r.task));
+  const char *span = w.span;
+  strlcpy(r.span, span ? span : "", sizeof(r.span));
+  r.stalledMs = elapsed;
+  r.uptimeMs = now;
+  r.restarted = restart;
+  r.magic = STALL_MAGIC;
+
+  portENTER_CRITICAL(&mux);
+  bool valid = recordValid();
+  r.sequence = valid ? record.sequence : 0;
+  // The restart capture of a stall already recorded is not a new stall
+  if (!(restart && w.captured)) {
+    r.sequence++;
+  }
+  r.checksum = checksum(r);
+  record = r;
+  portEXIT_CRITICAL(&mux);
+}
+
+// --- Watcher ---
+
+void HSC_Stall::begin(uint32_t budgetMs, uint32_t restartMs) {
+  budget = budgetMs;
+  restartLimit = restartMs;
+  if (!recordValid()) {
+    memset(&record, 0, sizeof(record));
+  } else if (record.restarted && !record.reported) {
+    HSC_LOG("Restarted after %s stalled %u ms in '%s'", record.task,
+            record.stalledMs, record.span);
+  }
+  if (watchTask == nullptr) {
+    xTaskCreatePinnedToCore(watch, "hsc_stall", 3072, nullptr,
+                            WATCH_PRIORITY, &watchTask, 0);
+  }
+}
+
+void HSC_Stall::watch(void *arg) {
+  TickType_t wake = xTaskGetTickCount();
+  for (;;) {
+    vTaskDelayUntil(&wake, pdMS_TO_TICKS(CHECK_INTERVAL_MS));
+    check(millis());
+  }
+}
+
+void HSC_Stall::check(uint32_t now) {
+  uint8_t count = watchedCount;
+  for (uint8_t i = 0; i < count; i++) {
+    Watched &w = watched[i];
+    if (!w.heartbeat && w.depth == 0) {
+      continue;
+    }
+    uint32_t since = w.since;
+    uint32_t elapsed = now - since;
+    if (w.captured && w.capturedSince != since) {
+      w.captured = false; // Moved on since the last capture
+    }
+    uint32_t allow = w.allowMs;
+    uint32_t soft = allow > budget ? allow : budget;
+    uint32_t hard = allow > restartLimit ? allow : restartLimit;
+    if ((int32_t)elapsed < 0 || elapsed < soft) {
+      continue;
+    }
+    if (restartLimit > 0 && elapsed >= hard && !w.restarting) {
+      w.restarting = true;
+      capture(w, now, elapsed, true);
+      esp_restart();
+    }
+    if (!w.captured) {
+      capture(w, now, elapsed, false);
+      w.captured = true;
+      w.capturedSince = since;
+    }
+  }
+}
+
+void HSC_Stall::beat() {
+  if (loopSlot == nullptr) {
+    loopSlot = slotFor(xTaskGetCurrentTaskHandle(), true);
+    if (loopSlot == nullptr) {
+      return;
+    }
+    loopSlot->since = millis();
+    loopSlot->heartbeat = true;
+  }
+  loopSlot->since = millis();
+}
+
+// --- Spans ---
+
+const char *HSC_Stall::enter(const char *name, uint32_t allowMs) {
+  Watched *w = slotFor(xTaskGetCurrentTaskHandle(), true);
+  if (w == nullptr) {
+    return nullptr;
+  }
+  const char *previous = w->span;
+  if (w->depth == 0 && !w->heartbeat) {
+    w->since = millis();
+  }
+  if (allowMs > w->allowMs) {
+    w->allowMs = allowMs;
+  }
+  w->span = name;
+  w->depth = w->depth + 1;
+  return previous;
+}
+
+void HSC_Stall::leave(const char *previous) {
+  Watched *w = slotFor(xTaskGetCurrentTaskHandle(), false);
+  if (w == nullptr || w->depth == 0) {
+    return;
+  }
+  w->depth = w->depth - 1;
+  w->span = previous;
+  if (w->depth == 0) {
+    w->allowMs = 0;
+  }
+}
+
+// --- Record ---
+
+bool HSC_Stall::pending() {
+  portENTER_CRITICAL(&mux);
+  bool result = recordValid() && !record.reported;
+  portEXIT_CRITICAL(&mux);
+  return result;
+}
+
+void HSC_Stall::markReported() {
+  portENTER_CRITICAL(&mux);
+  if (recordValid()) {
+    record.reported = true;
+    record.checksum = checksum(record);
+  }
+  portEXIT_CRITICAL(&mux);
+}
+
+bool HSC_Stall::last(StallRecord &out) {
+  portENTER_CRITICAL(&mux);
+  bool valid = recordValid();
+  if (valid) {
+    out = record;
+  }
+  portEXIT_CRITICAL(&mux);
+  return valid;
+}
+
+void HSC_Stall::writeRecord(Print &out, const StallRecord &r) {
+  // Same PC:SP pairs as the panic handler prints, for addr2line or the
+  // exception decoder
+  char backtrace[STALL_MAX_FRAMES * 22 + 1];
+  size_t len = 0;
+  backtrace[0] = '\0';
+  for (uint8_t i = 0; i < r.depth && i < STALL_MAX_FRAMES; i++) {
+    len += snprintf(backtrace + len, sizeof(backtrace) - len,
+                    "%s0x%08x:0x%08x", i ? " " : "", (unsigned)r.pc[i],
+                    (unsigned)r.sp[i]);
+    if (len >= sizeof(backtrace)) {
+      break;
+    }
+  }
+
+  StaticJsonDocument<768> doc;
+  doc["sequence"] = r.sequence;
+  doc["task"] = r.task;
+  doc["span"] = r.span;
+  doc["stalled_ms"] = r.stalledMs;
+  doc["uptime_ms"] = r.uptimeMs;
+  doc["restarted"] = r.restarted;
+  doc["backtrace"] = backtrace;
+  serializeJson(doc, out);
+}
@@ -0,0 +1,77 @@
+#ifndef HSC_STALL_H
+#define HSC_STALL_H
+
+#include <Arduino.h>
+
+// Names the work a task is doing so a stall report says where it was stuck.
+// Spans nest; on any task other than the loop task the outermost span also
+// starts the stall timer, so handlers on async_tcp are timed from entry.
+#define HSC_STALL_CONCAT2(a, b) a##b
+#define HSC_STALL_CONCAT(a, b) HSC_STALL_CONCAT2(a, b)
+#define HSC_STALL_SPAN(name)                                                   \
+  HSC_StallSpan HSC_STALL_CONCAT(_stallSpan, __LINE__)(name)
+
+static const uint8_t STALL_MAX_FRAMES = 16;
+
+// Last stall, kept in RTC memory across the restart it may have caused
+struct StallRecord {
+  uint32_t magic;
+  uint32_t sequence; // Stalls recorded since power-on
+  char task[16];
+  char span[24];
+  uint32_t stalledMs; // At the time of capture
+  uint32_t uptimeMs;
+  bool restarted; // The hard limit was crossed
+  bool reported;  // Published over MQTT
+  uint8_t depth;
+  uint32_t pc[STALL_MAX_FRAMES];
+  uint32_t sp[STALL_MAX_FRAMES];
+  uint32_t checksum;
+};
+
+// Watchdog for the loop task and for tasks running handlers in spans. The
+// loop task is due to call beat() at least every budgetMs, a span on any
+// other task must end within budgetMs. When one is late its backtrace and
+// span are captured once into the StallRecord and HSC_Base publishes it;
+// the task is left alone. Only past restartMs is the board restarted, and
+// the record is then published after the reboot.
+//
+// The check runs on its own task on core 0 every 100 ms. On dual-core
+// chips the other core is interrupted briefly through esp_ipc so a task
+// spinning there has its registers saved before they are read.
+class HSC_Stall {
+public:
+  static void begin(uint32_t budgetMs, uint32_t restartMs);
+  // Call from every pass of the loop task
+  static void beat();
+
+  // Record not yet published, if any; mark it with markReported()
+  static bool pending();
+  static void markReported();
+  static bool last(StallRecord &out);
+  static void writeRecord(Print &out, const StallRecord &record);
+
+  // Used by HSC_StallSpan
+  static const char *enter(const char *name, uint32_t allowMs);
+  static void leave(const char *previous);
+
+private:
+  static void watch(void *arg);
+  static void check(uint32_t now);
+};
+
+class HSC_StallSpan {
+public:
+  // allowMs raises the budget and the hard limit while the span is open,
+  // for work that blocks by design such as an OTA download
+  explicit HSC_StallSpan(const char *name, uint32_t allowMs = 0)
+      : previous(HSC_Stall::enter(name, allowMs)) {}
+  ~HSC_StallSpan() { HSC_Stall::leave(previous); }
+
+private:
+  const char *previous;
+  HSC_StallSpan(const HSC_StallSpan &);
+  HSC_StallSpan &operator=(const HSC_StallSpan &);
+};
+
+#endif
@@ -0,0 +1,258 @@
+#include "HSC_Store.h"
+#include "HSC_Log.h"
+
+// Lifetime NVS write counter, kept in the store's own namespace
+static const char STORE_WRITES_KEY[] = "_writes";
+static const size_t STORE_MAX_KEY = 15;
+
+bool HSC_Store::begin(const char *ns, uint32_t interval) {
+  commitIntervalMs = interval;
+  if (!prefs.begin(ns, false)) {
+    HSC_LOG("Store: cannot open NVS namespace %s", ns);
+    return false;
+  }
+  started = true;
+  stats.lifetimeWrites = prefs.getUInt(STORE_WRITES_KEY, 0);
+  return true;
+}
+
+bool HSC_Store::loop() {
+  if (!hasDirty || millis() - firstDirty < commitIntervalMs) {
+    return false;
+  }
+  uint32_t before = stats.writes;
+  commit();
+  return stats.writes != before;
+}
+
+void HSC_Store::commit() {
+  hasDirty = false;
+  if (!started) {
+    return;
+  }
+  uint32_t written = 0;
+  for (Entry &e : entries) {
+    if (!e.dirty) {
+      continue;
+    }
+    e.dirty = false;
+    size_t ok = 1;
+    if (e.removed) {
+      prefs.remove(e.key);
+    } else {
+      switch (e.type) {
+      case STORE_BOOL:
+        ok = prefs.putBool(e.key, e.value.b);
+        break;
+      case STORE_INT:
+        ok = prefs.putInt(e.key, e.value.i);
+        break;
+      case STORE_UINT:
+        ok = prefs.putUInt(e.key, e.value.u);
+        break;
+      case STORE_FLOAT:
+        ok = prefs.putFloat(e.key, e.value.f);
+        break;
+      case STORE_STRING:
+        ok = prefs.putString(e.key, e.str);
+        break;
+      default:
+        break;
+      }
+    }
+    if (ok == 0) {
+      HSC_LOG("Store: writing %s failed", e.key);
+    }
+    written++;
+  }
+  stats.dirty = 0;
+  if (written == 0) {
+    return;
+  }
+  stats.lifetimeWrites += written + 1; // Including the counter itself
+  prefs.putUInt(STORE_WRITES_KEY, stats.lifetimeWrites);
+  stats.writes += written + 1;
+  stats.commits++;
+}
+
+StoreStats HSC_Store::getStats() {
+  StoreStats s = stats;
+  s.entries = 0;
+  for (const Entry &e : entries) {
+    if (e.type != STORE_NONE && !e.removed) {
+      s.entries++;
+    }
+  }
+  s.freeEntries = started ? prefs.freeEntries() : 0;
+  return s;
+}
+
+// --- Cache ---
+
+HSC_Store::Entry *HSC_Store::find(const char *key) {
+  for (Entry &e : entries) {
+    if (strcmp(e.key, key) == 0) {
+      return &e;
+    }
+  }
+  return nullptr;
+}
+
+// Returns the cached entry if it holds a value of this type, reading it
+// from NVS on first use. Misses are cached too.
+HSC_Store::Entry *HSC_Store::load(const char *key, EntryType type) {
+  Entry *e = find(key);
+  if (e == nullptr) {
+    if (!started || strlen(key) > STORE_MAX_KEY) {
+      return nullptr;
+    }
+    entries.push_back(Entry());
+    e = &entries.back();
+    strcpy(e->key, key);
+    e->type = STORE_NONE;
+    e->dirty = false;
+    e->removed = false;
+    e->value.u = 0;
+
+    switch (prefs.getType(key)) {
+    case PT_U8:
+      e->type = STORE_BOOL;
+      e->value.b = prefs.getBool(key);
+      break;
+    case PT_I32:
+      e->type = STORE_INT;
+      e->value.i = prefs.getInt(key);
+      break;
+    case PT_U32:
+      e->type = STORE_UINT;
+      e->value.u = prefs.getUInt(key);
+      break;
+    case PT_BLOB:
+      e->type = STORE_FLOAT;
+      e->value.f = prefs.getFloat(key);
+      break;
+    case PT_STR:
+      e->type = STORE_STRING;
+      e->str = prefs.getString(key);
+      break;
+    default:
+      break;
+    }
+  }
+  return e->type == type && !e->removed ? e : nullptr;
+}
+
+// Entry to hold a new value for key, or nullptr if the key is invalid
+HSC_Store::Entry *HSC_Store::prepare(const char *key, EntryType type) {
+  load(key, type);
+  Entry *e = find(key);
+  if (e == nullptr) {
+    HSC_LOG("Store: invalid key %s", key);
+  }
+  return e;
+}
+
+void HSC_Store::markDirty(Entry *e) {
+  if (!e->dirty) {
+    e->dirty = true;
+    stats.dirty++;
+  }
+  if (!hasDirty) {
+    hasDirty = true;
+    firstDirty = millis();
+  }
+}
+
+// --- Typed access ---
+
+bool HSC_Store::getBool(const char *key, bool def) {
+  Entry *e = load(key, STORE_BOOL);
+  return e ? e->value.b : def;
+}
+
+int32_t HSC_Store::getInt(const char *key, int32_t def) {
+  Entry *e = load(key, STORE_INT);
+  return e ? e->value.i : def;
+}
+
+uint32_t HSC_Store::getUInt(const char *key, uint32_t def) {
+  Entry *e = load(key, STORE_UINT);
+  return e ? e->value.u : def;
+}
+
+float HSC_Store::getFloat(const char *key, float def) {
+  Entry *e = load(key, STORE_FLOAT);
+  return e ? e->value.f : def;
+}
+
+String HSC_Store::getString(const char *key, const String &def) {
+  Entry *e = load(key, STORE_STRING);
+  return e ? e->str : def;
+}
+
+bool HSC_Store::contains(const char *key) {
+  load(key, STORE_NONE);
+  Entry *e = find(key);
+  return e && e->type != STORE_NONE && !e->removed;
+}
+
+void HSC_Store::setBool(const char *key, bool value) {
+  Entry *e = prepare(key, STORE_BOOL);
+  if (e && (e->type != STORE_BOOL || e->removed || e->value.b != value)) {
+    e->type = STORE_BOOL;
+    e->removed = false;
+    e->value.b = value;
+    markDirty(e);
+  }
+}
+
+void HSC_Store::setInt(const char *key, int32_t value) {
+  Entry *e = prepare(key, STORE_INT);
+  if (e && (e->type != STORE_INT || e->removed || e->value.i != value)) {
+    e->type = STORE_INT;
+    e->removed = false;
+    e->value.i = value;
+    markDirty(e);
+  }
+}
+
+void HSC_Store::setUInt(const char *key, uint32_t value) {
+  Entry *e = prepare(key, STORE_UINT);
+  if (e && (e->type != STORE_UINT || e->removed || e->value.u != value)) {
+    e->type = STORE_UINT;
+    e->removed = false;
+    e->value.u = value;
+    markDirty(e);
+  }
+}
+
+void HSC_Store::setFloat(const char *key, float value) {
+  Entry *e = prepare(key, STORE_FLOAT);
+  if (e && (e->type != STORE_FLOAT || e->removed || e->value.f != value)) {
+    e->type = STORE_FLOAT;
+    e->removed = false;
+    e->value.f = value;
+    markDirty(e);
+  }
+}
+
+void HSC_Store::setString(const char *key, const String &value) {
+  Entry *e = prepare(key, STORE_STRING);
+  if (e && (e->type != STORE_STRING || e->removed || e->str != value)) {
+    e->type = STORE_STRING;
+    e->removed = false;
+    e->str = value;
+    markDirty(e);
+  }
+}
+
+void HSC_Store::remove(const char *key) {
+  load(key, STORE_NONE);
+  Entry *e = find(key);
+  if (e == nullptr || e->type == STORE_NONE || e->removed) {
+    return;
+  }
+  e->removed = true;
+  e->str = String();
+  markDirty(e);
+}
@@ -0,0 +1,92 @@
+#ifndef HSC_STORE_H
+#define HSC_STORE_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <vector>
+
+struct StoreStats {
+  uint32_t writes;         // NVS writes since boot
+  uint32_t commits;        // Commits since boot that wrote something
+  uint32_t lifetimeWrites; // NVS writes over the life of the board
+  uint16_t entries;
+  uint16_t dirty;
+  size_t freeEntries; // Free NVS entries in the partition
+};
+
+// Application key-value store for state that changes at runtime (turnout
+// positions, counters), kept apart from the Config settings in its own
+// NVS namespace. Values live in a RAM cache: a set() only updates RAM,
+// and dirty keys are written to NVS together once commitIntervalMs has
+// passed since the first change, or on commit(), which HSC_Base calls
+// before every planned reboot. However often a key changes between
+// commits it costs one flash write, and setting the value it already
+// holds costs none.
+//
+// Keys are typed: a get with a different type than the key was stored
+// with returns the default. Keys are at most 15 characters (the NVS
+// limit); prefix them with the module name to keep them apart. Use from
+// the loop task only.
+class HSC_Store {
+public:
+  bool begin(const char *ns = "app", uint32_t commitIntervalMs = 10000);
+  // Returns true if a commit wrote to NVS
+  bool loop();
+  // Write all dirty keys now
+  void commit();
+
+  bool getBool(const char *key, bool def = false);
+  int32_t getInt(const char *key, int32_t def = 0);
+  uint32_t getUInt(const char *key, uint32_t def = 0);
+  float getFloat(const char *key, float def = 0);
+  String getString(const char *key, const String &def = String());
+  bool contains(const char *key);
+
+  void setBool(const char *key, bool value);
+  void setInt(const char *key, int32_t value);
+  void setUInt(const char *key, uint32_t value);
+  void setFloat(const char *key, float value);
+  void setString(const char *key, const String &value);
+  void remove(const char *key);
+
+  StoreStats getStats();
+
+private:
+  enum EntryType : uint8_t {
+    STORE_NONE,
+    STORE_BOOL,
+    STORE_INT,
+    STORE_UINT,
+    STORE_FLOAT,
+    STORE_STRING
+  };
+
+  struct Entry {
+    char key[16];
+    EntryType type;
+    bool dirty;
+    bool removed; // Delete from NVS on commit
+    union {
+      bool b;
+      int32_t i;
+      uint32_t u;
+      float f;
+    } value;
+    String str;
+  };
+
+  Preferences prefs;
+  bool started = false;
+  std::vector<Entry> entries;
+  uint32_t commitIntervalMs = 10000;
+  unsigned long firstDirty = 0;
+  bool hasDirty = false;
+  StoreStats stats = {};
+
+  Entry *find(const char *key);
+  Entry *load(const char *key, EntryType type);
+  Entry *prepare(const char *key, EntryType type);
+  void markDirty(Entry *e);
+};
+
+#endif
@@ -0,0 +1,252 @@
+#include "HSC_Turnouts.h"
+
+static const uint32_t SERVO_FREQ_HZ = 50;
+static const uint8_t SERVO_RESOLUTION_BITS = 16;
+static const uint32_t SERVO_PERIOD_US = 1000000 / SERVO_FREQ_HZ;
+
+static const uint32_t STEP_INTERVAL_MS = 5;
+static const uint16_t RELEASE_AFTER_TICKS = 500 / STEP_INTERVAL_MS;
+
+// Positions live in the application store, which coalesces the flash
+// writes of a ladder of turnouts thrown together
+static const char STORE_KEY[] = "to_thrown";
+
+HSC_Turnouts::HSC_Turnouts(HSC_Base &base) : base(base) {
+  memset(turnouts, 0, sizeof(turnouts));
+}
+
+int HSC_Turnouts::add(int pin, uint16_t closedUs, uint16_t thrownUs,
+                      uint16_t travelMs, TurnoutProfile profile) {
+  TurnoutConfig config = {pin, closedUs, thrownUs, travelMs, profile, true};
+  return add(config);
+}
+
+int HSC_Turnouts::add(const TurnoutConfig &config) {
+  if (started || turnoutCount >= MAX_TURNOUTS ||
+      config.closedUs == config.thrownUs) {
+    return -1;
+  }
+  turnouts[turnoutCount].config = config;
+  return turnoutCount++;
+}
+
+bool HSC_Turnouts::begin() {
+  uint32_t persistedMask = base.getStore().getUInt(STORE_KEY, 0);
+
+  // Start at the stored positions without moving
+  for (uint8_t i = 0; i < turnoutCount; i++) {
+    Turnout &t = turnouts[i];
+    ledcSetup(i, SERVO_FREQ_HZ, SERVO_RESOLUTION_BITS);
+    ledcAttachPin(t.config.pin, i);
+    t.thrown = (persistedMask >> i) & 1;
+    t.toUs = t.thrown ? t.config.thrownUs : t.config.closedUs;
+    t.fromUs = t.toUs;
+    writePulse(i, t.toUs);
+    t.active = true;
+    t.changed = true;
+  }
+
+  base.onMqtt(base.deviceTopic("turnout/+/set"),
+              [this](const char *topic, const uint8_t *payload,
+                     unsigned int length) {
+                handleCommand(topic, payload, length);
+              });
+
+  esp_timer_create_args_t timerArgs = {};
+  timerArgs.callback = onStep;
+  timerArgs.arg = this;
+  timerArgs.name = "turnouts";
+  if (esp_timer_create(&timerArgs, &stepTimer) != ESP_OK ||
+      esp_timer_start_periodic(stepTimer, STEP_INTERVAL_MS * 1000) != ESP_OK) {
+    HSC_LOG("Turnouts: timer setup failed");
+    return false;
+  }
+
+  started = true;
+  HSC_LOG("Turnouts: %u servos", turnoutCount);
+  return true;
+}
+
+bool HSC_Turnouts::set(uint8_t index, bool thrown) {
+  if (!started || index >= turnoutCount) {
+    return false;
+  }
+  Turnout &t = turnouts[index];
+  const TurnoutConfig &c = t.config;
+
+  portENTER_CRITICAL(&mux);
+  if (t.thrown == thrown && t.active) {
+    portEXIT_CRITICAL(&mux);
+    return true;
+  }
+  // Reversals start from wherever the servo is now, and a partial move
+  // takes proportionally less time
+  t.fromUs = t.moving ? t.currentUs : t.toUs;
+  t.toUs = thrown ? c.thrownUs : c.closedUs;
+  uint32_t span = abs((int)c.thrownUs - (int)c.closedUs);
+  uint32_t distance = abs((int)t.toUs - (int)t.fromUs);
+  t.durationTicks = (uint32_t)c.travelMs * distance / span / STEP_INTERVAL_MS;
+  if (t.durationTicks == 0) {
+    t.durationTicks = 1;
+  }
+  t.elapsedTicks = 0;
+  t.thrown = thrown;
+  t.moving = true;
+  t.active = true;
+  t.changed = true;
+  portEXIT_CRITICAL(&mux);
+  return true;
+}
+
+bool HSC_Turnouts::toggle(uint8_t index) {
+  return index < turnoutCount && set(index, !turnouts[index].thrown);
+}
+
+bool HSC_Turnouts::isThrown(uint8_t index) const {
+  return index < turnoutCount && turnouts[index].thrown;
+}
+
+bool HSC_Turnouts::isMoving(uint8_t index) const {
+  return index < turnoutCount && turnouts[index].moving;
+}
+
+void HSC_Turnouts::onStep(void *arg) {
+  static_cast<HSC_Turnouts *>(arg)->step();
+}
+
+void HSC_Turnouts::step() {
+  for (uint8_t i = 0; i < turnoutCount; i++) {
+    Turnout &t = turnouts[i];
+    portENTER_CRITICAL(&mux);
+    if (t.moving) {
+      t.elapsedTicks++;
+      uint16_t us;
+      if (t.elapsedTicks >= t.durationTicks) {
+        us = t.toUs;
+        t.moving = false;
+        t.idleTicks = 0;
+        t.changed = true;
+      } else {
+        uint32_t progress = (t.elapsedTicks << 16) / t.durationTicks;
+        int32_t delta = (int32_t)t.toUs - (int32_t)t.fromUs;
+        us = t.fromUs +
+             (int32_t)(((int64_t)delta *
+                        profilePosition(t.config.profile, progress)) >>
+                       16);
+      }
+      portEXIT_CRITICAL(&mux);
+      writePulse(i, us);
+    } else if (t.active && t.config.releaseWhenIdle &&
+               ++t.idleTicks >= RELEASE_AFTER_TICKS) {
+      t.active = false;
+      portEXIT_CRITICAL(&mux);
+      ledcWrite(i, 0);
+    } else {
+      portEXIT_CRITICAL(&mux);
+    }
+  }
+}
+
+// Fraction of the move completed (Q16) after fraction t (Q16) of its time
+uint16_t HSC_Turnouts::profilePosition(TurnoutProfile profile, uint32_t t) {
+  if (t >= 65536) {
+    return 65535;
+  }
+  uint32_t p;
+  switch (profile) {
+  case PROFILE_EASE: {
+    // 3t^2 - 2t^3
+    uint32_t t2 = (t * t) >> 16;
+    uint32_t t3 = (t2 * t) >> 16;
+    p = 3 * t2 - 2 * t3;
+    break;
+  }
+  case PROFILE_TRAPEZOID:
+    // Accelerate for t < 1/4, cruise at 4/3, decelerate for t > 3/4
+    if (t < 16384) {
+      p = ((t * t) >> 16) * 8 / 3;
+    } else if (t <= 49152) {
+      p = (t - 8192) * 4 / 3;
+    } else {
+      uint32_t r = 65536 - t;
+      p = 65536 - ((r * r) >> 16) * 8 / 3;
+    }
+    break;
+  default:
+    p = t;
+    break;
+  }
+  return p > 65535 ? 65535 : p;
+}
+
+void HSC_Turnouts::writePulse(uint8_t index, uint16_t us) {
+  turnouts[index].currentUs = us;
+  ledcWrite(index, ((uint32_t)us << SERVO_RESOLUTION_BITS) / SERVO_PERIOD_US);
+}
+
+void HSC_Turnouts::loop() {
+  if (!started) {
+    return;
+  }
+  bool connected = base.getMqttClient().connected();
+  for (uint8_t i = 0; i < turnoutCount; i++) {
+    Turnout &t = turnouts[i];
+    portENTER_CRITICAL(&mux);
+    bool changed = t.changed && connected;
+    if (changed) {
+      t.changed = false;
+    }
+    portEXIT_CRITICAL(&mux);
+    if (changed) {
+      publishState(i);
+    }
+  }
+
+  persist();
+}
+
+void HSC_Turnouts::persist() {
+  uint16_t mask = 0;
+  for (uint8_t i = 0; i < turnoutCount; i++) {
+    if (turnouts[i].moving) {
+      return;
+    }
+    if (turnouts[i].thrown) {
+      mask |= 1 << i;
+    }
+  }
+  // Unchanged values cost nothing; the store commits on its own schedule
+  base.getStore().setUInt(STORE_KEY, mask);
+}
+
+void HSC_Turnouts::publishState(uint8_t index) {
+  const Turnout &t = turnouts[index];
+  const char *state = t.moving ? "MOVING" : t.thrown ? "THROWN" : "CLOSED";
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), "turnout/%u", index);
+  char topic[HSC_Base::TOPIC_MAX];
+  base.deviceTopic(topic, sizeof(topic), suffix);
+  base.getMqttClient().publish(topic, state, true);
+}
+
+void HSC_Turnouts::handleCommand(const char *topic, const uint8_t *payload,
+                                 unsigned int length) {
+  // .../turnout/{n}/set
+  const char *p = strstr(topic, "/turnout/");
+  if (p == nullptr) {
+    return;
+  }
+  int index = atoi(p + strlen("/turnout/"));
+  char value[16];
+  size_t n = length < sizeof(value) - 1 ? length : sizeof(value) - 1;
+  memcpy(value, payload, n);
+  value[n] = '\0';
+
+  if (strcasecmp(value, "THROWN") == 0) {
+    set(index, true);
+  } else if (strcasecmp(value, "CLOSED") == 0) {
+    set(index, false);
+  } else if (strcasecmp(value, "TOGGLE") == 0) {
+    toggle(index);
+  }
+}
@@ -0,0 +1,85 @@
+#ifndef HSC_TURNOUTS_H
+#define HSC_TURNOUTS_H
+
+#include "HSC_Base.h"
+#include <esp_timer.h>
+
+// Shape of a servo move between its closed and thrown positions
+enum TurnoutProfile : uint8_t {
+  PROFILE_LINEAR,    // Constant speed
+  PROFILE_TRAPEZOID, // Constant acceleration for the first and last quarter
+  PROFILE_EASE,      // Smoothstep, gentlest start and stop
+};
+
+struct TurnoutConfig {
+  int pin;
+  uint16_t closedUs;  // Servo pulse width at the closed end
+  uint16_t thrownUs;  // Servo pulse width at the thrown end
+  uint16_t travelMs;  // Duration of a full closed-to-thrown move
+  TurnoutProfile profile;
+  bool releaseWhenIdle; // Stop pulses once settled, so servos don't buzz
+};
+
+// Turnout servo driver. Each servo gets its own LEDC channel at 50 Hz;
+// a 5 ms esp_timer steps every moving servo along its motion profile, so
+// any number of turnouts move at once and loop() never blocks.
+//
+// Commands are accepted on HSC/devices/{id}/turnout/{n}/set (CLOSED,
+// THROWN or TOGGLE) and the state is published retained on
+// HSC/devices/{id}/turnout/{n} (MOVING, then CLOSED or THROWN). The last
+// commanded position is kept in the application store (HSC_Store) and
+// restored without motion at boot.
+class HSC_Turnouts {
+public:
+  static const uint8_t MAX_TURNOUTS = 16; // One per LEDC channel
+
+  explicit HSC_Turnouts(HSC_Base &base);
+
+  // Register a turnout before begin(); returns its index or -1
+  int add(int pin, uint16_t closedUs = 1200, uint16_t thrownUs = 1800,
+          uint16_t travelMs = 800, TurnoutProfile profile = PROFILE_TRAPEZOID);
+  int add(const TurnoutConfig &config);
+
+  bool begin();
+  void loop();
+
+  bool set(uint8_t index, bool thrown);
+  bool toggle(uint8_t index);
+  bool isThrown(uint8_t index) const;
+  bool isMoving(uint8_t index) const;
+  uint8_t count() const { return turnoutCount; }
+
+private:
+  struct Turnout {
+    TurnoutConfig config;
+    bool thrown;           // Commanded end position
+    uint16_t fromUs;       // Pulse width when the current move started
+    uint16_t toUs;         // Pulse width at the end of the current move
+    uint16_t currentUs;    // Last pulse width written
+    uint32_t durationTicks;
+    uint32_t elapsedTicks;
+    bool moving;
+    bool active;           // Pulses are being output
+    uint16_t idleTicks;
+    bool changed;          // State topic needs publishing
+  };
+
+  HSC_Base &base;
+  Turnout turnouts[MAX_TURNOUTS];
+  uint8_t turnoutCount = 0;
+  esp_timer_handle_t stepTimer = nullptr;
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+  bool started = false;
+
+  static void onStep(void *arg);
+  void step();
+  void writePulse(uint8_t index, uint16_t us);
+  void handleCommand(const char *topic, const uint8_t *payload,
+                     unsigned int length);
+  void publishState(uint8_t index);
+  void persist();
+
+  static uint16_t profilePosition(TurnoutProfile profile, uint32_t t);
+};
+
+#endif
@@ -5,7 +5,7 @@
 static const char FW_VERSION[] = "0.2.0"; // Base Template
 
 // --- Board Type ---
-// Override these in your project's src/config.h
+// Defaults until the project calls HSC_Base::setBoardInfo()
 static const char BOARD_TYPE_DESC[] =
     "HSC Base Device";                         // Full description for web UI
 static const char BOARD_TYPE_SHORT[] = "BASE"; // Short name for MQTT topics
@@ -19,14 +19,38 @@ static const char *MQTT_SERVER = "mqtt.internal";
 static const int MQTT_PORT = 1883;
 static const char *MQTT_USER = "";     // Leave empty if not needed
 static const char *MQTT_PASSWORD = ""; // Leave empty if not needed
+static const char *MQTT_SERVER2 = "";  // Secondary broker, empty for none
+static const int MQTT_PORT2 = 1883;
 
 // --- Device Configuration ---
 // CHANGE THIS ID FOR EACH BOARD
 static const int BOARD_ID = 0;
 
 // --- Pin Definitions ---
-// AP Mode Button
-static const int PIN_AP_BUTTON = 4;
+// Pins belong to the board, see HSC_Board.h
+
+// --- Keep-alive API Server ---
+// JSON GET APIs are also served here over persistent connections
+static const int API_KEEPALIVE_PORT = 8080;
+static const int API_KEEPALIVE_IDLE_MS = 15000;    // Close idle connections
+static const int API_KEEPALIVE_MAX_REQUESTS = 100; // Per connection
+// Connection limit is HSC_Board::API_MAX_CLIENTS
+
+// --- Last-known-good Configuration ---
+// A config saved from the web UI must bring up WiFi and MQTT within this
+// window after the reboot, or the previous one is restored
+static const int CONFIG_TRIAL_MS = 60000;
+static const int CONFIG_TRIAL_BOOTS = 3; // Crash loop limit during a trial
+
+// --- Network Statistics ---
+// Stack and WiFi counters published to HSC/devices/{id}/netstats
+static const int NETSTATS_INTERVAL_MS = 60000;
+
+// --- Stall Detector ---
+// The loop task and AsyncTCP handlers are reported (with a backtrace) when
+// blocked for longer than the budget, and the board restarts past the limit
+static const int STALL_BUDGET_MS = 2000;
+static const int STALL_RESTART_MS = 30000;
 
 // --- OTA Update ---
 // static const char *UPDATE_URL =
@@ -14,6 +14,8 @@ Usage: $0 [OPTIONS]
 Options:
   -p, --port PORT       Specify port to monitor:
                           1 or 2        - Monitor first or second detected port
+                          all or *      - Monitor every detected port as one merged
+                                          stream (see monitor_all.py)
                           /dev/ttyUSB0  - Monitor specific port path
                         If not specified, will use default or prompt if multiple ports found
   -b, --baud RATE       Set baud rate (default: 115200)
@@ -27,6 +29,7 @@ Examples:
   $0 -p /dev/ttyUSB0    # Monitor specific port
   $0 -p 1 -b 9600       # Monitor first port at 9600 baud
   $0 -p 1 -f esp32_exception_decoder  # Monitor with exception decoder
+  $0 -p all             # Monitor all ports, tagged by device id
 EOF
     exit 0
 }
@@ -123,6 +126,11 @@ get_monitor_port() {
     echo "$monitor_port"
 }
 
+# --- Monitor all ports through the aggregating monitor ---
+if [ "$PORT_OPTION" = "all" ] || [ "$PORT_OPTION" = "*" ]; then
+    exec python3 "$(dirname "$0")/monitor_all.py" --baud "$BAUD_RATE"
+fi
+
 # --- Get the port to monitor ---
 MONITOR_PORT=$(get_monitor_port)
 
@@ -0,0 +1,245 @@
+#!/usr/bin/env python3
+"""Monitor several HSC boards at once as one merged, ordered stream.
+
+Every port is read on its own thread. Lines are stamped with host time on
+arrival and printed in timestamp order, tagged with the board's device id
+(parsed from the ``Hostname:`` line of the boot banner printed by
+``setupWifi()``) or with the port name until the banner has been seen.
+
+Panic backtraces (``Backtrace: 0x...:0x... ...``) are decoded with
+``xtensa-esp32-elf-addr2line`` against the ELF selected for that board. ELFs
+can be given per port or per device id prefix, so boards running different
+firmware on the same bench decode correctly. Boards built with
+``-DHSC_LOG_COMPACT`` emit binary log frames, which are decoded with the same
+ELF (see hsc_logdecode.py).
+"""
+
+import argparse
+import glob
+import heapq
+import os
+import re
+import subprocess
+import sys
+import threading
+import time
+import queue
+
+from hsc_logdecode import Elf, LogStream
+
+try:
+    import serial
+except ImportError:
+    sys.stderr.write("ERROR: pyserial is required (pip install pyserial)\n")
+    sys.exit(1)
+
+PORT_PATTERNS = ["/dev/ttyUSB*", "/dev/ttyACM*", "/dev/cu.usbserial*", "/dev/cu.SLAB_USBtoUART*"]
+
+HOSTNAME_RE = re.compile(r"^Hostname:\s*(\S+)")
+BACKTRACE_RE = re.compile(r"Backtrace:((?:\s*0x[0-9a-fA-F]+:0x[0-9a-fA-F]+)+)")
+
+COLORS = ["\033[36m", "\033[33m", "\033[35m", "\033[32m", "\033[34m", "\033[31m"]
+RESET = "\033[0m"
+
+# Lines are held briefly so output from different ports is merged in
+# host-timestamp order even when reader threads are scheduled unevenly.
+REORDER_WINDOW_S = 0.05
+
+
+def detect_ports():
+    ports = []
+    for pattern in PORT_PATTERNS:
+        ports.extend(sorted(glob.glob(pattern)))
+    return ports
+
+
+def find_addr2line():
+    candidates = glob.glob(os.path.expanduser(
+        "~/.platformio/packages/toolchain-xtensa-esp32*/bin/xtensa-esp32-elf-addr2line"))
+    for name in candidates + ["xtensa-esp32-elf-addr2line"]:
+        try:
+            subprocess.run([name, "--version"], stdout=subprocess.DEVNULL,
+                           stderr=subprocess.DEVNULL, check=True)
+            return name
+        except (OSError, subprocess.CalledProcessError):
+            continue
+    return None
+
+
+def default_elf():
+    if not os.path.exists("platformio.ini"):
+        return None
+    with open("platformio.ini") as f:
+        match = re.search(r"^\[env:([^\]]+)\]", f.read(), re.MULTILINE)
+    if not match:
+        return None
+    path = os.path.join(".pio", "build", match.group(1), "firmware.elf")
+    return path if os.path.exists(path) else None
+
+
+class Board:
+    """State for one serial port."""
+
+    def __init__(self, port, color):
+        self.port = port
+        self.name = os.path.basename(port)
+        self.device_id = None
+        self.color = color
+        self.stream = LogStream()
+
+    @property
+    def tag(self):
+        return self.device_id or self.name
+
+
+class Monitor:
+    def __init__(self, args):
+        self.args = args
+        self.lines = queue.Queue()
+        self.stop = threading.Event()
+        self.elf_map = {}
+        for spec in args.elf or []:
+            key, sep, path = spec.partition("=")
+            if sep:
+                self.elf_map[key] = path
+            else:
+                self.elf_map["*"] = spec
+        if "*" not in self.elf_map:
+            fallback = default_elf()
+            if fallback:
+                self.elf_map["*"] = fallback
+        self.addr2line = args.addr2line or find_addr2line()
+        self.elfs = {}
+
+    def elf_for(self, board):
+        if board.port in self.elf_map:
+            return self.elf_map[board.port]
+        if board.device_id:
+            # Longest device id prefix wins (e.g. "yard" or "yard-a1b2c3")
+            matches = [k for k in self.elf_map if k != "*" and board.device_id.startswith(k)]
+            if matches:
+                return self.elf_map[max(matches, key=len)]
+        return self.elf_map.get("*")
+
+    def load_elf(self, board):
+        path = self.elf_for(board)
+        if not path:
+            return None
+        if path not in self.elfs:
+            try:
+                self.elfs[path] = Elf(path)
+            except (OSError, ValueError):
+                self.elfs[path] = None
+        return self.elfs[path]
+
+    def decode_backtrace(self, board, frames):
+        elf = self.elf_for(board)
+        if not elf or not self.addr2line:
+            return []
+        pcs = [f.split(":")[0] for f in frames.split()]
+        try:
+            out = subprocess.run([self.addr2line, "-pfiaC", "-e", elf] + pcs,
+                                 stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                                 universal_newlines=True, timeout=10).stdout
+        except (OSError, subprocess.TimeoutExpired):
+            return []
+        return ["  " + line for line in out.splitlines() if line.strip()]
+
+    def reader(self, board):
+        while not self.stop.is_set():
+            try:
+                with serial.Serial(board.port, self.args.baud, timeout=0.2) as ser:
+                    while not self.stop.is_set():
+                        chunk = ser.read(ser.in_waiting or 1)
+                        if not chunk:
+                            continue
+                        now = time.time()
+                        # The ELF can change once the banner names the device
+                        board.stream.elf = self.load_elf(board)
+                        for line in board.stream.feed(chunk):
+                            self.lines.put((now, board, line))
+            except serial.SerialException as e:
+                self.lines.put((time.time(), board, "[port error: %s]" % e))
+                # Board was unplugged or reset into the bootloader; retry
+                self.stop.wait(1.0)
+
+    def emit(self, ts, board, line):
+        match = HOSTNAME_RE.match(line)
+        if match:
+            board.device_id = match.group(1)
+
+        stamp = time.strftime("%H:%M:%S", time.localtime(ts)) + ".%03d" % (ts % 1 * 1000)
+        if self.args.no_color:
+            prefix = "%s [%s]" % (stamp, board.tag)
+        else:
+            prefix = "%s %s[%s]%s" % (stamp, board.color, board.tag, RESET)
+        out = [prefix + " " + line]
+
+        match = BACKTRACE_RE.search(line)
+        if match:
+            out.extend(prefix + " " + l for l in self.decode_backtrace(board, match.group(1)))
+
+        text = "\n".join(out)
+        print(text, flush=True)
+        if self.log:
+            self.log.write(text + "\n")
+            self.log.flush()
+
+    def run(self, ports):
+        self.log = open(self.args.log, "a") if self.args.log else None
+        boards = [Board(p, COLORS[i % len(COLORS)]) for i, p in enumerate(ports)]
+        for board in boards:
+            threading.Thread(target=self.reader, args=(board,), daemon=True).start()
+
+        heap = []
+        seq = 0
+        try:
+            while True:
+                try:
+                    ts, board, line = self.lines.get(timeout=REORDER_WINDOW_S)
+                    heapq.heappush(heap, (ts, seq, board, line))
+                    seq += 1
+                except queue.Empty:
+                    pass
+                cutoff = time.time() - REORDER_WINDOW_S
+                while heap and heap[0][0] <= cutoff:
+                    ts, _, board, line = heapq.heappop(heap)
+                    self.emit(ts, board, line)
+        except KeyboardInterrupt:
+            self.stop.set()
+            while heap:
+                ts, _, board, line = heapq.heappop(heap)
+                self.emit(ts, board, line)
+        finally:
+            if self.log:
+                self.log.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Monitor all connected HSC boards")
+    parser.add_argument("ports", nargs="*", help="Ports to monitor (default: all detected)")
+    parser.add_argument("-b", "--baud", type=int, default=115200, help="Baud rate")
+    parser.add_argument("-e", "--elf", action="append",
+                        help="ELF for backtrace decoding: PATH, PORT=PATH or "
+                             "DEVICE_PREFIX=PATH (repeatable)")
+    parser.add_argument("--addr2line", help="Path to xtensa-esp32-elf-addr2line")
+    parser.add_argument("-o", "--log", help="Also append the merged stream to a file")
+    parser.add_argument("--no-color", action="store_true", help="Disable colored tags")
+    args = parser.parse_args()
+
+    ports = args.ports or detect_ports()
+    if not ports:
+        sys.stderr.write("ERROR: No serial ports detected!\n")
+        return 1
+
+    monitor = Monitor(args)
+    print("Monitoring %d port(s): %s" % (len(ports), " ".join(ports)))
+    if not monitor.addr2line:
+        print("addr2line not found; backtraces will not be decoded")
+    print("Press Ctrl+C to exit\n")
+    monitor.run(ports)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
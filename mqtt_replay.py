@@ -0,0 +1,374 @@
+#!/usr/bin/env python3
+"""Record and replay HSC MQTT traffic.
+
+Records every message under a topic filter (default ``HSC/#``) into a compact
+binary capture, and replays a capture against a broker at real time or an
+accelerated rate while checking device responses against assertions.
+
+Capture format (all integers are unsigned LEB128 varints):
+
+    header   : b"HSCR" + version byte (1)
+    record   : delta_ms, flags, topic_ref, payload_len, payload bytes
+    flags    : bit0-1 = QoS, bit2 = retain, bit3 = new topic follows
+    topic_ref: index into the topic table; when bit3 is set the record carries
+               topic_len + topic bytes and the topic is appended to the table
+
+Timestamps are deltas from the previous record, so a night of traffic with a
+few hundred distinct topics costs a handful of bytes per message plus payload.
+
+Assertion files are JSON lists of rules:
+
+    [
+      {"when": "HSC/devices/+/config", "expect": "HSC/devices/+/status",
+       "payload": "online", "within_ms": 2000}
+    ]
+
+Each replayed message that matches ``when`` (and optional ``when_payload``
+regex) arms a check that a message matching ``expect`` (and optional
+``payload`` regex) arrives within ``within_ms``. Replayed messages are not
+counted as responses.
+"""
+
+import argparse
+import json
+import re
+import sys
+import threading
+import time
+
+try:
+    import paho.mqtt.client as mqtt
+except ImportError:
+    sys.stderr.write("ERROR: paho-mqtt is required (pip install paho-mqtt)\n")
+    sys.exit(1)
+
+MAGIC = b"HSCR"
+VERSION = 1
+
+FLAG_QOS_MASK = 0x03
+FLAG_RETAIN = 0x04
+FLAG_NEW_TOPIC = 0x08
+
+
+# --- Varint helpers ---
+def write_varint(out, value):
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.write(bytes((byte | 0x80,)))
+        else:
+            out.write(bytes((byte,)))
+            return
+
+
+def read_varint(inp):
+    shift = 0
+    value = 0
+    while True:
+        raw = inp.read(1)
+        if not raw:
+            raise EOFError
+        byte = raw[0]
+        value |= (byte & 0x7F) << shift
+        if not byte & 0x80:
+            return value
+        shift += 7
+
+
+# --- Capture file ---
+class CaptureWriter:
+    def __init__(self, path):
+        self._file = open(path, "wb")
+        self._file.write(MAGIC + bytes((VERSION,)))
+        self._topics = {}
+        self._last_ms = None
+        self._lock = threading.Lock()
+        self.count = 0
+
+    def write(self, t_ms, topic, payload, qos, retain):
+        with self._lock:
+            delta = 0 if self._last_ms is None else max(0, t_ms - self._last_ms)
+            self._last_ms = t_ms
+            flags = (qos & FLAG_QOS_MASK) | (FLAG_RETAIN if retain else 0)
+            ref = self._topics.get(topic)
+            if ref is None:
+                ref = len(self._topics)
+                self._topics[topic] = ref
+                flags |= FLAG_NEW_TOPIC
+            write_varint(self._file, delta)
+            write_varint(self._file, flags)
+            write_varint(self._file, ref)
+            if flags & FLAG_NEW_TOPIC:
+                encoded = topic.encode("utf-8")
+                write_varint(self._file, len(encoded))
+                self._file.write(encoded)
+            write_varint(self._file, len(payload))
+            self._file.write(payload)
+            self.count += 1
+
+    def close(self):
+        with self._lock:
+            self._file.close()
+
+
+def read_capture(path):
+    """Yield (t_ms, topic, payload, qos, retain) tuples from a capture."""
+    with open(path, "rb") as inp:
+        header = inp.read(len(MAGIC) + 1)
+        if header[: len(MAGIC)] != MAGIC:
+            raise ValueError("%s is not an HSC capture" % path)
+        if header[len(MAGIC)] != VERSION:
+            raise ValueError("Unsupported capture version %d" % header[len(MAGIC)])
+        topics = []
+        t_ms = 0
+        while True:
+            try:
+                delta = read_varint(inp)
+            except EOFError:
+                return
+            flags = read_varint(inp)
+            ref = read_varint(inp)
+            if flags & FLAG_NEW_TOPIC:
+                topic_len = read_varint(inp)
+                topics.append(inp.read(topic_len).decode("utf-8"))
+            payload_len = read_varint(inp)
+            payload = inp.read(payload_len)
+            t_ms += delta
+            yield t_ms, topics[ref], payload, flags & FLAG_QOS_MASK, bool(
+                flags & FLAG_RETAIN
+            )
+
+
+# --- MQTT helpers ---
+def make_client(client_id):
+    try:
+        return mqtt.Client(mqtt.CallbackAPIVersion.VERSION1, client_id=client_id)
+    except AttributeError:
+        return mqtt.Client(client_id=client_id)
+
+
+def connect(client, args):
+    if args.user:
+        client.username_pw_set(args.user, args.password)
+    client.connect(args.broker, args.port, keepalive=30)
+
+
+def now_ms():
+    return int(time.monotonic() * 1000)
+
+
+# --- Commands ---
+def cmd_record(args):
+    writer = CaptureWriter(args.output)
+    client = make_client("hsc-recorder-%d" % (now_ms() & 0xFFFF))
+
+    def on_connect(c, userdata, flags, rc):
+        if rc != 0:
+            sys.stderr.write("Connect failed, rc=%d\n" % rc)
+            return
+        for topic in args.topic:
+            c.subscribe(topic, qos=1)
+        print("Recording %s to %s (Ctrl+C to stop)" % (", ".join(args.topic), args.output))
+
+    def on_message(c, userdata, msg):
+        writer.write(now_ms(), msg.topic, msg.payload, msg.qos, msg.retain)
+        if args.verbose:
+            print("%s %s" % (msg.topic, msg.payload[:80]))
+
+    client.on_connect = on_connect
+    client.on_message = on_message
+    connect(client, args)
+
+    deadline = time.monotonic() + args.duration if args.duration else None
+    client.loop_start()
+    try:
+        while deadline is None or time.monotonic() < deadline:
+            time.sleep(0.2)
+    except KeyboardInterrupt:
+        pass
+    client.loop_stop()
+    client.disconnect()
+    writer.close()
+    print("Recorded %d messages" % writer.count)
+    return 0
+
+
+def cmd_dump(args):
+    for t_ms, topic, payload, qos, retain in read_capture(args.capture):
+        flags = "q%d%s" % (qos, "r" if retain else "")
+        print("%10.3f %-4s %s %s" % (t_ms / 1000.0, flags, topic,
+                                     payload.decode("utf-8", "replace")))
+    return 0
+
+
+class Assertion:
+    def __init__(self, spec):
+        self.when = spec["when"]
+        self.when_payload = re.compile(spec["when_payload"]) if "when_payload" in spec else None
+        self.expect = spec["expect"]
+        self.payload = re.compile(spec["payload"]) if "payload" in spec else None
+        self.within_ms = int(spec.get("within_ms", 1000))
+        self.passed = 0
+        self.failed = 0
+        self.latencies = []
+
+    def triggers(self, topic, payload):
+        if not mqtt.topic_matches_sub(self.when, topic):
+            return False
+        return self.when_payload is None or bool(
+            self.when_payload.search(payload.decode("utf-8", "replace")))
+
+    def satisfied_by(self, topic, payload):
+        if not mqtt.topic_matches_sub(self.expect, topic):
+            return False
+        return self.payload is None or bool(
+            self.payload.search(payload.decode("utf-8", "replace")))
+
+    def describe(self):
+        return "%s -> %s within %d ms" % (self.when, self.expect, self.within_ms)
+
+
+def cmd_replay(args):
+    assertions = []
+    if args.assert_file:
+        with open(args.assert_file) as f:
+            assertions = [Assertion(spec) for spec in json.load(f)]
+
+    pending = []  # (deadline_ms, armed_ms, assertion)
+    lock = threading.Lock()
+    sent = set()  # (topic, payload) pairs in flight from the replayer
+
+    client = make_client("hsc-replayer-%d" % (now_ms() & 0xFFFF))
+
+    def on_message(c, userdata, msg):
+        key = (msg.topic, bytes(msg.payload))
+        t = now_ms()
+        with lock:
+            if key in sent:
+                sent.discard(key)
+                return
+            for entry in list(pending):
+                deadline, armed, rule = entry
+                if rule.satisfied_by(msg.topic, msg.payload):
+                    rule.passed += 1
+                    rule.latencies.append(t - armed)
+                    pending.remove(entry)
+
+    def expire(t):
+        with lock:
+            for entry in list(pending):
+                deadline, armed, rule = entry
+                if t > deadline:
+                    rule.failed += 1
+                    pending.remove(entry)
+                    if args.verbose:
+                        print("FAIL %s" % rule.describe())
+
+    client.on_message = on_message
+    connect(client, args)
+    if assertions:
+        for rule in assertions:
+            client.subscribe(rule.expect, qos=1)
+    client.loop_start()
+
+    start = now_ms()
+    first_ms = None
+    count = 0
+    try:
+        for t_ms, topic, payload, qos, retain in read_capture(args.capture):
+            if args.topic and not any(mqtt.topic_matches_sub(f, topic) for f in args.topic):
+                continue
+            if first_ms is None:
+                first_ms = t_ms
+            target = start + (t_ms - first_ms) / args.speed
+            while True:
+                t = now_ms()
+                expire(t)
+                if t >= target:
+                    break
+                time.sleep(min(0.05, (target - t) / 1000.0))
+            with lock:
+                sent.add((topic, bytes(payload)))
+                for rule in assertions:
+                    if rule.triggers(topic, payload):
+                        t = now_ms()
+                        pending.append((t + rule.within_ms, t, rule))
+            client.publish(topic, payload, qos=qos, retain=retain and not args.no_retain)
+            count += 1
+            if args.verbose:
+                print("%8.3f %s" % ((now_ms() - start) / 1000.0, topic))
+    except KeyboardInterrupt:
+        pass
+
+    # Let outstanding assertions settle
+    settle_until = now_ms() + max([a.within_ms for a in assertions] + [0])
+    while True:
+        with lock:
+            outstanding = len(pending)
+        if not outstanding or now_ms() > settle_until:
+            break
+        time.sleep(0.05)
+    expire(float("inf"))
+
+    client.loop_stop()
+    client.disconnect()
+
+    elapsed = (now_ms() - start) / 1000.0
+    print("Replayed %d messages in %.1f s (x%g)" % (count, elapsed, args.speed))
+    failures = 0
+    for rule in assertions:
+        lat = sorted(rule.latencies)
+        p50 = lat[len(lat) // 2] if lat else 0
+        worst = lat[-1] if lat else 0
+        status = "OK  " if rule.failed == 0 else "FAIL"
+        print("%s %s: %d passed, %d failed (p50 %d ms, max %d ms)"
+              % (status, rule.describe(), rule.passed, rule.failed, p50, worst))
+        failures += rule.failed
+    return 1 if failures else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Record and replay HSC MQTT traffic")
+    parser.add_argument("-H", "--broker", default="mqtt.internal", help="MQTT broker host")
+    parser.add_argument("-P", "--port", type=int, default=1883, help="MQTT broker port")
+    parser.add_argument("-u", "--user", default="", help="MQTT user")
+    parser.add_argument("-w", "--password", default="", help="MQTT password")
+    parser.add_argument("-v", "--verbose", action="store_true", help="Print each message")
+    sub = parser.add_subparsers(dest="command")
+    sub.required = True
+
+    rec = sub.add_parser("record", help="Record traffic to a capture file")
+    rec.add_argument("output", help="Capture file to write")
+    rec.add_argument("-t", "--topic", action="append",
+                     help="Topic filter (repeatable, default HSC/#)")
+    rec.add_argument("-d", "--duration", type=float, default=0,
+                     help="Stop after N seconds (default: until Ctrl+C)")
+    rec.set_defaults(func=cmd_record)
+
+    rep = sub.add_parser("replay", help="Replay a capture against a broker")
+    rep.add_argument("capture", help="Capture file to replay")
+    rep.add_argument("-s", "--speed", type=float, default=1.0,
+                     help="Replay speed multiplier (default 1.0)")
+    rep.add_argument("-t", "--topic", action="append",
+                     help="Only replay topics matching this filter (repeatable)")
+    rep.add_argument("-a", "--assert", dest="assert_file",
+                     help="JSON assertion file")
+    rep.add_argument("--no-retain", action="store_true",
+                     help="Clear the retain flag on replayed messages")
+    rep.set_defaults(func=cmd_replay)
+
+    dump = sub.add_parser("dump", help="Print a capture as text")
+    dump.add_argument("capture", help="Capture file to print")
+    dump.set_defaults(func=cmd_dump)
+
+    args = parser.parse_args()
+    if args.command == "record" and not args.topic:
+        args.topic = ["HSC/#"]
+    if args.command == "replay" and args.speed <= 0:
+        parser.error("--speed must be positive")
+    return args.func(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,221 @@
+#!/usr/bin/env python3
+"""Generate an NVS partition image holding an HSC board's configuration.
+
+The image contains the ``yarddetector`` namespace with the same keys and types
+that ``ConfigManager::save()`` writes through ``Preferences``, so a freshly
+flashed board boots straight into its configured identity instead of the
+defaults from ``config.h``. Keys that are not given are left out and fall back
+to the compiled defaults, exactly as they would on a board configured via the
+web UI.
+
+The writer follows the ESP-IDF NVS v2 page layout: 4096-byte pages, each with
+a 32-byte header, a 32-byte entry state bitmap and 126 32-byte entries. Strings
+are stored as a header entry followed by raw data entries in the same page.
+
+Also reads the NVS offset/size from a built ``partitions.bin`` so callers do
+not have to hard-code the partition layout.
+"""
+
+import argparse
+import struct
+import sys
+import zlib
+
+NAMESPACE = "yarddetector"
+
+PAGE_SIZE = 4096
+ENTRY_SIZE = 32
+ENTRIES_PER_PAGE = 126
+HEADER_SIZE = 32
+BITMAP_SIZE = 32
+
+PAGE_STATE_ACTIVE = 0xFFFFFFFE
+PAGE_STATE_FULL = 0xFFFFFFFC
+PAGE_VERSION_2 = 0xFE
+
+TYPE_U8 = 0x01
+TYPE_I32 = 0x14
+TYPE_STR = 0x21
+
+CHUNK_ANY = 0xFF
+
+# ConfigManager key name and NVS type for each provisioning field
+CONFIG_KEYS = [
+    ("wifi_ssid", "wifi_ssid", TYPE_STR),
+    ("wifi_password", "wifi_pass", TYPE_STR),
+    ("mqtt_server", "mqtt_srv", TYPE_STR),
+    ("mqtt_port", "mqtt_port", TYPE_I32),
+    ("mqtt_server2", "mqtt_srv2", TYPE_STR),
+    ("mqtt_port2", "mqtt_port2", TYPE_I32),
+    ("mqtt_user", "mqtt_user", TYPE_STR),
+    ("mqtt_password", "mqtt_pass", TYPE_STR),
+    ("board_id", "board_id", TYPE_I32),
+    ("location", "location", TYPE_STR),
+]
+
+
+def crc32(data):
+    return zlib.crc32(bytes(data), 0xFFFFFFFF) & 0xFFFFFFFF
+
+
+class Page:
+    def __init__(self, seq):
+        self.data = bytearray(b"\xff" * PAGE_SIZE)
+        self.seq = seq
+        self.next_entry = 0
+
+    def free_entries(self):
+        return ENTRIES_PER_PAGE - self.next_entry
+
+    def write_entry(self, entry):
+        idx = self.next_entry
+        offset = HEADER_SIZE + BITMAP_SIZE + idx * ENTRY_SIZE
+        self.data[offset:offset + ENTRY_SIZE] = entry
+        # Entry state 0b10 = written
+        bit = idx * 2
+        self.data[HEADER_SIZE + bit // 8] &= ~(1 << (bit % 8)) & 0xFF
+        self.next_entry += 1
+
+    def finish(self, full):
+        state = PAGE_STATE_FULL if full else PAGE_STATE_ACTIVE
+        header = bytearray(b"\xff" * HEADER_SIZE)
+        struct.pack_into("<II", header, 0, state, self.seq)
+        header[8] = PAGE_VERSION_2
+        struct.pack_into("<I", header, 28, crc32(header[4:28]))
+        self.data[0:HEADER_SIZE] = header
+
+
+def make_entry(ns_index, type_code, span, key, payload):
+    entry = bytearray(b"\xff" * ENTRY_SIZE)
+    entry[0] = ns_index
+    entry[1] = type_code
+    entry[2] = span
+    entry[3] = CHUNK_ANY
+    encoded = key.encode("ascii")
+    if len(encoded) > 15:
+        raise ValueError("NVS key too long: %s" % key)
+    entry[8:24] = encoded + b"\x00" * (16 - len(encoded))
+    entry[24:32] = payload
+    struct.pack_into("<I", entry, 4, crc32(entry[0:4] + entry[8:32]))
+    return entry
+
+
+class NvsImage:
+    def __init__(self, size):
+        if size % PAGE_SIZE or size < 3 * PAGE_SIZE:
+            raise ValueError("NVS size must be a multiple of 4096 and >= 3 pages")
+        self.size = size
+        self.pages = [Page(0)]
+        self.namespaces = {}
+
+    def _reserve(self, count):
+        if self.pages[-1].free_entries() < count:
+            self.pages.append(Page(len(self.pages)))
+            # NVS needs one spare page to run garbage collection
+            if len(self.pages) * PAGE_SIZE > self.size - PAGE_SIZE:
+                raise ValueError("Data does not fit into the NVS partition")
+        return self.pages[-1]
+
+    def _namespace(self, name):
+        if name not in self.namespaces:
+            index = len(self.namespaces) + 1
+            payload = bytes((index,)) + b"\xff" * 7
+            self._reserve(1).write_entry(make_entry(0, TYPE_U8, 1, name, payload))
+            self.namespaces[name] = index
+        return self.namespaces[name]
+
+    def put_int(self, namespace, key, value):
+        ns = self._namespace(namespace)
+        payload = struct.pack("<i", int(value)) + b"\xff" * 4
+        self._reserve(1).write_entry(make_entry(ns, TYPE_I32, 1, key, payload))
+
+    def put_string(self, namespace, key, value):
+        ns = self._namespace(namespace)
+        data = value.encode("utf-8") + b"\x00"
+        data_entries = (len(data) + ENTRY_SIZE - 1) // ENTRY_SIZE
+        if data_entries + 1 > ENTRIES_PER_PAGE:
+            raise ValueError("String too long for one NVS page: %s" % key)
+        payload = struct.pack("<HHI", len(data), 0xFFFF, crc32(data))
+        page = self._reserve(data_entries + 1)
+        page.write_entry(make_entry(ns, TYPE_STR, data_entries + 1, key, payload))
+        padded = data + b"\xff" * (data_entries * ENTRY_SIZE - len(data))
+        for i in range(data_entries):
+            page.write_entry(padded[i * ENTRY_SIZE:(i + 1) * ENTRY_SIZE])
+
+    def to_bytes(self):
+        out = bytearray()
+        for i, page in enumerate(self.pages):
+            page.finish(full=i < len(self.pages) - 1)
+            out += page.data
+        out += b"\xff" * (self.size - len(out))
+        return bytes(out)
+
+
+def build_config_image(values, size):
+    """Build an image from a dict of ConfigManager field -> value."""
+    image = NvsImage(size)
+    if not values.get("board_id"):
+        raise ValueError("board_id is required (ConfigManager ignores NVS without it)")
+    for field, key, type_code in CONFIG_KEYS:
+        value = values.get(field)
+        if value is None or value == "":
+            continue
+        if type_code == TYPE_I32:
+            image.put_int(NAMESPACE, key, int(value))
+        else:
+            image.put_string(NAMESPACE, key, str(value))
+    return image.to_bytes()
+
+
+def find_partition(partitions_bin, label="nvs"):
+    """Return (offset, size) of a partition from a partitions.bin table."""
+    with open(partitions_bin, "rb") as f:
+        table = f.read()
+    for pos in range(0, len(table) - 31, 32):
+        magic, ptype, subtype, offset, size = struct.unpack_from("<HBBII", table, pos)
+        if magic != 0x50AA:
+            break
+        name = table[pos + 12:pos + 28].split(b"\x00")[0].decode("ascii", "replace")
+        # data/nvs, matched by label first and subtype as a fallback
+        if name == label or (label == "nvs" and ptype == 0x01 and subtype == 0x02):
+            return offset, size
+    raise ValueError("No '%s' partition in %s" % (label, partitions_bin))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate an HSC board NVS image")
+    parser.add_argument("-o", "--output", help="Output image file")
+    parser.add_argument("--size", default="0x5000", help="NVS partition size")
+    parser.add_argument("--partitions", help="Read NVS size from a built partitions.bin")
+    parser.add_argument("--print-offset", action="store_true",
+                        help="Print '<offset> <size>' of the NVS partition and exit")
+    for field, _, type_code in CONFIG_KEYS:
+        parser.add_argument("--" + field.replace("_", "-"), dest=field,
+                            type=int if type_code == TYPE_I32 else str)
+    args = parser.parse_args()
+
+    size = int(args.size, 0)
+    if args.partitions:
+        offset, size = find_partition(args.partitions)
+        if args.print_offset:
+            print("0x%x 0x%x" % (offset, size))
+            return 0
+    elif args.print_offset:
+        parser.error("--print-offset requires --partitions")
+
+    if not args.output:
+        parser.error("--output is required")
+
+    values = {field: getattr(args, field) for field, _, _ in CONFIG_KEYS}
+    try:
+        image = build_config_image(values, size)
+    except ValueError as e:
+        sys.stderr.write("ERROR: %s\n" % e)
+        return 1
+    with open(args.output, "wb") as f:
+        f.write(image)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,281 @@
+#!/usr/bin/env python3
+"""Layout-wide WiFi survey from HSC_RfSurvey scan results.
+
+Collects the scan each board publishes retained on
+``HSC/devices/{id}/rf/scan`` (optionally asking every board to scan first
+through ``HSC/rf/scan/set``) and prints:
+
+  * each board's link: serving AP, channel, RSSI and a grade
+  * each of the layout's APs with the boards it serves and its weakest link
+  * a channel recommendation per AP, from the interference its boards hear
+    on the non-overlapping channels 1, 6 and 11
+  * placement advice: boards stuck on a distant AP while a closer one of
+    the same network is heard, and APs whose coverage ends at a board
+  * the loudest foreign networks
+
+Interference is each board's ``interference_dbm`` for a channel: the power
+of every AP it hears on or overlapping that channel, its own AP excluded.
+For an AP it is averaged in mW over the boards it serves.
+"""
+
+import argparse
+import json
+import math
+import sys
+import time
+
+try:
+    import paho.mqtt.client as mqtt
+except ImportError:
+    sys.stderr.write("ERROR: paho-mqtt is required (pip install paho-mqtt)\n")
+    sys.exit(1)
+
+SCAN_TOPIC = "HSC/devices/+/rf/scan"
+FLEET_TRIGGER = "HSC/rf/scan/set"
+CANDIDATE_CHANNELS = (1, 6, 11)
+
+# Link grades by RSSI (dBm)
+GRADES = ((-60, "good"), (-70, "fair"), (-80, "weak"))
+WEAK_RSSI = -70
+# A channel change or roam has to gain at least this much to be suggested
+MIN_GAIN_DB = 3
+ROAM_GAIN_DB = 6
+
+
+# --- MQTT helpers ---
+def make_client(client_id):
+    try:
+        return mqtt.Client(mqtt.CallbackAPIVersion.VERSION1, client_id=client_id)
+    except AttributeError:
+        return mqtt.Client(client_id=client_id)
+
+
+def connect(client, args):
+    if args.user:
+        client.username_pw_set(args.user, args.password)
+    client.connect(args.broker, args.port, keepalive=30)
+
+
+def collect(args):
+    """Returns {device_id: scan document}, the latest from each board."""
+    scans = {}
+    started = time.time()
+
+    def on_connect(c, userdata, flags, rc):
+        if rc != 0:
+            sys.stderr.write("Connect failed, rc=%d\n" % rc)
+            return
+        c.subscribe(SCAN_TOPIC, qos=1)
+        if args.scan:
+            c.publish(FLEET_TRIGGER, "scan")
+
+    def on_message(c, userdata, msg):
+        device = msg.topic.split("/")[2]
+        try:
+            doc = json.loads(msg.payload.decode("utf-8"))
+        except ValueError:
+            sys.stderr.write("Ignoring malformed scan from %s\n" % device)
+            return
+        if args.scan and msg.retain:
+            # Kept only until the fresh scan arrives
+            doc["stale"] = True
+        scans[device] = doc
+        if args.verbose:
+            print("%6.1fs %s: %d APs" % (time.time() - started, device,
+                                         doc.get("visible", 0)))
+
+    client = make_client("hsc-rfsurvey-%d" % (int(started) & 0xFFFF))
+    client.on_connect = on_connect
+    client.on_message = on_message
+    connect(client, args)
+    client.loop_start()
+    try:
+        time.sleep(args.wait)
+    except KeyboardInterrupt:
+        pass
+    client.loop_stop()
+    client.disconnect()
+    return scans
+
+
+# --- Analysis ---
+def dbm_to_mw(dbm):
+    return 10 ** (dbm / 10.0)
+
+
+def mw_to_dbm(mw):
+    return 10 * math.log10(mw) if mw > 0 else None
+
+
+def grade(rssi):
+    for limit, name in GRADES:
+        if rssi >= limit:
+            return name
+    return "poor"
+
+
+def channel_interference(scan):
+    """{channel: mW} as heard by one board."""
+    result = {}
+    for entry in scan.get("channels", []):
+        dbm = entry.get("interference_dbm")
+        result[entry["channel"]] = dbm_to_mw(dbm) if dbm is not None else 0.0
+    return result
+
+
+def analyse(scans, ssid):
+    boards = {}
+    aps = {}
+    foreign = {}
+
+    for device, scan in sorted(scans.items()):
+        link = scan.get("link")
+        board = {"link": link, "stale": scan.get("stale", False),
+                 "interference": channel_interference(scan), "heard": {}}
+        boards[device] = board
+        for ap in scan.get("aps", []):
+            if ap["ssid"] == ssid:
+                board["heard"][ap["bssid"]] = ap["rssi"]
+            elif ap["ssid"]:
+                seen = foreign.setdefault(ap["bssid"], dict(ap, boards=0, loudest=-200))
+                seen["boards"] += 1
+                seen["loudest"] = max(seen["loudest"], ap["rssi"])
+        if not link or link.get("ssid") != ssid:
+            continue
+        board["heard"][link["bssid"]] = link["rssi"]
+        served = aps.setdefault(link["bssid"], {"channel": link["channel"], "boards": []})
+        served["boards"].append(device)
+
+    advice = []
+    for bssid, ap in sorted(aps.items()):
+        # Average what the AP's boards hear on each candidate channel
+        averages = {}
+        for ch in CANDIDATE_CHANNELS + (ap["channel"],):
+            total = sum(boards[d]["interference"].get(ch, 0.0) for d in ap["boards"])
+            averages[ch] = total / len(ap["boards"])
+        ap["interference"] = {ch: mw_to_dbm(mw) for ch, mw in averages.items()}
+        ap["weakest"] = min(boards[d]["link"]["rssi"] for d in ap["boards"])
+
+        current = averages[ap["channel"]]
+        best = min(CANDIDATE_CHANNELS, key=lambda ch: averages[ch])
+        gain = None
+        if averages[best] < current:
+            gain = (10 * math.log10(current / averages[best])
+                    if averages[best] > 0 else float("inf"))
+        if best != ap["channel"] and gain is not None and gain >= MIN_GAIN_DB:
+            ap["recommend"] = best
+            advice.append("AP %s: move from channel %d to %d (%s dB less interference "
+                          "at its boards)" % (bssid, ap["channel"], best,
+                                              "%.0f" % gain if gain != float("inf") else "all"))
+        if ap["weakest"] < WEAK_RSSI - 5:
+            edge = [d for d in ap["boards"] if boards[d]["link"]["rssi"] < WEAK_RSSI]
+            advice.append("AP %s: coverage ends at %s; move it towards them or add an AP"
+                          % (bssid, ", ".join(edge)))
+
+    for device, board in sorted(boards.items()):
+        link = board["link"]
+        if not link or link.get("ssid") != ssid or link["rssi"] >= WEAK_RSSI:
+            continue
+        best_bssid = max(board["heard"], key=board["heard"].get)
+        gain = board["heard"][best_bssid] - link["rssi"]
+        if best_bssid != link["bssid"] and gain >= ROAM_GAIN_DB:
+            advice.append("%s: stays on %s at %d dBm while %s is %d dB stronger; "
+                          "check roaming or lock it to the closer AP"
+                          % (device, link["bssid"], link["rssi"], best_bssid, gain))
+        else:
+            advice.append("%s: weak link (%d dBm) and no closer AP heard; place an AP "
+                          "near it" % (device, link["rssi"]))
+
+    loudest = sorted(foreign.values(), key=lambda ap: ap["loudest"], reverse=True)[:5]
+    return {"ssid": ssid, "boards": boards, "aps": aps, "foreign": loudest,
+            "advice": advice}
+
+
+def guess_ssid(scans):
+    counts = {}
+    for scan in scans.values():
+        link = scan.get("link")
+        if link:
+            counts[link["ssid"]] = counts.get(link["ssid"], 0) + 1
+    return max(counts, key=counts.get) if counts else None
+
+
+# --- Output ---
+def fmt_dbm(value):
+    return "%6.1f" % value if value is not None else "  none"
+
+
+def print_report(report):
+    print("Network: %s" % report["ssid"])
+    print()
+    print("%-20s %-17s %3s %5s  %s" % ("Board", "AP", "Ch", "RSSI", "Grade"))
+    for device, board in sorted(report["boards"].items()):
+        link = board["link"]
+        note = " (stale)" if board["stale"] else ""
+        if not link:
+            print("%-20s %-17s %3s %5s  %s%s" % (device, "-", "-", "-", "not linked", note))
+            continue
+        print("%-20s %-17s %3d %5d  %s%s" % (device, link["bssid"], link["channel"],
+                                            link["rssi"], grade(link["rssi"]), note))
+
+    print()
+    header = "".join(" %6s" % ("ch%d" % ch) for ch in CANDIDATE_CHANNELS)
+    print("%-17s %3s %6s %8s%s" % ("AP", "Ch", "Boards", "Weakest", header))
+    for bssid, ap in sorted(report["aps"].items()):
+        cells = "".join(" %s" % fmt_dbm(ap["interference"][ch]) for ch in CANDIDATE_CHANNELS)
+        print("%-17s %3d %6d %8d%s" % (bssid, ap["channel"], len(ap["boards"]),
+                                       ap["weakest"], cells))
+
+    if report["foreign"]:
+        print()
+        print("Loudest other networks:")
+        for ap in report["foreign"]:
+            print("  %-32s %-17s ch %2d  %4d dBm, heard by %d board(s)"
+                  % (ap["ssid"], ap["bssid"], ap["channel"], ap["loudest"], ap["boards"]))
+
+    print()
+    if report["advice"]:
+        print("Recommendations:")
+        for line in report["advice"]:
+            print("  - " + line)
+    else:
+        print("No changes recommended.")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build a layout-wide WiFi report "
+                                                 "from HSC board scans")
+    parser.add_argument("-H", "--broker", default="mqtt.internal", help="MQTT broker host")
+    parser.add_argument("-P", "--port", type=int, default=1883, help="MQTT broker port")
+    parser.add_argument("-u", "--user", default="", help="MQTT user")
+    parser.add_argument("-w", "--password", default="", help="MQTT password")
+    parser.add_argument("-s", "--scan", action="store_true",
+                        help="Ask every board to scan now instead of using the last results")
+    parser.add_argument("-t", "--wait", type=float, default=None,
+                        help="Seconds to collect results (default 3, or 15 with --scan)")
+    parser.add_argument("--ssid", help="Layout network (default: the one most boards use)")
+    parser.add_argument("--json", help="Also write the report to this file")
+    parser.add_argument("-v", "--verbose", action="store_true", help="Print each result")
+    args = parser.parse_args()
+    if args.wait is None:
+        args.wait = 15 if args.scan else 3
+
+    scans = collect(args)
+    if not scans:
+        sys.stderr.write("No scan results received\n")
+        return 1
+    ssid = args.ssid or guess_ssid(scans)
+    if not ssid:
+        sys.stderr.write("No board reports a link; pass --ssid\n")
+        return 1
+
+    report = analyse(scans, ssid)
+    print_report(report)
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(report, f, indent=2, sort_keys=True)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
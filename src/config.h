@@ -1,11 +1,8 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
-// Override the board type from the library defaults
-// This identifies what type of device this is
-#undef BOARD_TYPE_DESC
-#undef BOARD_TYPE_SHORT
-
+// This identifies what type of device this is; main.cpp passes it to the
+// library with setBoardInfo(). Pins come from the board, see HSC_Board.h.
 static const char BOARD_TYPE_DESC[] =
     "HSC NEW Device"; // Full description for web UI
 static const char BOARD_TYPE_SHORT[] =
@@ -15,9 +12,6 @@ static const char BOARD_TYPE_SHORT[] =
 static const char *UPDATE_URL =
     "http://www-srvr.internal/firmware/firmware_%BOARD_TYPE%.bin";
 
-// You can also override other defaults from lib/HSC_Base/src/config.h here
-// For example:
-#undef FW_VERSION
 static const char FW_VERSION[] = "0.2.0";
 
 #endif